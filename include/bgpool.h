@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Background threads for work an event loop must not wait for: slow or
+// blocking calls (malloc_trim, reading a child's output...). A job is a
+// function and its argument, run once by whichever thread is free, in
+// no particular order. It reports back by itself if it has to (e.g.
+// through the loop's mailbox + eventfd), the pool doesn't.
+struct BgJob {
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+struct BgPool {
+    std::vector<std::thread> threads;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<BgJob> jobs; // guarded by mu
+    bool stopping = false; // guarded by mu
+};
+
+// starts num_threads threads, they live until bg_pool_destroy
+void bg_pool_init(BgPool *pool, uint32_t num_threads);
+
+// the threads run every job still queued, then exit and are joined.
+// no bg_submit after this starts
+void bg_pool_destroy(BgPool *pool);
+
+// any thread. never blocks on the job
+void bg_submit(BgPool *pool, void (*fn)(void *arg), void *arg);
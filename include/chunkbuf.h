@@ -0,0 +1,74 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Byte stream as a singly linked chain of chunks, for a conn's input and
+// output. appends fill the tail chunk and link a new one when it's full,
+// consume unlinks drained chunks from the head: bytes are never moved or
+// realloc'ed, a 30 MB reply costs the same per byte as a small one.
+// - chunks are chunk_len, except one made by reserve_whole() for a
+//   single big request
+// - the data isn't contiguous: data()/head_size() is the first chunk,
+//   peek() copies across chunks, iov() lists them for sendmsg
+// - an empty chain holds no memory, freed chunk_len chunks go to a
+//   per-thread pool for the next one (the next recv, usually)
+const size_t chunk_len = 16 * 1024;
+
+class ChunkBuf {
+public:
+    ChunkBuf() = default;
+    ~ChunkBuf();
+    ChunkBuf(const ChunkBuf &) = delete;
+    ChunkBuf &operator=(const ChunkBuf &) = delete;
+
+    size_t size();
+    // allocated bytes of the chunks, used or not
+    size_t capacity();
+    // keep *counter += capacity() as it changes, until it's destroyed
+    void track(size_t *counter);
+
+    void append(const uint8_t *src, size_t len);
+    // writable space at the tail, so recv() can land in place: at least
+    // `len` bytes (a new chunk if the tail has less), write up to
+    // tail_room() there, then commit() what was actually written
+    uint8_t *reserve(size_t len);
+    size_t tail_room();
+    void commit(size_t len);
+    // consume(0) also drops a chunk reserve() added that got nothing
+    void consume(size_t len);
+
+    // the first chunk's bytes, NULL when empty
+    uint8_t *data();
+    size_t head_size();
+    // copy `len` bytes at offset `off`, false if the data is shorter
+    bool peek(size_t off, void *dst, size_t len);
+    // bytes [off, off + len) as iovecs, at most max_iov. returns how
+    // many were filled
+    size_t iov(size_t off, size_t len, struct iovec *out, size_t max_iov);
+    // the data and the next (total - size()) bytes appended will be in
+    // one chunk: if the head chunk can't hold it all, the data is copied
+    // once into a new chunk of total + extra bytes
+    void reserve_whole(size_t total, size_t extra);
+
+private:
+    struct Chunk {
+        Chunk *next;
+        size_t cap;
+        size_t begin; // data is [begin, end) of buf
+        size_t end;
+        uint8_t buf[0];
+    };
+    Chunk *head = NULL;
+    Chunk *tail = NULL;
+    size_t bytes = 0;
+    size_t cap_bytes = 0;
+    size_t *mem_counter = NULL;
+
+    Chunk *chunk_new(size_t cap);
+    void chunk_free(Chunk *chunk);
+    void push_chunk(size_t cap);
+};
+
+// bytes waiting in the calling thread's pool of freed chunks
+size_t chunk_pool_bytes();
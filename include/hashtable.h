@@ -1,6 +1,11 @@
 #pragma once
 #include <stdint.h>
 #include <string>
+#include <string_view>
+
+#include "value.h"
+#include "slab.h"
+#include "heap.h"
 
 struct HNode {
     struct HNode *next = NULL;
@@ -11,22 +16,71 @@ struct HTable {
     HNode **table = NULL; // array of slot (HNode *)
     size_t mask = 0; // choose N = 2^n, because it's the "% 2^n" is just "& 2^n - 1"
     size_t size = 0; // fixed size
+    // HMAP_SWISS only: a control byte per slot, and how many are tombstones
+    uint8_t *ctrl = NULL;
+    size_t deleted = 0;
+};
+
+enum HMapKind : uint8_t {
+    HMAP_CHAIN, // a chain per slot through HNode::next
+    HMAP_SWISS, // open addressing, control bytes probed 16 at a time
 };
 
 // in normal situation: we use new
+// both kinds resize incrementally: a few keys move from older to newer
+// on every insert, lookup and delete (and in hm_rehash_step when the
+// server is idle). it grows past the max load, and shrinks when a
+// delete leaves it under 1/8 full
 struct HMap {
+    HMapKind kind = HMAP_CHAIN; // pick before the first insert
     HTable older;
     HTable newer;
     size_t migrate_pos = 0;
 };
 
+// which key goes when a shard is over its memory limit
+enum EvictPolicy : uint8_t {
+    EVICT_NONE, // writes fail instead
+    EVICT_LRU, // the longest unused of a sample
+    EVICT_LFU, // the least used of a sample, by a decaying log counter
+};
+
+// entries come from the slab, the map only links them
 struct Cache {
     HMap map;
+    Slab slab;
+    std::vector<HeapItem> ttl; // deadlines (ms) of the keys that have one
+    size_t value_bytes = 0; // out of line values, the slab has the rest
+    EvictPolicy evict = EVICT_NONE;
+    // ms, set by the owner once per loop round. stamps Entry::access
+    uint64_t clock = 0;
+    uint64_t rng = 1; // xorshift state for the LFU counter and sampling
 };
 
+// One slab allocation per key: the node, the lengths, the key bytes, then
+// the value bytes if they're at most entry_inline_max. A bigger value is a
+// separate refcounted Value, so a GET reply can pin it while it's sent
+// (inline ones are copied into the reply right away); its pointer takes
+// the place of the value bytes.
+// the node is first, so the lookup's read of the node brings the key in too
 struct Entry {
-    std::string key;
-    std::string value;
+    HNode node;
+    uint32_t key_len;
+    uint32_t val_len; // inline value bytes, entry_val_ref if out of line
+    uint32_t heap_idx; // in Cache::ttl, heap_none without a TTL
+    // for eviction, see entry_touch. LRU: Cache::clock >> lru_clock_shift.
+    // LFU: minutes << 8 | log counter
+    uint32_t access;
+    char data[0]; // key, then the inline value or a Value *
+};
+
+const uint32_t entry_val_ref = (uint32_t)-1;
+const size_t entry_inline_max = 128;
+
+// probe for lookup/delete: points at the key bytes (e.g. inside the
+// request) instead of owning a copy, so looking up doesn't allocate
+struct LookupKey {
+    std::string_view key;
     HNode node;
 };
 
@@ -36,8 +90,56 @@ HNode *hm_lookup(HMap *map, HNode *node, bool (* eq)(HNode *, HNode *));
 void hm_insert(HMap *map, HNode *node);
 HNode *hm_delete(HMap *map, HNode *node, bool (* eq)(HNode *, HNode *));
 bool entry_eq(HNode *n1, HNode *n2);
+Entry *entry_new(Cache *cache, std::string_view key, uint64_t hashval, std::string_view val);
+// the entry must be out of the map already
+void entry_free(Cache *cache, Entry *entry);
+// new value for an entry in the map: in place if it still fits the same
+// slab class, otherwise a new entry takes its place in the map. returns
+// the entry that's in the map now
+Entry *entry_set_value(Cache *cache, Entry *entry, std::string_view val);
+std::string_view entry_key(Entry *entry);
+std::string_view entry_val(Entry *entry);
+// the out of line value (owns one ref), NULL if inline
+Value *entry_value(Entry *entry);
+// deadline in ms, 0 = none. the clock is the caller's
+void entry_set_deadline(Cache *cache, Entry *entry, uint64_t deadline);
+uint64_t entry_deadline(Cache *cache, Entry *entry);
+// a hit: stamp the access for the cache's eviction policy
+void entry_touch(Cache *cache, Entry *entry);
+// take it out of the map and free it
+void cache_remove(Cache *cache, Entry *entry);
+// remove the worst key of `samples` random ones by the cache's policy.
+// O(samples), not a walk of the map. false if nothing was found
+bool cache_evict(Cache *cache, size_t samples);
+// remove keys whose deadline is <= now, at most max_keys. return how many
+size_t cache_expire(Cache *cache, uint64_t now, size_t max_keys);
+// n1 is an Entry in the map, n2 a LookupKey
+bool entry_key_eq(HNode *n1, HNode *n2);
+// for a batch of lookups: prefetch every slot first, then every chain
+// head (this reads the slot, by then it's hopefully in cache), then do
+// the lookups. the misses overlap instead of coming one by one
+void hm_prefetch_slot(HMap *map, uint64_t hashval);
+void hm_prefetch_head(HMap *map, uint64_t hashval);
 void hm_foreach(HMap *map, bool (* fn)(HNode *, void *), void *);
+// visit the keys of one step of a walk: start with cursor 0, pass back
+// what it returns, 0 again means done. no state is kept in between, and
+// a key that's in the map the whole time is visited at least once even
+// across resizes (maybe twice). fn must not change the map
+uint64_t hm_scan(HMap *map, uint64_t cursor, void (* fn)(HNode *, void *), void *arg);
+// up to n keys from around a random spot (rnd): the keys of the next few
+// slots after it. the hash spreads keys, so neighbors are as good as
+// random picks. looks at a bounded number of slots, may find fewer
+size_t hm_sample(HMap *map, uint64_t rnd, HNode **out, size_t n);
 size_t hm_size(HMap *map);
+// a resize is going on, both tables are alive
+bool hm_rehashing(HMap *map);
+// move keys for about budget_ns, true if there's still more to move
+bool hm_rehash_step(HMap *map, uint64_t budget_ns);
+// bytes of the slot arrays (+ control bytes), the nodes not included
+size_t hm_mem(HMap *map);
+const char *hm_kind_name(HMapKind kind);
 
-// for hashing anything
+// for hashing anything. seeded, call str_hash_seed once before any
+// thread uses it (the server picks a random seed at startup)
 uint64_t str_hash(uint8_t *data, size_t len);
+void str_hash_seed(uint64_t seed);
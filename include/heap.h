@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+// Binary min-heap in an array, for deadlines. every item points back at
+// an index field of its owner (`ref`), kept up to date whenever the item
+// moves, so the owner can find its item to update or remove it in
+// O(log n) without a search.
+struct HeapItem {
+    uint64_t val = 0;
+    uint32_t *ref = NULL;
+};
+
+// index of an owner that isn't in the heap
+const uint32_t heap_none = (uint32_t)-1;
+
+// a[pos].val changed: move it up or down to where it belongs
+void heap_update(HeapItem *a, size_t pos, size_t len);
+void heap_push(std::vector<HeapItem> &heap, uint64_t val, uint32_t *ref);
+// sets the owner's index to heap_none
+void heap_remove(std::vector<HeapItem> &heap, size_t pos);
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+// Fork/join for the io-threads mode: the owner thread hands one function
+// to every helper, runs its own share, and waits until all are done.
+// Nothing is queued, a round is over when io_pool_run returns, so the
+// helpers only ever touch what the owner gave them for that round.
+// Helpers spin a little for the next round, then sleep on the condvar.
+struct IoPool {
+    uint32_t num_threads = 1; // the owner included
+    std::vector<std::thread> threads;
+    void (*fn)(void *arg, uint32_t idx) = NULL;
+    void *arg = NULL;
+
+    std::mutex mu;
+    std::condition_variable cv;
+    std::atomic<uint64_t> round{0}; // bumped under mu to start one
+    std::atomic<uint32_t> busy{0}; // helpers still running this round
+};
+
+// starts num_threads - 1 helpers, they live as long as the process
+void io_pool_init(IoPool *pool, uint32_t num_threads);
+
+// fn(arg, idx) for every idx in [0, num_threads), idx 0 on the caller.
+// returns after all of them did, their writes are visible by then
+void io_pool_run(IoPool *pool, void (*fn)(void *arg, uint32_t idx), void *arg);
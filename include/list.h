@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+
+// Intrusive circular doubly linked list. The list itself is a dummy
+// node, embed a DList in each item and use container_of, like HNode.
+// Every operation is O(1), a node knows how to unlink itself.
+struct DList {
+    DList *prev = NULL;
+    DList *next = NULL;
+};
+
+// an empty list, or a node that isn't in one
+inline void dlist_init(DList *node) {
+    node->prev = node->next = node;
+}
+
+inline bool dlist_empty(DList *node) {
+    return node->next == node;
+}
+
+// harmless on a node that isn't in a list (after dlist_init)
+inline void dlist_detach(DList *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    dlist_init(node);
+}
+
+// before the dummy node = at the tail
+inline void dlist_insert_before(DList *target, DList *node) {
+    node->prev = target->prev;
+    node->next = target;
+    target->prev->next = node;
+    target->prev = node;
+}
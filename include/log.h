@@ -0,0 +1,20 @@
+#pragma once
+
+// Log lines for the hot paths (accept, errors that can repeat per conn),
+// rate-limited and asynchronous:
+// - log_allow() takes one of log_rate_max lines of this second. false
+//   when they're used up: skip the line, don't even format it. skipped
+//   lines are counted and reported as one "N lines dropped" line
+// - log_printf() formats into a shared buffer under a short lock, a log
+//   thread writes it to stdout. the caller never waits on the terminal
+//   or the file behind it
+// startup messages can stay plain printf
+
+// starts the log thread
+void log_init();
+
+// any thread
+bool log_allow();
+
+// one line, the newline is added. cut at 255 bytes
+void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -0,0 +1,25 @@
+#pragma once
+#include <atomic>
+
+// Intrusive multi-producer single-consumer queue (Vyukov style).
+// Any thread can push, only the owner thread pops. No locks:
+// push is one atomic exchange, pop never waits.
+// Embed MailNode in your message and use container_of, like HNode.
+struct MailNode {
+    std::atomic<MailNode *> next{NULL};
+};
+
+struct Mailbox {
+    std::atomic<MailNode *> head{NULL}; // producers push at head
+    MailNode *tail = NULL; // consumer pops at tail
+    MailNode stub;
+};
+
+void mailbox_init(Mailbox *box);
+
+// any thread
+void mailbox_push(Mailbox *box, MailNode *node);
+
+// owner thread only. return NULL when empty, or when a producer is
+// in the middle of a push (it will notify after, so just try later)
+MailNode *mailbox_pop(Mailbox *box);
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include <vector>
+
+// interest/readiness bits, same meaning for every backend
+enum PollEvents : uint32_t {
+    EV_READ = 1 << 0,
+    EV_WRITE = 1 << 1,
+    EV_ERR = 1 << 2, // error or hang up, always reported (no need to ask)
+};
+
+enum PollerBackend : uint8_t {
+    BACKEND_POLL,
+    BACKEND_EPOLL,
+};
+
+struct PollerEvent {
+    int fd;
+    uint32_t events;
+};
+
+// Register an fd once, then only tell the poller when the interest changes.
+// - epoll: kernel keeps the interest list, wait costs O(ready fds)
+// - poll: fallback. we keep the pollfd array alive between waits and
+//   index it by fd, so add/mod/del are O(1), but poll() itself is O(fds)
+struct Poller {
+    PollerBackend backend = BACKEND_POLL;
+    bool edge_triggered = false; // epoll only, caller must drain to EAGAIN
+
+    // epoll
+    int epfd = -1;
+    std::vector<struct epoll_event> ep_events;
+
+    // poll
+    std::vector<struct pollfd> pfds;
+    std::vector<int> fd_idx; // fd -> index in pfds, -1 if not registered
+
+    uint64_t syscalls = 0; // epoll_ctl/epoll_wait/poll calls, for stats
+};
+
+// return false if the backend is not usable (caller can fall back to poll)
+bool poller_init(Poller *poller, PollerBackend backend, bool edge_triggered);
+void poller_add(Poller *poller, int fd, uint32_t events);
+void poller_mod(Poller *poller, int fd, uint32_t events);
+void poller_del(Poller *poller, int fd);
+
+// wait for readiness and fill `out` with ready fds.
+// return number of ready fds, or -1 with errno set (EINTR included)
+int poller_wait(Poller *poller, std::vector<PollerEvent> &out, int timeout_ms);
+
+const char *poller_name(Poller *poller);
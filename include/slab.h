@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Size-classed allocator for small objects of one owner (a shard):
+// - classes every 16 bytes from 32 to 512, an object is rounded up to
+//   its class, so at most 15 bytes are wasted
+// - each class carves objects out of 64 KB pages (aligned, so an
+//   object finds its page by masking its address). a page keeps its own
+//   free list (linked through the objects' first word) and live count
+// - a page that empties out goes back to malloc, unless it's the last
+//   one of its class with room, so a delete wave gives the memory back
+// - bigger objects fall through to malloc
+// Single thread only.
+const size_t slab_page_size = 64 * 1024;
+const size_t slab_min_obj = 32;
+const size_t slab_max_obj = 512;
+const size_t slab_step = 16;
+const size_t slab_num_classes = (slab_max_obj - slab_min_obj) / slab_step + 1;
+
+// header at the start of every page
+struct SlabPage {
+    SlabPage *prev = NULL;
+    SlabPage *next = NULL;
+    void *free_list = NULL;
+    uint8_t *bump = NULL; // not carved yet
+    uint8_t *end = NULL;
+    uint32_t live = 0;
+    uint32_t cls = 0;
+};
+
+// pages with room first, full ones aside, both doubly linked
+struct SlabClass {
+    SlabPage *partial = NULL;
+    SlabPage *full = NULL;
+};
+
+struct Slab {
+    SlabClass classes[slab_num_classes];
+    size_t num_pages = 0;
+    size_t used_bytes = 0; // live objects at their rounded size, big ones too
+    size_t big_bytes = 0; // the malloc'ed ones
+};
+
+// `len` is needed again to free, the caller knows it from the object
+void *slab_alloc(Slab *slab, size_t len);
+void slab_free(Slab *slab, void *ptr, size_t len);
+// what an object of `len` bytes really takes
+size_t slab_size(size_t len);
+// bytes taken from the system: pages + big objects
+size_t slab_mem(Slab *slab);
+// big objects must be freed by their owner before this
+void slab_destroy(Slab *slab);
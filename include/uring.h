@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring on raw syscalls (no liburing):
+// one ring with mmap'ed SQ/CQ, plus provided buffer rings so multishot
+// recv can pick its own buffer. Single thread use only.
+struct Uring {
+    int fd = -1;
+
+    // submission queue, sqe_tail is ours until uring_submit publishes it
+    unsigned *sq_head = NULL;
+    unsigned *sq_tail = NULL;
+    unsigned *sq_array = NULL;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned sqe_tail = 0;
+    struct io_uring_sqe *sqes = NULL;
+
+    // completion queue
+    unsigned *cq_head = NULL;
+    unsigned *cq_tail = NULL;
+    unsigned cq_mask = 0;
+    struct io_uring_cqe *cqes = NULL;
+
+    void *sq_ring = NULL;
+    void *cq_ring = NULL;
+    size_t sq_ring_len = 0;
+    size_t cq_ring_len = 0;
+    size_t sqes_len = 0;
+
+    uint64_t syscalls = 0; // io_uring_enter calls
+};
+
+// kernel picks a buffer from here for every recv completion, we give
+// it back with uring_buf_recycle once we copied the data out
+struct UringBufRing {
+    struct io_uring_buf_ring *ring = NULL;
+    uint8_t *bufs = NULL;
+    uint32_t entries = 0; // 2^n
+    uint32_t buf_len = 0;
+    uint16_t bgid = 0;
+    uint16_t tail = 0;
+};
+
+// return false if the kernel has no io_uring (or we are not allowed)
+bool uring_init(Uring *ring, unsigned entries);
+void uring_destroy(Uring *ring);
+
+// never NULL: if the SQ is full, submit first to make room
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+
+// submit everything queued and wait for at least `wait_nr` completions.
+// return >= 0 or -errno
+int uring_submit(Uring *ring, unsigned wait_nr);
+
+// NULL if the CQ is empty. call uring_cqe_seen when done with it
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+// return false on old kernels (< 5.19)
+bool uring_buf_ring_init(Uring *ring, UringBufRing *br, uint16_t bgid,
+                         uint32_t entries, uint32_t buf_len);
+uint8_t *uring_buf(UringBufRing *br, uint16_t bid);
+void uring_buf_recycle(UringBufRing *br, uint16_t bid);
+
+// sqe setup, user_data is set by the caller
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd);
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, uint16_t bgid);
+void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *buf, size_t len);
+// msg (and its iovecs) must stay alive until the completion
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg);
+void uring_prep_poll_multishot(struct io_uring_sqe *sqe, int fd, uint32_t poll_mask);
+// one completion, then it's gone: the fd can be closed after it
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, uint32_t poll_mask);
+// completes with -ETIME after ts (relative)
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts);
+// cancel the request(s) submitted with `user_data`, they complete with
+// -ECANCELED
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t user_data);
+
+// multishot accept + multishot recv with a buffer ring need ~6.0.
+// try them once on a socketpair, so we can fall back at startup
+bool uring_probe_multishot(void);
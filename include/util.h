@@ -1,7 +1,13 @@
 #pragma once
 
+#include <string_view>
+
 #include "format.h"
 
 int32_t recv_all(int connfd, char *buff, size_t bytes);
 int32_t send_all(int connfd, char *msg, size_t bytes);
 
+
+// shell-style pattern: * any run, ? any byte, [abc] [a-z] [^a] a set,
+// \ escapes the next byte
+bool glob_match(std::string_view pattern, std::string_view str);
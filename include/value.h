@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+struct BgPool;
+
+// Refcounted, immutable value bytes. The keyspace holds one ref and a
+// reply that points to the value (instead of copying it) holds another,
+// so a SET/DEL can't free bytes that are still being sent.
+// refs is atomic: a reply on another reactor can pin it too.
+struct Value {
+    std::atomic<uint32_t> refs;
+    size_t len;
+    char data[0]; // flexible array, like ZNode::name
+};
+
+// copy the bytes in, refs = 1
+Value *value_new(const char *data, size_t len);
+void value_ref(Value *value);
+// free on the last ref
+void value_unref(Value *value);
+
+// from now on the last unref of a value of min_len bytes or more hands
+// the free to `pool` instead: a big block goes back with munmap, page
+// tables and TLBs of every thread, the caller shouldn't wait for that.
+// before any thread unrefs. off (NULL) by default
+void value_lazy_free(BgPool *pool, size_t min_len);
+// values freed that way so far
+uint64_t value_lazy_freed();
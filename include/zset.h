@@ -6,6 +6,7 @@
 struct ZSet {
     AVLNode *root = NULL; // tree: score -> name
     HMap map; // hashmap: name -> score
+    size_t node_bytes = 0; // every ZNode's malloc size
 };
 
 struct ZNode {
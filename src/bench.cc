@@ -0,0 +1,756 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#include "util.h"
+
+// Load generator for the server.
+//  - every connection gets its own thread and blocking socket
+//  - send `pipeline` requests, then read all the replies
+//  - latency of a request = batch sent -> its reply parsed
+// Run against a running server, or let it start one with --server, and
+// with --sweep-threads it restarts the server with --threads N for each N
+// and prints one line per N (GET/SET throughput as the reactors scale).
+// --sweep-args does the same with whole argument sets, e.g. to put the
+// I/O backends next to each other. --sweep-pipeline runs once per depth
+// against each server. --fill SETs the whole keyspace first, so GETs hit
+// (make -k big to get a map that doesn't fit in cache), and when we
+// spawned the server it prints how much its RSS grew per key. --ttl
+// gives the filled keys a lifetime that ends at the same moment for all
+// of them (ttl after the fill started), to see the latency while they
+// all expire at once during the run. --zipf picks keys with a skew
+// (key:0 the hottest) instead of uniformly, the hit% column then shows
+// how well a server with --maxmemory keeps the hot ones.
+// syscalls/request comes from the server's `info` counters before and
+// after the run. --storm N replaces the run with a reconnect storm: N
+// clients connect at once and send one GET each, it prints how long
+// until every one got its reply (see bench_storm).
+// --port picks the TCP port, --unix PATH talks to the server's unix
+// socket instead (a server we spawn gets --unix PATH added).
+// --sweep-transport tcp,unix runs each config once over each, to put
+// their latencies next to each other.
+//
+// example:
+//  bin/bench -c 8 -P 16 -s 5
+//  bin/bench --server bin/server --sweep-threads 1,2,4,8 -c 16 -P 16
+//  bin/bench --server bin/server --sweep-args "--poll|--epoll|--io-uring"
+//  bin/bench --server bin/server --fill -k 4000000 -r 0 --sweep-pipeline 1,16,128
+//  bin/bench --server bin/server --fill -k 1000000 --ttl 3000 -r 0 -s 6
+//  bin/bench --server bin/server --storm 5000 --sweep-args "--backlog 10|--backlog 4096"
+//  bin/bench --server bin/server --unix /tmp/kv.sock --sweep-transport tcp,unix -c 1
+//  bin/bench --server "bin/server --maxmemory 20m" --sweep-args "--maxmemory-policy lru|--maxmemory-policy lfu" -k 1000000 --zipf 0.99 -r 20
+
+struct BenchConfig {
+    int conns = 4;
+    int pipeline = 1;
+    double seconds = 3;
+    int keyspace = 10000;
+    int value_size = 16;
+    int set_percent = 50;
+    bool check = false; // verify GET sees our own previous SET
+    bool fill = false; // SET every key before the run
+    int ttl_ms = 0; // PX of the filled keys, 0 = none
+    double zipf = 0; // key skew exponent, 0 = uniform
+    std::vector<double> zipf_cdf; // P(key index <= i), built from `zipf`
+    std::string server; // command to spawn, empty = server already running
+    std::vector<std::string> sweep; // server args for each run
+    std::vector<int> pipelines; // a run per depth, empty = just `pipeline`
+    int storm = 0; // conns of a reconnect storm instead of the run, 0 = no
+    int port = 1234;
+    std::string unix_path; // empty = TCP only
+    std::vector<std::string> transports; // a run per "tcp"/"unix", empty = just one
+};
+
+// where bench_connect goes: 127.0.0.1:port, or the unix socket.
+// global: every thread connects, and --sweep-transport switches it
+// between runs
+struct BenchTarget {
+    int port = 1234;
+    std::string unix_path;
+    bool use_unix = false;
+};
+static BenchTarget g_target;
+
+// the address to connect to, its length
+static socklen_t target_addr(struct sockaddr_storage *addr) {
+    memset(addr, 0, sizeof(*addr));
+    if (g_target.use_unix) {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+        un->sun_family = AF_UNIX;
+        snprintf(un->sun_path, sizeof(un->sun_path), "%s", g_target.unix_path.c_str());
+        return sizeof(*un);
+    }
+    struct sockaddr_in *in = (struct sockaddr_in *)addr;
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)g_target.port);
+    inet_pton(AF_INET, "127.0.0.1", &in->sin_addr.s_addr);
+    return sizeof(*in);
+}
+
+struct BenchResult {
+    uint64_t ops = 0;
+    uint64_t errors = 0;
+    uint64_t gets = 0;
+    uint64_t hits = 0;
+    std::vector<uint64_t> lat_ns;
+    double syscalls_per_req = -1; // -1: server didn't tell us
+    double allocs_per_req = -1; // only a COUNT_ALLOCS server counts them
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_connect() {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = target_addr(&addr);
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (!g_target.use_unix) {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    return fd;
+}
+
+// append one request: u32 nwords, then (u32 len, bytes) for each word
+static void put_req(std::string &out, const std::vector<std::string> &cmd) {
+    uint32_t n = (uint32_t)cmd.size();
+    out.append((char *)&n, 4);
+    for (const std::string &word : cmd) {
+        uint32_t len = (uint32_t)word.size();
+        out.append((char *)&len, 4);
+        out.append(word);
+    }
+}
+
+// buffered reply reader, so a pipelined batch doesn't cost a syscall per reply
+struct Reader {
+    int fd;
+    std::vector<uint8_t> buff = std::vector<uint8_t>(64 * 1024);
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+// read one reply: u32 len, u32 status, data. return false on EOF/error
+static bool read_res(Reader &rd, uint32_t &status, std::string &data) {
+    uint32_t msg_len = 0;
+    bool have_len = false;
+    while (true) {
+        size_t avail = rd.end - rd.begin;
+        if (!have_len && avail >= 4) {
+            memcpy(&msg_len, &rd.buff[rd.begin], 4);
+            have_len = true;
+            if (msg_len + 4 > rd.buff.size()) rd.buff.resize(msg_len + 4);
+        }
+        if (have_len && avail >= 4 + (size_t)msg_len) {
+            memcpy(&status, &rd.buff[rd.begin + 4], 4);
+            data.assign((char *)&rd.buff[rd.begin + 8], msg_len - 4);
+            rd.begin += 4 + msg_len;
+            return true;
+        }
+        // compact and read more
+        memmove(rd.buff.data(), &rd.buff[rd.begin], avail);
+        rd.begin = 0;
+        rd.end = avail;
+        ssize_t n = recv(rd.fd, &rd.buff[rd.end], rd.buff.size() - rd.end, 0);
+        if (n <= 0) return false;
+        rd.end += n;
+    }
+}
+
+// P(key i) ~ 1 / (i + 1)^s
+static void zipf_init(BenchConfig &cfg) {
+    cfg.zipf_cdf.resize(cfg.keyspace);
+    double sum = 0;
+    for (int i = 0; i < cfg.keyspace; i++) {
+        sum += 1.0 / pow(i + 1, cfg.zipf);
+        cfg.zipf_cdf[i] = sum;
+    }
+    for (double &p : cfg.zipf_cdf) p /= sum;
+}
+
+static int pick_key(const BenchConfig *cfg, unsigned *seed) {
+    if (cfg->zipf_cdf.empty()) return rand_r(seed) % cfg->keyspace;
+    double u = (double)rand_r(seed) / ((double)RAND_MAX + 1);
+    const std::vector<double> &cdf = cfg->zipf_cdf;
+    size_t idx = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    return (int)std::min(idx, cdf.size() - 1);
+}
+
+// one connection's worth of load
+// 1. build a batch of `pipeline` requests
+// 2. send all, then read every reply and stamp its latency
+// 3. repeat until the deadline
+static void bench_worker(const BenchConfig *cfg, int id, uint64_t deadline, BenchResult *res) {
+    int fd = bench_connect();
+    if (fd < 0) {
+        perror("connect");
+        res->errors++;
+        return;
+    }
+    Reader rd;
+    rd.fd = fd;
+    unsigned seed = (unsigned)id * 7919 + 1;
+    std::string value(cfg->value_size, 'x');
+    std::string batch;
+    std::vector<std::string> expect; // check mode: expected GET value, per reply
+    std::vector<bool> is_get; // per reply
+    uint64_t seq = 0;
+
+    while (now_ns() < deadline) {
+        batch.clear();
+        expect.clear();
+        is_get.clear();
+        for (int i = 0; i < cfg->pipeline; i++) {
+            if (cfg->check) {
+                // own key per conn, so nobody else can change it under us
+                std::string key = "c" + std::to_string(id) + ":" + std::to_string(seq % 64);
+                std::string val = std::to_string(seq++);
+                if (val.size() < value.size()) val.resize(value.size(), '.');
+                put_req(batch, {"set", key, val});
+                put_req(batch, {"get", key});
+                expect.push_back("");
+                expect.push_back(val);
+                is_get.push_back(false);
+                is_get.push_back(true);
+                continue;
+            }
+            std::string key = "key:" + std::to_string(pick_key(cfg, &seed));
+            bool get = (int)(rand_r(&seed) % 100) >= cfg->set_percent;
+            if (get) {
+                put_req(batch, {"get", key});
+            } else {
+                put_req(batch, {"set", key, value});
+            }
+            is_get.push_back(get);
+        }
+
+        uint64_t start = now_ns();
+        if (send_all(fd, batch.data(), batch.size()) == -1) break;
+        int num_reqs = cfg->check ? cfg->pipeline * 2 : cfg->pipeline;
+        for (int i = 0; i < num_reqs; i++) {
+            uint32_t status;
+            std::string data;
+            if (!read_res(rd, status, data)) {
+                res->errors++;
+                close(fd);
+                return;
+            }
+            res->lat_ns.push_back(now_ns() - start);
+            res->ops++;
+            if (status == 2) res->errors++; // RES_ERR
+            if (is_get[i]) {
+                res->gets++;
+                res->hits += status == 0;
+            }
+            if (cfg->check && !expect[i].empty() && data != expect[i]) {
+                fprintf(stderr, "check failed: conn %d want %.32s got %.32s\n",
+                        id, expect[i].c_str(), data.c_str());
+                res->errors++;
+            }
+        }
+    }
+    close(fd);
+}
+
+// ask the server for one counter out of `info`, -1 if we can't
+static int64_t server_stat(const char *name) {
+    int fd = bench_connect();
+    if (fd < 0) return -1;
+    std::string req;
+    put_req(req, {"info"});
+    int64_t val = -1;
+    Reader rd;
+    rd.fd = fd;
+    uint32_t status;
+    std::string text;
+    if (send_all(fd, req.data(), req.size()) == 0 && read_res(rd, status, text) && status == 0) {
+        std::string key = std::string(name) + ":";
+        size_t pos = text.find(key);
+        if (pos != std::string::npos) {
+            val = atoll(text.c_str() + pos + key.size());
+        }
+    }
+    close(fd);
+    return val;
+}
+
+static pid_t spawn_server(const std::string &cmd) {
+    fflush(stdout); // or the child prints our buffered lines again
+    pid_t pid = fork();
+    if (pid == 0) {
+        // keep the server's chatter out of our table
+        freopen("/dev/null", "w", stdout);
+        execl("/bin/sh", "sh", "-c", ("exec " + cmd).c_str(), (char *)NULL);
+        _exit(127);
+    }
+    // wait until it accepts
+    for (int i = 0; i < 100; i++) {
+        int fd = bench_connect();
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        usleep(20 * 1000);
+    }
+    fprintf(stderr, "server did not come up: %s\n", cmd.c_str());
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// the port can stay taken for a moment after the process is gone
+// (io_uring tears the ring down async), wait until we can bind it
+static void wait_port_free() {
+    for (int i = 0; i < 100; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)g_target.port);
+        int rv = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        close(fd);
+        if (rv == 0) return;
+        usleep(20 * 1000);
+    }
+}
+
+static void stop_server(pid_t pid) {
+    if (pid <= 0) return;
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    wait_port_free();
+}
+
+// resident bytes of a process, -1 if we can't read it
+static int64_t rss_bytes(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    long pages = 0, resident = 0;
+    int got = fscanf(fp, "%ld %ld", &pages, &resident);
+    fclose(fp);
+    if (got != 2) return -1;
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+// SET key:0 .. key:keyspace-1 over one conn, 1000 requests per batch.
+// pid > 0: the server is ours, report its RSS growth per key
+static bool bench_fill(const BenchConfig &cfg, pid_t pid) {
+    int64_t rss_before = pid > 0 ? rss_bytes(pid) : -1;
+    int fd = bench_connect();
+    if (fd < 0) {
+        perror("connect");
+        return false;
+    }
+    Reader rd;
+    rd.fd = fd;
+    std::string value(cfg.value_size, 'x');
+    std::string batch;
+    uint64_t expire_at = now_ns() + (uint64_t)cfg.ttl_ms * 1000000;
+    bool ok = true;
+    for (int next = 0; ok && next < cfg.keyspace;) {
+        batch.clear();
+        int n = 0;
+        for (; n < 1000 && next < cfg.keyspace; n++, next++) {
+            if (cfg.ttl_ms > 0) {
+                int64_t left = (int64_t)(expire_at - now_ns()) / 1000000;
+                std::string px = std::to_string(std::max<int64_t>(left, 1));
+                put_req(batch, {"set", "key:" + std::to_string(next), value, "px", px});
+            } else {
+                put_req(batch, {"set", "key:" + std::to_string(next), value});
+            }
+        }
+        ok = send_all(fd, batch.data(), batch.size()) != -1;
+        for (int i = 0; ok && i < n; i++) {
+            uint32_t status;
+            std::string data;
+            ok = read_res(rd, status, data) && status == 0;
+        }
+    }
+    close(fd);
+    if (!ok) fprintf(stderr, "fill failed\n");
+    int64_t rss_after = pid > 0 ? rss_bytes(pid) : -1;
+    if (ok && rss_before >= 0 && rss_after >= 0) {
+        printf("fill: %d keys, rss +%.1f MB, %.1f B/key\n", cfg.keyspace,
+               (rss_after - rss_before) / 1e6, (double)(rss_after - rss_before) / cfg.keyspace);
+    }
+    return ok;
+}
+
+static uint64_t percentile(std::vector<uint64_t> &lat, double p) {
+    if (lat.empty()) return 0;
+    size_t idx = (size_t)(p * (lat.size() - 1));
+    std::nth_element(lat.begin(), lat.begin() + idx, lat.end());
+    return lat[idx];
+}
+
+static BenchResult bench_run(const BenchConfig &cfg) {
+    int64_t sys_before = server_stat("syscalls");
+    int64_t req_before = server_stat("requests");
+    int64_t alloc_before = server_stat("allocs");
+    std::vector<BenchResult> results(cfg.conns);
+    std::vector<std::thread> threads;
+    uint64_t deadline = now_ns() + (uint64_t)(cfg.seconds * 1e9);
+    for (int i = 0; i < cfg.conns; i++) {
+        threads.emplace_back(bench_worker, &cfg, i, deadline, &results[i]);
+    }
+    BenchResult total;
+    for (int i = 0; i < cfg.conns; i++) {
+        threads[i].join();
+        total.ops += results[i].ops;
+        total.errors += results[i].errors;
+        total.gets += results[i].gets;
+        total.hits += results[i].hits;
+        total.lat_ns.insert(total.lat_ns.end(), results[i].lat_ns.begin(), results[i].lat_ns.end());
+    }
+    // counters are published once per loop iteration, give it a moment
+    usleep(10 * 1000);
+    int64_t sys_after = server_stat("syscalls");
+    int64_t req_after = server_stat("requests");
+    int64_t alloc_after = server_stat("allocs");
+    if (sys_before >= 0 && sys_after >= 0 && req_after > req_before) {
+        total.syscalls_per_req = (double)(sys_after - sys_before) / (req_after - req_before);
+    }
+    if (alloc_before >= 0 && alloc_after >= 0 && req_after > req_before) {
+        total.allocs_per_req = (double)(alloc_after - alloc_before) / (req_after - req_before);
+    }
+    return total;
+}
+
+static void print_header(const char *label) {
+    printf("%-28s %12s %10s %10s %10s %10s %10s %10s %7s %8s\n", label,
+           "ops/s", "p50(us)", "p99(us)", "p999(us)", "max(us)", "sys/req", "alloc/req", "hit%",
+           "errors");
+}
+
+static void print_result(const char *label, const BenchConfig &cfg, BenchResult &res) {
+    char sys[32] = "-";
+    if (res.syscalls_per_req >= 0) {
+        snprintf(sys, sizeof(sys), "%.2f", res.syscalls_per_req);
+    }
+    char allocs[32] = "-";
+    if (res.allocs_per_req >= 0) {
+        snprintf(allocs, sizeof(allocs), "%.2f", res.allocs_per_req);
+    }
+    char hits[32] = "-";
+    if (res.gets > 0) {
+        snprintf(hits, sizeof(hits), "%.1f", 100.0 * res.hits / res.gets);
+    }
+    printf("%-28s %12.0f %10.1f %10.1f %10.1f %10.1f %10s %10s %7s %8lu\n", label,
+           res.ops / cfg.seconds,
+           percentile(res.lat_ns, 0.50) / 1e3,
+           percentile(res.lat_ns, 0.99) / 1e3,
+           percentile(res.lat_ns, 0.999) / 1e3,
+           percentile(res.lat_ns, 1.0) / 1e3,
+           sys,
+           allocs,
+           hits,
+           (unsigned long)res.errors);
+}
+
+const int storm_timeout_ms = 30 * 1000;
+
+// one conn of the storm
+struct StormConn {
+    int fd = -1;
+    bool sent = false; // connected, GET out
+    std::string in; // reply so far
+    uint64_t done_ns = 0; // reply complete, 0 = not yet (or failed)
+};
+
+// reconnect storm, all from this thread:
+// 1. start cfg.storm nonblocking connects at once
+// 2. each sends a GET when its connect completes, then waits for the reply
+// 3. poll them all until every one is done, failed, or storm_timeout_ms
+// a conn's time = storm start -> its reply. the slowest one is when the
+// server caught up. a SYN the listener's backlog had no room for is
+// retried by the kernel after 1 s, 3 s... that's the tail to look at
+static bool bench_storm(const BenchConfig &cfg, const std::string &label) {
+    std::string get;
+    put_req(get, {"get", "key:0"});
+    std::vector<StormConn> conns(cfg.storm);
+    struct sockaddr_storage addr;
+    socklen_t addr_len = target_addr(&addr);
+
+    uint64_t start = now_ns();
+    int failed = 0;
+    for (StormConn &sc : conns) {
+        // a unix socket with a full backlog says EAGAIN right away,
+        // no SYN to retry: that conn counts as failed
+        sc.fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (sc.fd < 0 || (connect(sc.fd, (struct sockaddr *)&addr, addr_len) == -1 &&
+                          errno != EINPROGRESS)) {
+            if (sc.fd >= 0) close(sc.fd);
+            sc.fd = -1;
+            failed++;
+        }
+    }
+
+    std::vector<struct pollfd> pfds;
+    std::vector<StormConn *> owners;
+    uint64_t deadline = start + (uint64_t)storm_timeout_ms * 1000000;
+    while (now_ns() < deadline) {
+        pfds.clear();
+        owners.clear();
+        for (StormConn &sc : conns) {
+            if (sc.fd < 0) continue;
+            pfds.push_back({sc.fd, (short)(sc.sent ? POLLIN : POLLOUT), 0});
+            owners.push_back(&sc);
+        }
+        if (pfds.empty()) break;
+        if (poll(pfds.data(), pfds.size(), 100) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (size_t i = 0; i < pfds.size(); i++) {
+            StormConn &sc = *owners[i];
+            if (pfds[i].revents == 0) continue;
+            bool ok = true;
+            if (!sc.sent) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(sc.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                ok = err == 0 && send(sc.fd, get.data(), get.size(), MSG_NOSIGNAL) == (ssize_t)get.size();
+                sc.sent = ok;
+            } else {
+                char buf[256];
+                ssize_t n = recv(sc.fd, buf, sizeof(buf), 0);
+                ok = n > 0 || (n < 0 && errno == EAGAIN);
+                if (n > 0) sc.in.append(buf, (size_t)n);
+                uint32_t msg_len = 0;
+                if (sc.in.size() >= 4) memcpy(&msg_len, sc.in.data(), 4);
+                if (sc.in.size() >= 4 && sc.in.size() >= 4 + (size_t)msg_len) {
+                    sc.done_ns = now_ns() - start;
+                    close(sc.fd);
+                    sc.fd = -1;
+                    continue;
+                }
+            }
+            if (!ok) {
+                close(sc.fd);
+                sc.fd = -1;
+                failed++;
+            }
+        }
+    }
+
+    std::vector<uint64_t> lat;
+    for (StormConn &sc : conns) {
+        if (sc.fd >= 0) close(sc.fd); // timed out
+        if (sc.done_ns) lat.push_back(sc.done_ns);
+    }
+    printf("%-28s %8d %8zu %8d %10.1f %10.1f %10.1f\n", label.c_str(), cfg.storm, lat.size(), failed,
+           percentile(lat, 0.50) / 1e6, percentile(lat, 0.99) / 1e6, percentile(lat, 1.0) / 1e6);
+    return (int)lat.size() == cfg.storm;
+}
+
+static void print_storm_header(const char *label) {
+    printf("%-28s %8s %8s %8s %10s %10s %10s\n", label, "conns", "served", "failed", "p50(ms)",
+           "p99(ms)", "all(ms)");
+}
+
+// one server (already up, `pid` if we started it): fill if asked, then a
+// line per pipeline depth
+// the runs of one server over the current transport
+static bool bench_transport(const BenchConfig &cfg, const std::string &label) {
+    if (cfg.storm > 0) return bench_storm(cfg, label);
+    if (cfg.pipelines.empty()) {
+        BenchResult res = bench_run(cfg);
+        print_result(label.c_str(), cfg, res);
+        return res.errors == 0;
+    }
+    bool ok = true;
+    for (int depth : cfg.pipelines) {
+        BenchConfig run = cfg;
+        run.pipeline = depth;
+        BenchResult res = bench_run(run);
+        std::string name = label.empty() ? "" : label + " ";
+        name += "P=" + std::to_string(depth);
+        print_result(name.c_str(), run, res);
+        ok = ok && res.errors == 0;
+    }
+    return ok;
+}
+
+static bool bench_server(const BenchConfig &cfg, const std::string &label, pid_t pid) {
+    if (cfg.fill && !bench_fill(cfg, pid)) return false;
+    if (cfg.transports.empty()) return bench_transport(cfg, label);
+    bool ok = true;
+    for (const std::string &transport : cfg.transports) {
+        g_target.use_unix = transport == "unix";
+        ok = bench_transport(cfg, label.empty() ? transport : label + " " + transport) && ok;
+    }
+    g_target.use_unix = !cfg.unix_path.empty();
+    return ok;
+}
+
+// the server's command line: ours, then where to listen, then the run's
+static std::string server_cmd(const BenchConfig &cfg, const std::string &args) {
+    std::string cmd = cfg.server;
+    if (cfg.port != 1234) cmd += " --port " + std::to_string(cfg.port);
+    if (!cfg.unix_path.empty()) cmd += " --unix " + cfg.unix_path;
+    if (!args.empty()) cmd += " " + args;
+    return cmd;
+}
+
+static std::vector<std::string> split(const char *arg, char sep) {
+    std::vector<std::string> out;
+    std::string cur;
+    for (const char *p = arg; *p; p++) {
+        if (*p == sep) {
+            out.push_back(cur);
+            cur.clear();
+        } else {
+            cur += *p;
+        }
+    }
+    out.push_back(cur);
+    return out;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [-c conns] [-P pipeline] [-s seconds] [-k keyspace]\n"
+        "          [-v value_size] [-r set_percent] [--check] [--fill] [--ttl ms]\n"
+        "          [--zipf s] [--storm conns] [--port N] [--unix PATH]\n"
+        "          [--server CMD] [--sweep-threads 1,2,4,...]\n"
+        "          [--sweep-args \"ARGS|ARGS|...\"] [--sweep-pipeline 1,16,...]\n"
+        "          [--sweep-transport tcp,unix]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig cfg;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_val = i + 1 < argc;
+        if (strcmp(arg, "-c") == 0 && has_val) {
+            cfg.conns = atoi(argv[++i]);
+        } else if (strcmp(arg, "-P") == 0 && has_val) {
+            cfg.pipeline = atoi(argv[++i]);
+        } else if (strcmp(arg, "-s") == 0 && has_val) {
+            cfg.seconds = atof(argv[++i]);
+        } else if (strcmp(arg, "-k") == 0 && has_val) {
+            cfg.keyspace = atoi(argv[++i]);
+        } else if (strcmp(arg, "-v") == 0 && has_val) {
+            cfg.value_size = atoi(argv[++i]);
+        } else if (strcmp(arg, "-r") == 0 && has_val) {
+            cfg.set_percent = atoi(argv[++i]);
+        } else if (strcmp(arg, "--check") == 0) {
+            cfg.check = true;
+        } else if (strcmp(arg, "--fill") == 0) {
+            cfg.fill = true;
+        } else if (strcmp(arg, "--ttl") == 0 && has_val) {
+            cfg.ttl_ms = atoi(argv[++i]);
+        } else if (strcmp(arg, "--zipf") == 0 && has_val) {
+            cfg.zipf = atof(argv[++i]);
+        } else if (strcmp(arg, "--storm") == 0 && has_val) {
+            cfg.storm = atoi(argv[++i]);
+        } else if (strcmp(arg, "--sweep-pipeline") == 0 && has_val) {
+            for (const std::string &n : split(argv[++i], ',')) {
+                cfg.pipelines.push_back(atoi(n.c_str()));
+                if (cfg.pipelines.back() <= 0) cfg.pipeline = 0; // rejected below
+            }
+        } else if (strcmp(arg, "--port") == 0 && has_val) {
+            cfg.port = atoi(argv[++i]);
+        } else if (strcmp(arg, "--unix") == 0 && has_val) {
+            cfg.unix_path = argv[++i];
+        } else if (strcmp(arg, "--sweep-transport") == 0 && has_val) {
+            for (const std::string &t : split(argv[++i], ',')) {
+                if (t != "tcp" && t != "unix") cfg.port = 0; // rejected below
+                cfg.transports.push_back(t);
+            }
+        } else if (strcmp(arg, "--server") == 0 && has_val) {
+            cfg.server = argv[++i];
+        } else if (strcmp(arg, "--sweep-threads") == 0 && has_val) {
+            for (const std::string &n : split(argv[++i], ',')) {
+                cfg.sweep.push_back("--threads " + n);
+            }
+        } else if (strcmp(arg, "--sweep-args") == 0 && has_val) {
+            for (const std::string &args : split(argv[++i], '|')) {
+                cfg.sweep.push_back(args);
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.conns <= 0 || cfg.pipeline <= 0 || cfg.keyspace <= 0 || cfg.seconds <= 0 || cfg.zipf < 0 ||
+        cfg.storm < 0 || cfg.port <= 0 || cfg.port > 65535 ||
+        cfg.unix_path.size() >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!cfg.transports.empty() && cfg.unix_path.empty()) {
+        fprintf(stderr, "--sweep-transport needs --unix\n");
+        return 1;
+    }
+    g_target.port = cfg.port;
+    g_target.unix_path = cfg.unix_path;
+    g_target.use_unix = !cfg.unix_path.empty();
+    if (!cfg.sweep.empty() && cfg.server.empty()) {
+        fprintf(stderr, "--sweep-threads/--sweep-args need --server\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (cfg.zipf > 0) zipf_init(cfg);
+
+    if (cfg.storm > 0) {
+        printf("storm: %d conns at once, one GET each\n", cfg.storm);
+    } else {
+        printf("conns=%d pipeline=%d set=%d%% keyspace=%d value=%dB %.1fs",
+               cfg.conns, cfg.pipeline, cfg.set_percent, cfg.keyspace, cfg.value_size, cfg.seconds);
+        if (cfg.zipf > 0) printf(" zipf=%.2f", cfg.zipf);
+        printf("\n");
+    }
+    bool failed = false;
+    if (cfg.sweep.empty()) {
+        pid_t pid = cfg.server.empty() ? 0 : spawn_server(server_cmd(cfg, ""));
+        if (pid < 0) return 1;
+        cfg.storm > 0 ? print_storm_header("") : print_header("");
+        failed = !bench_server(cfg, "", pid);
+        stop_server(pid);
+    } else {
+        cfg.storm > 0 ? print_storm_header("server args") : print_header("server args");
+        for (const std::string &args : cfg.sweep) {
+            pid_t pid = spawn_server(server_cmd(cfg, args));
+            if (pid < 0) return 1;
+            failed = !bench_server(cfg, args, pid) || failed;
+            stop_server(pid);
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "bgpool.h"
+
+// BgPool jobs submitted from one thread, the way the loop does: every job
+// runs exactly once, on a pool thread, whatever order they take. then
+// bg_pool_destroy with jobs still queued behind slow ones: they all run
+// before it returns, and the threads are gone.
+
+struct Job {
+    std::atomic<uint32_t> runs{0};
+    std::thread::id ran_on;
+    useconds_t sleep_us = 0;
+};
+
+struct Jobs {
+    std::vector<Job> jobs;
+    std::atomic<size_t> done{0};
+    std::thread::id submitter;
+};
+
+struct JobArg {
+    Jobs *all;
+    size_t idx;
+};
+
+static unsigned rng_seed = 1;
+
+static void job_fn(void *arg) {
+    JobArg *job_arg = (JobArg *)arg;
+    Job &job = job_arg->all->jobs[job_arg->idx];
+    if (job.sleep_us) usleep(job.sleep_us);
+    job.ran_on = std::this_thread::get_id();
+    job.runs.fetch_add(1);
+    job_arg->all->done.fetch_add(1);
+}
+
+// submit every job of `all` from this thread
+static std::vector<JobArg> submit_all(BgPool *pool, Jobs &all) {
+    std::vector<JobArg> args(all.jobs.size());
+    all.submitter = std::this_thread::get_id();
+    for (size_t i = 0; i < all.jobs.size(); i++) {
+        args[i] = JobArg{&all, i};
+    }
+    for (JobArg &arg : args) bg_submit(pool, job_fn, &arg);
+    return args;
+}
+
+// cons: each job ran once, not on the submitting thread
+static void jobs_verify(Jobs &all) {
+    assert(all.done.load() == all.jobs.size());
+    for (Job &job : all.jobs) {
+        assert(job.runs.load() == 1);
+        assert(job.ran_on != all.submitter);
+    }
+}
+
+int main(void) {
+    // stage 1: a burst of jobs, some of them slow. wait until the count
+    // is there, then a little longer: nothing runs twice
+    BgPool pool;
+    bg_pool_init(&pool, 4);
+    assert(pool.threads.size() == 4);
+    {
+        Jobs all;
+        all.jobs = std::vector<Job>(20000);
+        for (Job &job : all.jobs) {
+            job.sleep_us = rand_r(&rng_seed) % 100 == 0 ? 200 : 0;
+        }
+        std::vector<JobArg> args = submit_all(&pool, all);
+        while (all.done.load() < all.jobs.size()) usleep(1000);
+        usleep(10000);
+        jobs_verify(all);
+    }
+
+    // stage 2: jobs one at a time, the threads asleep in between
+    {
+        Jobs all;
+        all.jobs = std::vector<Job>(20);
+        for (size_t i = 0; i < all.jobs.size(); i++) {
+            JobArg arg{&all, i};
+            bg_submit(&pool, job_fn, &arg);
+            while (all.done.load() == i) usleep(100);
+        }
+        all.submitter = std::this_thread::get_id();
+        jobs_verify(all);
+    }
+
+    // stage 3: destroy with jobs still queued behind slow ones: it runs
+    // them all, then joins every thread
+    {
+        Jobs all;
+        all.jobs = std::vector<Job>(2000);
+        for (size_t i = 0; i < all.jobs.size(); i++) {
+            all.jobs[i].sleep_us = i < 8 ? 20000 : 0;
+        }
+        std::vector<JobArg> args = submit_all(&pool, all);
+        assert(all.done.load() < all.jobs.size()); // still queued
+        bg_pool_destroy(&pool);
+        assert(pool.threads.empty() && pool.jobs.empty());
+        jobs_verify(all);
+    }
+
+    // stage 4: an idle pool is destroyed too, and can start again
+    bg_pool_init(&pool, 2);
+    bg_pool_destroy(&pool);
+    assert(pool.threads.empty());
+    bg_pool_init(&pool, 2);
+    {
+        Jobs all;
+        all.jobs = std::vector<Job>(100);
+        std::vector<JobArg> args = submit_all(&pool, all);
+        bg_pool_destroy(&pool);
+        jobs_verify(all);
+    }
+
+    printf("ok\n");
+    return 0;
+}
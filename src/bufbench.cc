@@ -0,0 +1,209 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "chunkbuf.h"
+#include "format.h"
+
+// Microbenchmark for building replies in a conn's ChunkBuf, next to
+// `Exact`, a copy of the old contiguous buffer (reallocs to exactly
+// what's needed, never shrinks, no pool). Phases:
+//  - build: one reply of n small out_str items (like KEYS or ZQUERY
+//    listing), appended one by one, then drained
+//  - churn: a conn's life, n times: new buffer, a recv reserve (what
+//    conn_in_prepare asks for), a small reply, destroy
+//  - after big: one 8 MB reply sent and drained, then small ones: what
+//    the buffer still holds
+// every reply is checked, a wrong byte exits non-zero.
+//
+// example:
+//  bin/bufbench -n 200000
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the old conn buffer: grow by exactly the missing bytes
+struct Exact {
+    uint8_t *buff_begin = (uint8_t *)malloc(1024);
+    uint8_t *buff_end = buff_begin + 1024;
+    uint8_t *data_begin = buff_begin;
+    uint8_t *data_end = buff_begin;
+
+    ~Exact() {
+        free(buff_begin);
+    }
+    void ensure_tail(size_t len) {
+        if ((size_t)(buff_end - data_end) >= len) return;
+        size_t data_len = data_end - data_begin;
+        memmove(buff_begin, data_begin, data_len);
+        data_begin = buff_begin;
+        data_end = buff_begin + data_len;
+        if ((size_t)(buff_end - data_end) >= len) return;
+        buff_begin = (uint8_t *)realloc(buff_begin, data_len + len);
+        data_begin = buff_begin;
+        data_end = data_begin + data_len;
+        buff_end = buff_begin + data_len + len;
+    }
+    void append(const uint8_t *src, size_t len) {
+        ensure_tail(len);
+        memcpy(data_end, src, len);
+        data_end += len;
+    }
+    uint8_t *reserve(size_t len) {
+        ensure_tail(len);
+        return data_end;
+    }
+    void commit(size_t len) {
+        data_end += len;
+    }
+    bool peek(size_t off, void *dst, size_t len) {
+        if (off + len > size()) return false;
+        memcpy(dst, data_begin + off, len);
+        return true;
+    }
+    size_t size() {
+        return data_end - data_begin;
+    }
+    void consume(size_t len) {
+        data_begin += len;
+    }
+    size_t capacity() {
+        return buff_end - buff_begin;
+    }
+};
+
+static bool failed = false;
+
+static void expect(bool ok, const char *what) {
+    if (!ok && !failed) {
+        fprintf(stderr, "wrong result: %s\n", what);
+    }
+    failed = failed || !ok;
+}
+
+template <typename Buf>
+static void out_str(Buf &buf, char *data, size_t len) {
+    uint8_t tag = TAG_STR;
+    buf.append(&tag, 1);
+    buf.append((uint8_t *)&len, 4);
+    buf.append((uint8_t *)data, len);
+}
+
+static const size_t item_len = 16;
+static const size_t recv_reserve = 1024; // the server's read_min
+static const size_t item_size = 1 + 4 + item_len; // tag, len, bytes
+
+// build: n items, then check and drain. returns ns, and how many times
+// the capacity changed
+template <typename Buf>
+static uint64_t run_build(Buf &buf, size_t n, size_t &reallocs) {
+    char item[item_len];
+    memset(item, 'k', sizeof(item));
+    reallocs = 0;
+    size_t cap = buf.capacity();
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        item[0] = (char)i;
+        out_str(buf, item, sizeof(item));
+        if (buf.capacity() != cap) {
+            cap = buf.capacity();
+            reallocs++;
+        }
+    }
+    uint64_t took = now_ns() - start;
+    expect(buf.size() == n * item_size, "reply size");
+    for (size_t i = 0; i < n; i += n / 16 + 1) {
+        uint8_t byte = 0;
+        expect(buf.peek(i * item_size + 5, &byte, 1) && byte == (uint8_t)i, "reply bytes");
+    }
+    buf.consume(buf.size());
+    return took;
+}
+
+// churn: n short conns. returns ns
+template <typename Buf>
+static uint64_t run_churn(size_t n) {
+    const char reply[] = "reply";
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        Buf *buf = new Buf();
+        uint8_t *dst = buf->reserve(recv_reserve);
+        memcpy(dst, "req", 3);
+        buf->commit(3);
+        buf->consume(3);
+        buf->append((uint8_t *)reply, sizeof(reply));
+        expect(buf->size() == sizeof(reply), "churn reply");
+        delete buf;
+    }
+    return now_ns() - start;
+}
+
+// after big: 8 MB out, drained, then 10 small replies. returns capacity
+template <typename Buf>
+static size_t run_after_big(Buf &buf) {
+    std::string big(8 << 20, 'v');
+    buf.append((uint8_t *)big.data(), big.size());
+    while (buf.size() > 0) {
+        buf.consume(std::min<size_t>(buf.size(), 256 * 1024)); // sends
+    }
+    for (int i = 0; i < 10; i++) {
+        buf.append((uint8_t *)"small", 5);
+        buf.consume(5);
+    }
+    return buf.capacity();
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n items]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = 200000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            n = (size_t)atol(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (n == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%-10s %14s %12s %14s %16s\n", "buffer", "build MB/s", "cap changes", "churn ns/conn",
+           "after big (KB)");
+
+    Exact exact;
+    size_t exact_reallocs = 0;
+    uint64_t exact_build = run_build(exact, n, exact_reallocs);
+    uint64_t exact_churn = run_churn<Exact>(n);
+    Exact exact_big;
+    size_t exact_left = run_after_big(exact_big);
+
+    ChunkBuf chunked;
+    size_t reallocs = 0;
+    uint64_t build = run_build(chunked, n, reallocs);
+    uint64_t churn = run_churn<ChunkBuf>(n);
+    size_t pooled = chunk_pool_bytes(); // the last conn's, before `big` takes it
+    ChunkBuf big;
+    size_t left = run_after_big(big);
+
+    double mb = (double)(n * item_size) / 1e6;
+    printf("%-10s %14.1f %12zu %14.1f %16zu\n", "exact", mb / (exact_build / 1e9), exact_reallocs,
+           (double)exact_churn / n, exact_left / 1024);
+    printf("%-10s %14.1f %12zu %14.1f %16zu\n", "chunked", mb / (build / 1e9), reallocs,
+           (double)churn / n, left / 1024);
+    printf("pool after churn: %zu KB kept for the next conn\n", pooled / 1024);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <algorithm>
+
+#include "chunkbuf.h"
+
+// ChunkBuf against a std::string holding the same bytes: after every
+// append, commit and consume, peek() and iov() have to read back the
+// string's bytes wherever the chunk boundaries fall, and capacity() has
+// to match what track() counted.
+
+static unsigned rng_seed = 1;
+
+static std::string random_bytes(size_t len) {
+    std::string str(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        str[i] = (char)rand_r(&rng_seed);
+    }
+    return str;
+}
+
+// cons: verify the chain against the reference
+// 1. sizes, and the counter track() keeps
+// 2. everything with one peek, then short peeks at every offset near a
+//    chunk boundary, and one past the end fails
+// 3. iov of a few ranges, glued back together
+static void buf_verify(ChunkBuf &buf, const std::string &ref, size_t counter) {
+    assert(buf.size() == ref.size());
+    assert(counter == buf.capacity());
+    assert(buf.head_size() <= buf.size());
+    assert(ref.empty() == (buf.head_size() == 0));
+    if (buf.head_size() > 0) {
+        assert(memcmp(buf.data(), ref.data(), buf.head_size()) == 0);
+    }
+
+    std::string all(ref.size(), '\0');
+    assert(buf.peek(0, &all[0], all.size()));
+    assert(all == ref);
+    for (size_t off = 0; off < ref.size(); off += chunk_len) {
+        for (size_t back = 0; back < 3 && back <= off; back++) {
+            size_t at = off - back;
+            size_t len = std::min<size_t>(5, ref.size() - at);
+            char got[5];
+            assert(buf.peek(at, got, len));
+            assert(memcmp(got, ref.data() + at, len) == 0);
+        }
+    }
+    char byte;
+    assert(!buf.peek(ref.size(), &byte, 1));
+
+    size_t ranges[][2] = {{0, ref.size()}, {ref.size() / 3, ref.size() / 2}, {ref.size(), 0}};
+    for (auto &range : ranges) {
+        size_t off = range[0];
+        size_t len = std::min(range[1], ref.size() - off);
+        struct iovec iov[64];
+        size_t n = buf.iov(off, len, iov, 64);
+        std::string glued;
+        for (size_t i = 0; i < n; i++) {
+            assert(iov[i].iov_len > 0);
+            glued.append((char *)iov[i].iov_base, iov[i].iov_len);
+        }
+        assert(glued == ref.substr(off, len));
+    }
+}
+
+// like a recv: reserve, write some of the room, commit what was written
+static void buf_recv(ChunkBuf &buf, std::string &ref, size_t want, size_t got) {
+    uint8_t *dst = buf.reserve(want);
+    assert(buf.tail_room() >= want && got <= buf.tail_room());
+    std::string bytes = random_bytes(got);
+    memcpy(dst, bytes.data(), got);
+    buf.commit(got);
+    ref += bytes;
+}
+
+int main(void) {
+    size_t counter = 0;
+
+    // stage 1: empty, and a chain that drains holds nothing
+    {
+        ChunkBuf buf;
+        buf.track(&counter);
+        std::string ref;
+        buf_verify(buf, ref, counter);
+        assert(buf.data() == NULL && buf.capacity() == 0);
+        ref = random_bytes(100);
+        buf.append((uint8_t *)ref.data(), ref.size());
+        buf_verify(buf, ref, counter);
+        buf.consume(ref.size());
+        ref.clear();
+        buf_verify(buf, ref, counter);
+        assert(buf.capacity() == 0);
+    }
+    assert(counter == 0);
+
+    // stage 2: appends across chunk boundaries, then consume exactly one
+    // whole chunk: the head moves to the next one, no empty chunk left
+    {
+        ChunkBuf buf;
+        buf.track(&counter);
+        std::string ref = random_bytes(chunk_len * 3 + 7);
+        buf.append((uint8_t *)ref.data(), chunk_len - 1);
+        buf.append((uint8_t *)ref.data() + chunk_len - 1, ref.size() - (chunk_len - 1));
+        buf_verify(buf, ref, counter);
+        assert(buf.head_size() == chunk_len && buf.capacity() == chunk_len * 4);
+
+        buf.consume(chunk_len);
+        ref.erase(0, chunk_len);
+        buf_verify(buf, ref, counter);
+        assert(buf.head_size() == chunk_len && buf.capacity() == chunk_len * 3);
+
+        // a consume that ends in the middle of a chunk keeps it
+        buf.consume(chunk_len + 3);
+        ref.erase(0, chunk_len + 3);
+        buf_verify(buf, ref, counter);
+        assert(buf.head_size() == chunk_len - 3 && buf.capacity() == chunk_len * 2);
+    }
+    assert(counter == 0);
+
+    // stage 3: reserve/commit. a reserve the tail can't hold links a new
+    // chunk, a recv that got nothing leaves an empty one: consume(0)
+    // drops it
+    {
+        ChunkBuf buf;
+        buf.track(&counter);
+        std::string ref;
+        buf_recv(buf, ref, 1024, chunk_len - 100);
+        buf_verify(buf, ref, counter);
+        buf_recv(buf, ref, 1024, 0); // 100 bytes of room: a new chunk
+        buf_verify(buf, ref, counter);
+        assert(buf.capacity() == chunk_len * 2);
+        buf.consume(0);
+        buf_verify(buf, ref, counter);
+        assert(buf.capacity() == chunk_len * 2); // the tail isn't drained data
+
+        buf.consume(ref.size());
+        ref.clear();
+        buf_verify(buf, ref, counter);
+        assert(buf.capacity() == 0);
+
+        buf_recv(buf, ref, 1024, 0);
+        assert(buf.capacity() == chunk_len);
+        buf.consume(0);
+        buf_verify(buf, ref, counter);
+        assert(buf.capacity() == 0);
+    }
+    assert(counter == 0);
+
+    // stage 4: reserve_whole. data that already fits its chunk stays, a
+    // request split across chunks is copied once into one big chunk
+    {
+        ChunkBuf buf;
+        buf.track(&counter);
+        std::string ref = random_bytes(100);
+        buf.append((uint8_t *)ref.data(), ref.size());
+        uint8_t *before = buf.data();
+        buf.reserve_whole(1000, 0);
+        assert(buf.data() == before);
+        buf_verify(buf, ref, counter);
+
+        size_t total = chunk_len * 2 + 500;
+        std::string more = random_bytes(chunk_len + 10);
+        buf.append((uint8_t *)more.data(), more.size());
+        ref += more;
+        buf.reserve_whole(total, 64);
+        buf_verify(buf, ref, counter);
+        assert(buf.head_size() == ref.size() && buf.capacity() == total + 64);
+        // the rest lands in place, still one chunk
+        while (ref.size() < total) {
+            size_t got = std::min<size_t>(total - ref.size(), 3000);
+            buf_recv(buf, ref, 1, got);
+        }
+        buf_verify(buf, ref, counter);
+        assert(buf.head_size() == total && buf.capacity() == total + 64);
+
+        buf.consume(total);
+        ref.clear();
+        buf_verify(buf, ref, counter);
+        assert(buf.capacity() == 0);
+
+        // on an empty chain: a fresh chunk of its own
+        buf.reserve_whole(chunk_len * 4, 0);
+        assert(buf.capacity() == chunk_len * 4 && buf.size() == 0);
+        buf.consume(0);
+        assert(buf.capacity() == 0);
+    }
+    assert(counter == 0);
+
+    // stage 5: random appends, recvs and consumes against the string
+    {
+        ChunkBuf buf;
+        buf.track(&counter);
+        std::string ref;
+        for (int i = 0; i < 2000; i++) {
+            int op = rand_r(&rng_seed) % 3;
+            if (op == 0) {
+                std::string bytes = random_bytes((size_t)rand_r(&rng_seed) % (chunk_len * 2));
+                buf.append((uint8_t *)bytes.data(), bytes.size());
+                ref += bytes;
+            } else if (op == 1) {
+                size_t want = 1 + (size_t)rand_r(&rng_seed) % chunk_len;
+                buf_recv(buf, ref, want, (size_t)rand_r(&rng_seed) % (want + 1));
+            } else {
+                size_t len = ref.empty() ? 0 : (size_t)rand_r(&rng_seed) % (ref.size() + 1);
+                buf.consume(len);
+                ref.erase(0, len);
+            }
+            buf_verify(buf, ref, counter);
+        }
+    }
+    assert(counter == 0);
+
+    printf("ok\n");
+    return 0;
+}
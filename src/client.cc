@@ -8,6 +8,7 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 
 #include <vector>
@@ -97,35 +98,69 @@ static int32_t recv_res(int connfd) {
 //     return recv_res(connfd);
 // }
 
-// 13. Create a socket
-// 14. Get connection
-// 15. query something like `"hello number 1"`
-// 16. query something like `"hello number 2"`
-// 17. Clean up by `goto CLEANUP`
+// 13. where to: -h host -p port (TCP, 127.0.0.1:1234 by default), or
+//     -s path for the server's --unix socket. the rest is the command
+// 14. Create a socket
+// 15. Get connection
+// 16. query something like `"hello number 1"`
+// 17. query something like `"hello number 2"`
+// 18. Clean up by `goto CLEANUP`
 // 	- It should close connection and return 0
 int main(int argc, char *argv[]) {
-    if (argc == 1) {
+    const char *host = "127.0.0.1";
+    int port = 1234;
+    const char *unix_path = NULL;
+    int i = 1;
+    for (; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-h") == 0) {
+            host = argv[i + 1];
+        } else if (strcmp(argv[i], "-p") == 0) {
+            port = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            unix_path = argv[i + 1];
+        } else {
+            break;
+        }
+    }
+    if (i == argc) {
         printf("please write command \n");
         return 1;
     }
 
-    int connfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_storage server_addr = {};
+    socklen_t addr_len;
+    if (unix_path) {
+        struct sockaddr_un *un = (struct sockaddr_un *)&server_addr;
+        un->sun_family = AF_UNIX;
+        if (strlen(unix_path) >= sizeof(un->sun_path)) {
+            fprintf(stderr, "socket path too long\n");
+            return 1;
+        }
+        strcpy(un->sun_path, unix_path);
+        addr_len = sizeof(*un);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)&server_addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)port);
+        if (inet_pton(AF_INET, host, &in->sin_addr) != 1) {
+            fprintf(stderr, "bad address: %s\n", host);
+            return 1;
+        }
+        addr_len = sizeof(*in);
+    }
+
+    int connfd = socket(server_addr.ss_family, SOCK_STREAM, 0);
     if (connfd < 0) {
         perror("socket");
         return 1;
     }
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(1234);
-    inet_pton(AF_INET, "127.0.0.1", &(server_addr.sin_addr.s_addr));
-
     std::vector<std::string> cmd;
-    for (int i = 1; i < argc; i++) {
+    for (; i < argc; i++) {
         cmd.push_back(std::string(argv[i]));
     }
 
-    if (connect(connfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+    if (connect(connfd, (struct sockaddr *)&server_addr, addr_len) == -1) {
         perror("connect");
         goto DONE;
     }
@@ -0,0 +1,97 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "util.h"
+
+// glob_match (SCAN MATCH) on the cases that are easy to get wrong: a *
+// that has to give back bytes it took, ranges and negated sets, escapes,
+// and patterns that end early (a trailing \, an unclosed [).
+
+static void expect(const char *pattern, const char *str, bool want) {
+    bool got = glob_match(pattern, str);
+    if (got != want) {
+        fprintf(stderr, "glob_match(\"%s\", \"%s\") = %d, want %d\n", pattern, str, got, want);
+    }
+    assert(got == want);
+}
+
+int main(void) {
+    // stage 1: plain bytes, ? and *
+    expect("", "", true);
+    expect("", "a", false);
+    expect("abc", "abc", true);
+    expect("abc", "abd", false);
+    expect("abc", "ab", false);
+    expect("a?c", "abc", true);
+    expect("a?c", "ac", false);
+    expect("*", "", true);
+    expect("*", "anything", true);
+    expect("**", "", true);
+    expect("user:*", "user:42", true);
+    expect("user:*", "session:42", false);
+
+    // stage 2: * backtracking. the first place that fits isn't the one
+    // that matches, the * has to take more and try again
+    expect("a*bc", "abcbc", true);
+    expect("a*b*c", "axxbyybzzc", true);
+    expect("a*b*c", "axxbyybzz", false);
+    expect("*ab", "aab", true);
+    expect("*ab", "abab", true);
+    expect("a*b", "acbd", false);
+    expect("*a*a*a", "aaa", true);
+    expect("*a*a*a", "aa", false);
+    expect("*x*", "abxcd", true);
+    expect("*?", "", false);
+    expect("*?", "a", true);
+
+    // stage 3: sets and ranges
+    expect("[abc]", "b", true);
+    expect("[abc]", "d", false);
+    expect("[abc]", "", false);
+    expect("[a-c]x", "bx", true);
+    expect("[a-c]x", "cx", true);
+    expect("[a-c]x", "dx", false);
+    expect("[c-a]", "b", true); // backwards range
+    expect("[a-]", "-", true); // a '-' before the ']' is just a byte
+    expect("[a-]", "a", true);
+    expect("[a-]", "b", false);
+    expect("[*]", "*", true);
+    expect("[*]", "a", false);
+    expect("k[0-9][0-9]", "k42", true);
+    expect("k[0-9][0-9]", "k4x", false);
+    expect("*[0-9]", "key7", true);
+
+    // stage 4: negated sets
+    expect("[^x]", "y", true);
+    expect("[^x]", "x", false);
+    expect("[^x]", "", false);
+    expect("[^a-c]", "d", true);
+    expect("[^a-c]", "b", false);
+    expect("a[^b]*", "acbb", true);
+    expect("a[^b]*", "abcc", false);
+
+    // stage 5: escapes
+    expect("\\*", "*", true);
+    expect("\\*", "a", false);
+    expect("a\\?", "a?", true);
+    expect("a\\?", "ab", false);
+    expect("[\\]]", "]", true);
+    expect("[\\^]", "^", true);
+
+    // stage 6: patterns that stop early. a trailing \ is a plain '\',
+    // an unclosed [ runs to the end of the pattern
+    expect("a\\", "a\\", true);
+    expect("a\\", "a", false);
+    expect("\\", "\\", true);
+    expect("[abc", "a", true);
+    expect("[abc", "c", true);
+    expect("[abc", "d", false);
+    expect("[abc", "ab", false);
+    expect("x[", "x", false);
+    expect("x[", "xa", false);
+    expect("*[", "abc", false);
+    expect("[^", "a", true);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "hashtable.h"
+
+// str_hash throughput by key length, next to the byte-at-a-time FNV-1a
+// it replaced. Each length hashes keys at every offset of a 64 KB
+// buffer (so it stays in L2), results are folded into a sink so the
+// compiler can't drop the work.
+//
+// example:
+//  bin/hashbench
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the old str_hash
+static uint64_t fnv1a(uint8_t *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325;
+    const uint64_t prime = 0x00000100000001b3;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= prime;
+    }
+    return hash;
+}
+
+static volatile uint64_t sink;
+
+// ns per hash
+static double bench_len(uint64_t (*hash)(uint8_t *, size_t), std::vector<uint8_t> &buf,
+                        size_t len, size_t iters) {
+    size_t span = buf.size() - len;
+    uint64_t acc = 0;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < iters; i++) {
+        acc ^= hash(buf.data() + (i * 61) % span, len);
+    }
+    double ns = (double)(now_ns() - start) / iters;
+    sink = acc;
+    return ns;
+}
+
+int main(void) {
+    str_hash_seed(1);
+    std::vector<uint8_t> buf(64 * 1024 + 2048);
+    for (size_t i = 0; i < buf.size(); i++) {
+        buf[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    const size_t lens[] = {4, 8, 16, 24, 40, 64, 100, 200, 1024};
+    printf("%8s %12s %12s %12s %12s\n", "key len", "fnv ns", "str_hash ns", "fnv GB/s", "str_hash GB/s");
+    for (size_t len : lens) {
+        size_t iters = 20 * 1000 * 1000 / (len + 16);
+        double fnv_ns = bench_len(fnv1a, buf, len, iters);
+        double new_ns = bench_len(str_hash, buf, len, iters);
+        printf("%8zu %12.1f %12.1f %12.2f %12.2f\n", len,
+               fnv_ns, new_ns, len / fnv_ns, len / new_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "hashtable.h"
+
+// Quality checks for str_hash:
+// - avalanche: flipping any input bit flips every output bit with
+//   probability ~1/2
+// - collisions: no 64-bit collisions on a million similar keys, and the
+//   low bits (HTable slot) and high bits (shard) spread evenly
+// - seed: keys that collide in a slot under one seed don't under another
+
+static unsigned rng_seed = 1;
+
+static void random_bytes(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)rand_r(&rng_seed);
+    }
+}
+
+// worst |P(output bit flips) - 0.5| over every (input bit, output bit).
+// 1 byte keys: all 256 of them instead of random ones
+static double avalanche_bias(size_t len, int samples) {
+    if (len == 1) samples = 256;
+    size_t in_bits = len * 8;
+    std::vector<uint32_t> flips(in_bits * 64, 0);
+    std::vector<uint8_t> buf(len);
+    for (int s = 0; s < samples; s++) {
+        if (len == 1) {
+            buf[0] = (uint8_t)s;
+        } else {
+            random_bytes(buf.data(), len);
+        }
+        uint64_t base = str_hash(buf.data(), len);
+        for (size_t bit = 0; bit < in_bits; bit++) {
+            buf[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+            uint64_t diff = base ^ str_hash(buf.data(), len);
+            buf[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+            for (int out = 0; out < 64; out++) {
+                flips[bit * 64 + out] += (diff >> out) & 1;
+            }
+        }
+    }
+    double worst = 0;
+    for (uint32_t count : flips) {
+        double bias = (double)count / samples - 0.5;
+        if (bias < 0) bias = -bias;
+        if (bias > worst) worst = bias;
+    }
+    return worst;
+}
+
+static uint64_t hash_str(const std::string &str) {
+    return str_hash((uint8_t *)str.data(), str.size());
+}
+
+// most keys in one of `buckets` buckets of the low bits
+static size_t max_bucket(std::vector<uint64_t> &hashes, size_t buckets) {
+    std::vector<size_t> count(buckets, 0);
+    size_t worst = 0;
+    for (uint64_t h : hashes) {
+        worst = std::max(worst, ++count[h & (buckets - 1)]);
+    }
+    return worst;
+}
+
+int main(void) {
+    str_hash_seed(12345);
+
+    // stage 1: basic properties
+    uint8_t buf[300];
+    random_bytes(buf, sizeof(buf));
+    uint8_t copy[301];
+    for (size_t len = 0; len <= 256; len++) {
+        // same bytes, different alignment, same hash
+        memcpy(copy + 1, buf, len);
+        assert(str_hash(buf, len) == str_hash(copy + 1, len));
+        // the length is part of it: a prefix isn't the same key
+        if (len > 0) assert(str_hash(buf, len) != str_hash(buf, len - 1));
+    }
+    uint8_t zeros[3] = {0, 0, 0};
+    assert(str_hash(zeros, 0) != str_hash(zeros, 1));
+    assert(str_hash(zeros, 1) != str_hash(zeros, 2));
+    uint64_t before = hash_str("key:1");
+    str_hash_seed(54321);
+    assert(hash_str("key:1") != before);
+    str_hash_seed(12345);
+    assert(hash_str("key:1") == before);
+
+    // stage 2: avalanche, every length path of str_hash.
+    // sampling noise is 0.5/sqrt(samples) per cell, and the worst of up
+    // to 100K cells per length lands around 5 of those. fail at 6.5, a
+    // real weak spot (like FNV's last byte) is way past that
+    const size_t lens[] = {1, 2, 3, 4, 7, 8, 9, 15, 16, 17, 24, 31, 32,
+                           33, 47, 48, 49, 64, 97, 100, 200};
+    double worst = 0;
+    for (size_t len : lens) {
+        int samples = len == 1 ? 256 : 1000;
+        double bias = avalanche_bias(len, samples);
+        assert(bias < 6.5 * 0.5 / sqrt((double)samples));
+        if (len > 1) worst = std::max(worst, bias);
+    }
+    printf("avalanche: worst bias %.3f over lengths 2..200 (1000 samples)\n", worst);
+
+    // stage 3: collisions on similar keys
+    const size_t n = 1 << 20;
+    std::vector<uint64_t> hashes;
+    for (size_t i = 0; i < n; i++) {
+        hashes.push_back(hash_str("key:" + std::to_string(i)));
+    }
+    std::string prefix(100, 'p');
+    for (size_t i = 0; i < n; i++) {
+        hashes.push_back(hash_str(prefix + std::to_string(i)));
+    }
+    std::vector<uint64_t> sorted = hashes;
+    std::sort(sorted.begin(), sorted.end());
+    size_t dups = 0;
+    for (size_t i = 1; i < sorted.size(); i++) {
+        dups += sorted[i] == sorted[i - 1];
+    }
+    assert(dups == 0);
+    // 2M keys in 64K slots, 32 on average. poisson max is ~60
+    size_t slot_max = max_bucket(hashes, 1 << 16);
+    assert(slot_max < 70);
+    // the shard picks (h >> 32) % N
+    size_t shards[3] = {0, 0, 0};
+    for (uint64_t h : hashes) {
+        shards[(h >> 32) % 3]++;
+    }
+    for (size_t count : shards) {
+        assert(count > hashes.size() / 3 * 99 / 100 && count < hashes.size() / 3 * 101 / 100);
+    }
+    printf("collisions: 0 of %zu keys, fullest of 64K slots %zu (mean %zu)\n",
+           hashes.size(), slot_max, hashes.size() >> 16);
+
+    // stage 4: keys that all share a slot under one seed spread out under
+    // another, so they can't be precomputed
+    std::vector<std::string> same_slot;
+    for (size_t i = 0; same_slot.size() < 1000; i++) {
+        std::string key = "key:" + std::to_string(i);
+        if ((hash_str(key) & 0xfff) == 0) same_slot.push_back(key);
+    }
+    str_hash_seed(777);
+    std::vector<uint64_t> reseeded;
+    for (const std::string &key : same_slot) {
+        reseeded.push_back(hash_str(key));
+    }
+    size_t reseeded_max = max_bucket(reseeded, 1 << 12);
+    assert(reseeded_max < 8);
+    printf("seed: 1000 keys of one slot (of 4K) spread to at most %zu per slot\n", reseeded_max);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "heap.h"
+
+// The heap against a plain array of owners: after every push, update and
+// remove, each owner's index has to point at its own item (that's how
+// the cache finds a key's deadline), and the items have to stay a heap.
+
+struct Owner {
+    uint64_t val = 0;
+    uint32_t heap_idx = heap_none;
+};
+
+static unsigned rng_seed = 1;
+
+static uint64_t random_val() {
+    return (uint64_t)(rand_r(&rng_seed) % 1000);
+}
+
+// cons: verify the heap against the owners
+// 1. every item is no smaller than its parent
+// 2. every item's ref is its owner's index, and it's the item's position
+// 3. owners in the heap hold their item's value, the others heap_none
+static void heap_verify(std::vector<HeapItem> &heap, std::vector<Owner> &owners) {
+    size_t in_heap = 0;
+    for (size_t i = 0; i < heap.size(); i++) {
+        if (i > 0) assert(heap[(i + 1) / 2 - 1].val <= heap[i].val);
+        assert(*heap[i].ref == i);
+    }
+    for (Owner &owner : owners) {
+        if (owner.heap_idx == heap_none) continue;
+        assert(owner.heap_idx < heap.size());
+        assert(heap[owner.heap_idx].ref == &owner.heap_idx);
+        assert(heap[owner.heap_idx].val == owner.val);
+        in_heap++;
+    }
+    assert(in_heap == heap.size());
+}
+
+static void owner_push(std::vector<HeapItem> &heap, Owner &owner, uint64_t val) {
+    owner.val = val;
+    heap_push(heap, val, &owner.heap_idx);
+}
+
+// like entry_set_deadline on a key that has one
+static void owner_update(std::vector<HeapItem> &heap, Owner &owner, uint64_t val) {
+    owner.val = val;
+    heap[owner.heap_idx].val = val;
+    heap_update(heap.data(), owner.heap_idx, heap.size());
+}
+
+int main(void) {
+    // the owners don't move, the heap points into them
+    std::vector<Owner> owners(1000);
+    std::vector<HeapItem> heap;
+
+    // stage 1: basic push and remove
+    heap_verify(heap, owners);
+    owner_push(heap, owners[0], 5);
+    heap_verify(heap, owners);
+    assert(owners[0].heap_idx == 0);
+    heap_remove(heap, owners[0].heap_idx);
+    assert(owners[0].heap_idx == heap_none);
+    heap_verify(heap, owners);
+
+    // stage 2: pushes in decreasing order, each one goes up to the top
+    for (size_t i = 0; i < 100; i++) {
+        owner_push(heap, owners[i], 1000 - i);
+        heap_verify(heap, owners);
+        assert(owners[i].heap_idx == 0);
+    }
+
+    // stage 3: pop the minimum until empty, the values come out sorted
+    uint64_t last = 0;
+    while (!heap.empty()) {
+        Owner *top = (Owner *)((uint8_t *)heap[0].ref - offsetof(Owner, heap_idx));
+        assert(top->val >= last);
+        last = top->val;
+        heap_remove(heap, 0);
+        assert(top->heap_idx == heap_none);
+        heap_verify(heap, owners);
+    }
+
+    // stage 4: random push, update (up and down) and remove from the
+    // middle, the last item fills the hole and moves either way
+    for (int i = 0; i < 20000; i++) {
+        Owner &owner = owners[(size_t)rand_r(&rng_seed) % owners.size()];
+        int op = rand_r(&rng_seed) % 3;
+        if (owner.heap_idx == heap_none) {
+            owner_push(heap, owner, random_val());
+        } else if (op == 0) {
+            heap_remove(heap, owner.heap_idx);
+            assert(owner.heap_idx == heap_none);
+        } else {
+            owner_update(heap, owner, random_val());
+        }
+        heap_verify(heap, owners);
+    }
+
+    // stage 5: remove everything in owner order
+    for (Owner &owner : owners) {
+        if (owner.heap_idx != heap_none) heap_remove(heap, owner.heap_idx);
+        heap_verify(heap, owners);
+    }
+    assert(heap.empty());
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,426 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "common.h"
+#include "hashtable.h"
+
+// HMap against a std::unordered_map holding the same keys, for both
+// kinds: random insert/delete churn that grows and shrinks the map
+// (resizes are incremental, so both tables are often alive). after every
+// step the tables themselves are checked too: sizes, chains in the right
+// slot, swiss control bytes and tombstone counts.
+// hm_scan, for both kinds: a key that's in the map for a whole walk is
+// visited at least once, while the map grows or shrinks between steps.
+// then the swiss paths random keys rarely hit, with keys whose hashes
+// are picked to collide: a tombstone reused by the next insert, a rehash
+// to the same size to drop tombstones, and sm_insert moving everything
+// left in older at once when newer got too full meanwhile.
+
+struct Data {
+    HNode node;
+    uint64_t key;
+};
+
+typedef std::unordered_map<uint64_t, Data *> Ref;
+
+// swiss control bytes, see utils/hashtable.cc
+const uint8_t ctrl_empty = 0x80;
+const uint8_t ctrl_deleted = 0xfe;
+const size_t group_width = 16;
+
+static unsigned rng_seed = 1;
+
+static uint64_t random_u64() {
+    return (uint64_t)rand_r(&rng_seed) << 33 ^ (uint64_t)rand_r(&rng_seed) << 11 ^
+           (uint64_t)rand_r(&rng_seed);
+}
+
+static uint64_t key_hash(uint64_t key) {
+    return str_hash((uint8_t *)&key, sizeof(key));
+}
+
+// every key of these starts its probe at `group` (of any table up to
+// 2^13 groups), h2 still differs
+static uint64_t group_hash(uint64_t key, uint64_t group) {
+    return key << 20 | group << 7 | (key & 0x7f);
+}
+
+static bool data_eq(HNode *n1, HNode *n2) {
+    return container_of(n1, Data, node)->key == container_of(n2, Data, node)->key;
+}
+
+static void map_add(HMap &map, Ref &ref, uint64_t key, uint64_t hashval) {
+    assert(ref.count(key) == 0);
+    Data *data = new Data{};
+    data->key = key;
+    data->node.hashval = hashval;
+    hm_insert(&map, &data->node);
+    ref[key] = data;
+}
+
+// missing keys too: the probe has the hash a present one would have
+static bool map_del(HMap &map, Ref &ref, uint64_t key) {
+    Data probe;
+    probe.key = key;
+    auto iter = ref.find(key);
+    probe.node.hashval = iter != ref.end() ? iter->second->node.hashval : key_hash(key);
+    HNode *node = hm_delete(&map, &probe.node, &data_eq);
+    if (iter == ref.end()) {
+        assert(!node);
+        return false;
+    }
+    assert(node == &iter->second->node);
+    delete iter->second;
+    ref.erase(iter);
+    return true;
+}
+
+static Data *map_find(HMap &map, uint64_t key, uint64_t hashval) {
+    Data probe;
+    probe.key = key;
+    probe.node.hashval = hashval;
+    HNode *node = hm_lookup(&map, &probe.node, &data_eq);
+    return node ? container_of(node, Data, node) : NULL;
+}
+
+// cons: verify one table
+// - chain: every node in the slot of its hash
+// - swiss: a full slot's byte is its node's h2, the counts match
+static size_t table_verify(HMapKind kind, HTable *htab) {
+    if (!htab->table) return 0;
+    size_t slots = htab->mask + 1;
+    size_t full = 0;
+    size_t deleted = 0;
+    for (size_t i = 0; i < slots; i++) {
+        if (kind == HMAP_CHAIN) {
+            for (HNode *cur = htab->table[i]; cur; cur = cur->next) {
+                assert((cur->hashval & htab->mask) == i);
+                full++;
+            }
+        } else if (htab->ctrl[i] == ctrl_deleted) {
+            deleted++;
+        } else if (htab->ctrl[i] != ctrl_empty) {
+            assert(htab->ctrl[i] == (htab->table[i]->hashval & 0x7f));
+            full++;
+        }
+    }
+    assert(full == htab->size);
+    if (kind == HMAP_SWISS) {
+        assert(slots % group_width == 0 && deleted == htab->deleted);
+        // the load factor always leaves a free slot
+        assert(full < slots);
+    }
+    return full;
+}
+
+static bool collect(HNode *node, void *arg) {
+    std::unordered_set<uint64_t> *keys = (std::unordered_set<uint64_t> *)arg;
+    assert(keys->insert(container_of(node, Data, node)->key).second);
+    return true;
+}
+
+// cons: verify the map against the reference, without lookups (they move
+// keys, the churn should see resizes half done)
+static void map_verify(HMap &map, Ref &ref) {
+    size_t keys = table_verify(map.kind, &map.newer) + table_verify(map.kind, &map.older);
+    assert(keys == ref.size() && hm_size(&map) == ref.size());
+    std::unordered_set<uint64_t> seen;
+    hm_foreach(&map, &collect, &seen);
+    assert(seen.size() == ref.size());
+    for (uint64_t key : seen) assert(ref.count(key));
+}
+
+// and with a lookup of every key
+static void map_verify_all(HMap &map, Ref &ref) {
+    map_verify(map, ref);
+    for (auto &kv : ref) {
+        assert(map_find(map, kv.first, kv.second->node.hashval) == kv.second);
+    }
+    map_verify(map, ref);
+}
+
+static void map_settle(HMap &map) {
+    while (hm_rehash_step(&map, (uint64_t)-1)) {}
+}
+
+static size_t map_slots(HMap &map) {
+    return map.newer.mask + 1;
+}
+
+// stage 2: random churn from `keys` possible keys. up to `peak` keys
+// mostly inserting, then down to none mostly deleting, twice. checked
+// after every step while a resize is going on, every 16th otherwise
+static void test_churn(HMapKind kind, uint64_t keys, size_t peak) {
+    HMap map;
+    map.kind = kind;
+    Ref ref;
+    size_t max_slots = 0;
+    size_t grows = 0;
+    size_t shrinks = 0;
+    size_t half_done = 0;
+    for (int round = 0; round < 2; round++) {
+        for (bool up : {true, false}) {
+            while (up ? ref.size() < peak : !ref.empty()) {
+                uint64_t key = random_u64() % keys;
+                bool insert = (rand_r(&rng_seed) % 4 != 0) == up;
+                size_t slots = map.newer.table ? map_slots(map) : 0;
+                if (insert) {
+                    if (ref.count(key) == 0) map_add(map, ref, key, key_hash(key));
+                } else if (!up && !ref.empty() && rand_r(&rng_seed) % 2) {
+                    // a present key, or it never gets down to none
+                    map_del(map, ref, ref.begin()->first);
+                } else {
+                    map_del(map, ref, key); // maybe a miss
+                }
+                if (map.newer.table && slots && map_slots(map) > slots) grows++;
+                if (map.newer.table && slots && map_slots(map) < slots) shrinks++;
+                if (map.newer.table) max_slots = std::max(max_slots, map_slots(map));
+                half_done += hm_rehashing(&map);
+                if (hm_rehashing(&map) || rand_r(&rng_seed) % 16 == 0) map_verify(map, ref);
+            }
+            map_verify_all(map, ref);
+        }
+    }
+    assert(grows >= 4 && shrinks >= 4 && half_done > 0);
+    printf("%s churn: %zu grows, %zu shrinks, up to %zu slots, %zu steps mid-resize\n",
+           hm_kind_name(kind), grows, shrinks, max_slots, half_done);
+}
+
+struct ScanSeen {
+    Ref *ref;
+    std::unordered_map<uint64_t, size_t> visits;
+};
+
+static void scan_visit(HNode *node, void *arg) {
+    ScanSeen *seen = (ScanSeen *)arg;
+    Data *data = container_of(node, Data, node);
+    auto iter = seen->ref->find(data->key);
+    assert(iter != seen->ref->end() && iter->second == data);
+    seen->visits[data->key]++;
+}
+
+// stage 3: walks of hm_scan with inserts (or deletes) of other keys
+// between every two steps, enough to resize the map a few times per
+// walk (up to max_others more keys: a walk of a growing table gets
+// longer). the `stable` keys are there from start to end of every walk
+static void test_scan(HMapKind kind) {
+    HMap map;
+    map.kind = kind;
+    Ref ref;
+    const uint64_t stable = 50;
+    const size_t per_step = 16;
+    const size_t max_others = 4000;
+    for (uint64_t key = 0; key < stable; key++) {
+        map_add(map, ref, key, key_hash(key));
+    }
+    std::vector<uint64_t> others;
+    uint64_t next = stable;
+    size_t resized_walks = 0;
+    size_t max_visits = 0;
+    size_t min_slots = map_slots(map);
+    size_t max_slots = min_slots;
+    for (int walk = 0; walk < 8; walk++) {
+        bool up = walk % 2 == 0;
+        bool resized = false;
+        ScanSeen seen;
+        seen.ref = &ref;
+        uint64_t cursor = 0;
+        do {
+            cursor = hm_scan(&map, cursor, &scan_visit, &seen);
+            size_t slots = map_slots(map);
+            for (size_t i = 0; i < per_step; i++) {
+                if (up && others.size() < max_others) {
+                    map_add(map, ref, next, key_hash(next));
+                    others.push_back(next++);
+                } else if (!others.empty()) {
+                    size_t pos = (size_t)rand_r(&rng_seed) % others.size();
+                    assert(map_del(map, ref, others[pos]));
+                    others[pos] = others.back();
+                    others.pop_back();
+                }
+            }
+            resized = resized || map_slots(map) != slots || hm_rehashing(&map);
+            min_slots = std::min(min_slots, map_slots(map));
+            max_slots = std::max(max_slots, map_slots(map));
+        } while (cursor != 0);
+        for (uint64_t key = 0; key < stable; key++) {
+            assert(seen.visits[key] >= 1);
+        }
+        for (auto &kv : seen.visits) max_visits = std::max(max_visits, kv.second);
+        resized_walks += resized;
+        map_verify_all(map, ref);
+    }
+    // a key can show up twice across a resize, not more than that per table
+    assert(resized_walks >= 4 && max_visits <= 4);
+    printf("%s scan: %zu of 8 walks resized, %zu to %zu slots, a key visited up to %zu times\n",
+           hm_kind_name(kind), resized_walks, min_slots, max_slots, max_visits);
+}
+
+// stage 4: group 0 full, a delete there leaves a tombstone (a probe
+// may go past it), and the next insert with the same start takes it
+static void test_tombstone_reuse() {
+    HMap map;
+    map.kind = HMAP_SWISS;
+    Ref ref;
+    for (uint64_t key = 1; key <= 30; key++) {
+        map_add(map, ref, key, group_hash(key, 0));
+    }
+    map_settle(map);
+    map_verify_all(map, ref);
+    for (size_t i = 0; i < group_width; i++) assert(!(map.newer.ctrl[i] & 0x80));
+    assert(map.newer.deleted == 0);
+
+    uint64_t victim = container_of(map.newer.table[3], Data, node)->key;
+    assert(map_del(map, ref, victim));
+    assert(map.newer.ctrl[3] == ctrl_deleted && map.newer.deleted == 1);
+    // the keys that went on to the next group are still found
+    map_verify_all(map, ref);
+
+    map_add(map, ref, 100, group_hash(100, 0));
+    assert(map.newer.table[3] == &ref[100]->node);
+    assert(map.newer.deleted == 0);
+    map_verify_all(map, ref);
+
+    // a group with an empty byte never had a probe go past it: the slot
+    // goes back to empty, no tombstone
+    uint64_t last = 0;
+    for (size_t i = group_width; i < map.newer.mask + 1; i++) {
+        if (!(map.newer.ctrl[i] & 0x80)) last = container_of(map.newer.table[i], Data, node)->key;
+    }
+    assert(map_del(map, ref, last));
+    assert(map.newer.deleted == 0);
+    map_verify_all(map, ref);
+}
+
+// stage 5: keys deleted from a full group and inserted into another one:
+// the tombstones pile up until the table counts as full with few live
+// keys, then it's rehashed to the same size, which drops them (a table
+// this small moves over within the insert that started it)
+static void test_tombstone_rehash() {
+    HMap map;
+    map.kind = HMAP_SWISS;
+    Ref ref;
+    uint64_t next = 1;
+    std::vector<uint64_t> first;
+    while (ref.size() < group_width) {
+        first.push_back(next);
+        map_add(map, ref, next, group_hash(next, 0));
+        next++;
+    }
+    map_settle(map);
+    size_t slots = map_slots(map);
+    assert(slots == 2 * group_width);
+    for (size_t i = 0; i < group_width; i++) assert(!(map.newer.ctrl[i] & 0x80));
+
+    size_t deleted = 0;
+    for (size_t i = 0; i < 3; i++) {
+        assert(map_del(map, ref, first[i]));
+        deleted++;
+    }
+    assert(map.newer.deleted == deleted);
+    // only the rehash takes tombstones away: group 1 has room for the
+    // inserts, they don't reuse group 0's
+    size_t round = 3;
+    while (map.newer.deleted > 0) {
+        assert(round < first.size());
+        assert(map_del(map, ref, first[round++]));
+        deleted++;
+        map_add(map, ref, next, group_hash(next, 1));
+        next++;
+        map_verify(map, ref);
+    }
+    assert(deleted > group_width / 2 && ref.size() * 2 < slots);
+    assert(map_slots(map) == slots && !hm_rehashing(&map));
+    map_verify_all(map, ref);
+}
+
+// stage 6: sm_insert, with older still alive and newer too full: the
+// rest of older moves at once before the insert. one step of migration
+// per op never gets there, so the state is made by hand from two maps:
+// older has its keys past the first step's slots, newer is at 7/8
+static void test_forced_migration() {
+    Ref ref;
+    // older: 256 slots, 40 keys in the second half
+    HMap older;
+    older.kind = HMAP_SWISS;
+    Ref older_ref;
+    uint64_t next = 1;
+    while (map_slots(older) < 256 || hm_rehashing(&older)) {
+        map_add(older, older_ref, next, group_hash(next, 8 + next % 8));
+        next++;
+    }
+    for (size_t i = 0; i < 256 && older_ref.size() > 40; i++) {
+        if (older.newer.ctrl[i] & 0x80) continue;
+        assert(map_del(older, older_ref, container_of(older.newer.table[i], Data, node)->key));
+    }
+    assert(map_slots(older) == 256 && !hm_rehashing(&older) && older_ref.size() == 40);
+    for (size_t i = 0; i < 128; i++) assert(older.newer.ctrl[i] & 0x80);
+
+    // newer: 512 slots, one key short of too full
+    HMap newer;
+    newer.kind = HMAP_SWISS;
+    Ref newer_ref;
+    while (newer_ref.size() < 447) {
+        map_add(newer, newer_ref, next, key_hash(next));
+        next++;
+    }
+    assert(map_slots(newer) == 512 && !hm_rehashing(&newer) && newer.newer.deleted == 0);
+
+    HMap map;
+    map.kind = HMAP_SWISS;
+    map.older = older.newer;
+    map.newer = newer.newer;
+    map.migrate_pos = 0;
+    ref = older_ref;
+    ref.insert(newer_ref.begin(), newer_ref.end());
+    map_verify(map, ref);
+
+    // 448 of 512: full, but the check comes before the insert
+    map_add(map, ref, next, key_hash(next));
+    next++;
+    assert(map.older.mask + 1 == 256 && map.older.size == 40);
+    map_verify(map, ref);
+    // older moves over whole, then newer grows as usual
+    map_add(map, ref, next, key_hash(next));
+    next++;
+    assert(map.older.mask + 1 == 512 && map_slots(map) == 1024);
+    map_verify(map, ref);
+    map_settle(map);
+    map_verify_all(map, ref);
+}
+
+int main(void) {
+    str_hash_seed(12345);
+
+    for (HMapKind kind : {HMAP_CHAIN, HMAP_SWISS}) {
+        // stage 1: basic
+        HMap map;
+        map.kind = kind;
+        Ref ref;
+        map_verify_all(map, ref);
+        assert(!map_del(map, ref, 1));
+        map_add(map, ref, 1, key_hash(1));
+        map_verify_all(map, ref);
+        assert(!map_find(map, 2, key_hash(2)));
+        assert(map_del(map, ref, 1));
+        map_verify_all(map, ref);
+
+        // stage 2: churn
+        test_churn(kind, 4000, 2000);
+
+        // stage 3: scan
+        test_scan(kind);
+    }
+
+    test_tombstone_reuse();
+    test_tombstone_rehash();
+    test_forced_migration();
+    printf("ok\n");
+    return 0;
+}
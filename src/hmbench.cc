@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "hashtable.h"
+
+// Microbenchmark for the HMap kinds (chained vs swiss), straight on the
+// hm_* interface with the same Entry nodes the server uses. Keys are
+// hashed up front, so only the map is timed. Phases, per kind:
+//  - insert: n new keys
+//  - hit: n lookups of present keys, random order
+//  - miss: n lookups of absent keys
+//  - churn: n times delete a present key + insert an absent one
+//    (swiss: leaves tombstones behind)
+//  - delete: every key, random order
+// every result is checked, a wrong answer exits non-zero.
+// B/key is the slot arrays (+ control bytes) per key after insert, plus
+// the HNode each Entry embeds. B left is the slot arrays after deleting
+// every key (the map shrinks on the way down). Entries come from a slab like the server's.
+//
+// example:
+//  bin/hmbench -n 4000000
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// only its slab is used, the maps are the benchmark's own
+static Cache pool;
+
+static Entry *key_entry(const std::string &key) {
+    uint64_t hashval = str_hash((uint8_t *)key.data(), key.size());
+    return entry_new(&pool, key, hashval, "");
+}
+
+static LookupKey probe_of(Entry *entry) {
+    LookupKey probe;
+    probe.key = entry_key(entry);
+    probe.node.hashval = entry->node.hashval;
+    return probe;
+}
+
+static bool failed = false;
+
+static void expect(bool ok, const char *what) {
+    if (!ok && !failed) {
+        fprintf(stderr, "wrong result: %s\n", what);
+    }
+    failed = failed || !ok;
+}
+
+static double ns_per(uint64_t start, size_t n) {
+    return (double)(now_ns() - start) / (double)n;
+}
+
+static void bench_kind(HMapKind kind, std::vector<Entry *> &present,
+                       std::vector<Entry *> &absent, std::vector<size_t> &order) {
+    HMap map;
+    map.kind = kind;
+    size_t n = present.size();
+
+    uint64_t start = now_ns();
+    for (Entry *entry : present) {
+        hm_insert(&map, &entry->node);
+    }
+    double insert_ns = ns_per(start, n);
+    expect(hm_size(&map) == n, "size after insert");
+    double bytes_per_key = (double)hm_mem(&map) / n + sizeof(HNode);
+
+    start = now_ns();
+    for (size_t i : order) {
+        LookupKey probe = probe_of(present[i]);
+        HNode *node = hm_lookup(&map, &probe.node, &entry_key_eq);
+        expect(node == &present[i]->node, "hit");
+    }
+    double hit_ns = ns_per(start, n);
+
+    start = now_ns();
+    for (size_t i : order) {
+        LookupKey probe = probe_of(absent[i]);
+        expect(hm_lookup(&map, &probe.node, &entry_key_eq) == NULL, "miss");
+    }
+    double miss_ns = ns_per(start, n);
+
+    // swap present[i] out for absent[i], then swap back, so both sets
+    // are the same as before
+    start = now_ns();
+    for (int round = 0; round < 2; round++) {
+        for (size_t i : order) {
+            LookupKey probe = probe_of(present[i]);
+            expect(hm_delete(&map, &probe.node, &entry_key_eq) == &present[i]->node, "churn delete");
+            hm_insert(&map, &absent[i]->node);
+            std::swap(present[i], absent[i]);
+        }
+    }
+    double churn_ns = ns_per(start, 2 * n);
+    expect(hm_size(&map) == n, "size after churn");
+
+    start = now_ns();
+    for (size_t i : order) {
+        LookupKey probe = probe_of(present[i]);
+        expect(hm_delete(&map, &probe.node, &entry_key_eq) == &present[i]->node, "delete");
+    }
+    double delete_ns = ns_per(start, n);
+    expect(hm_size(&map) == 0, "size after delete");
+    // finish a shrink that's still going
+    while (hm_rehash_step(&map, 1000 * 1000)) {}
+    size_t bytes_left = hm_mem(&map);
+
+    printf("%-8s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10zu\n", hm_kind_name(kind),
+           insert_ns, hit_ns, miss_ns, churn_ns, delete_ns, bytes_per_key, bytes_left);
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = 1 << 20;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            n = (size_t)atol(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-n keys]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n == 0) return 1;
+
+    std::vector<Entry *> present;
+    std::vector<Entry *> absent;
+    for (size_t i = 0; i < n; i++) {
+        present.push_back(key_entry("key:" + std::to_string(i)));
+        absent.push_back(key_entry("nokey:" + std::to_string(i)));
+    }
+    std::vector<size_t> order(n);
+    unsigned seed = 1;
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (size_t i = n - 1; i > 0; i--) {
+        std::swap(order[i], order[rand_r(&seed) % (i + 1)]);
+    }
+
+    printf("keys=%zu, ns/op\n", n);
+    printf("%-8s %10s %10s %10s %10s %10s %10s %10s\n", "map",
+           "insert", "hit", "miss", "churn", "delete", "B/key", "B left");
+    bench_kind(HMAP_CHAIN, present, absent, order);
+    bench_kind(HMAP_SWISS, present, absent, order);
+
+    for (size_t i = 0; i < n; i++) {
+        entry_free(&pool, present[i]);
+        entry_free(&pool, absent[i]);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "iopool.h"
+
+// IoPool rounds the way io_fanout uses them: items dealt round-robin to
+// the threads, each one works on its own share. after io_pool_run every
+// item was done exactly once in this round and every thread ran once,
+// the caller as idx 0, the writes all visible. rounds of any size, zero
+// items included, back to back (helpers still spinning) and after a
+// pause (helpers asleep on the condvar).
+
+struct Round {
+    uint32_t num_threads;
+    uint64_t id;
+    std::vector<uint32_t> done; // per item, times it was done
+    std::vector<uint32_t> calls; // per idx, times fn ran
+    std::vector<uint64_t> seen_id; // per idx, the round it saw
+    std::thread::id caller;
+    bool caller_ok = false;
+};
+
+static unsigned rng_seed = 1;
+
+static void round_fn(void *arg, uint32_t idx) {
+    Round *round = (Round *)arg;
+    assert(idx < round->num_threads);
+    round->calls[idx]++;
+    round->seen_id[idx] = round->id;
+    if (idx == 0) round->caller_ok = std::this_thread::get_id() == round->caller;
+    for (size_t i = idx; i < round->done.size(); i += round->num_threads) {
+        round->done[i]++;
+    }
+}
+
+// one round of `num_items`, then check it
+static void run_round(IoPool *pool, uint64_t id, size_t num_items) {
+    Round round;
+    round.num_threads = pool->num_threads;
+    round.id = id;
+    round.done.assign(num_items, 0);
+    round.calls.assign(pool->num_threads, 0);
+    round.seen_id.assign(pool->num_threads, 0);
+    round.caller = std::this_thread::get_id();
+    io_pool_run(pool, round_fn, &round);
+
+    for (uint32_t count : round.done) assert(count == 1);
+    for (uint32_t idx = 0; idx < pool->num_threads; idx++) {
+        assert(round.calls[idx] == 1 && round.seen_id[idx] == id);
+    }
+    assert(round.caller_ok);
+}
+
+int main(void) {
+    uint64_t id = 0;
+
+    // stage 1: no helpers, the caller does it all
+    IoPool *alone = new IoPool;
+    io_pool_init(alone, 1);
+    assert(alone->threads.empty());
+    run_round(alone, ++id, 0);
+    run_round(alone, ++id, 100);
+
+    // stage 2: four threads, a zero-item round first and then rounds of
+    // random size back to back, some of them empty or smaller than the
+    // pool. the helpers live as long as the process, like the server's
+    IoPool *pool = new IoPool;
+    io_pool_init(pool, 4);
+    assert(pool->threads.size() == 3);
+    run_round(pool, ++id, 0);
+    for (int i = 0; i < 20000; i++) {
+        size_t num_items = rand_r(&rng_seed) % 4 == 0 ? (size_t)rand_r(&rng_seed) % 4
+                                                       : (size_t)rand_r(&rng_seed) % 300;
+        run_round(pool, ++id, num_items);
+    }
+
+    // stage 3: a pause before each round, long enough for the helpers to
+    // stop spinning and sleep. the next round has to wake them all
+    for (int i = 0; i < 50; i++) {
+        usleep(2000);
+        run_round(pool, ++id, i % 5 == 0 ? 0 : (size_t)i * 7);
+    }
+
+    printf("ok\n");
+    return 0;
+}
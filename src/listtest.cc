@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <list>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "list.h"
+
+// DList the way the reactor's idle and busy lists use it, against a
+// std::list of the same items: insert at the tail, detach from the head,
+// the middle or the tail, and "touch" (detach, insert at the tail again,
+// maybe of the other list) that keeps a list ordered by last activity.
+// both directions are walked after every step, a detached node points
+// at itself.
+
+struct Item {
+    DList node;
+    int id;
+    int list = -1; // which list it's in, -1 = none
+};
+
+typedef std::list<Item *> Ref;
+
+static unsigned rng_seed = 1;
+
+// cons: verify one list against the reference
+// 1. forward from the dummy node: the items in order, each prev link
+//    pointing back at where we came from
+// 2. backward: the same items in reverse
+// 3. empty exactly when there are none
+static void list_verify(DList *list, const Ref &ref) {
+    auto iter = ref.begin();
+    DList *prev = list;
+    for (DList *cur = list->next; cur != list; cur = cur->next) {
+        assert(iter != ref.end());
+        assert(cur == &(*iter)->node);
+        assert(cur->prev == prev);
+        prev = cur;
+        iter++;
+    }
+    assert(iter == ref.end() && list->prev == prev);
+
+    auto riter = ref.rbegin();
+    for (DList *cur = list->prev; cur != list; cur = cur->prev) {
+        assert(riter != ref.rend() && cur == &(*riter)->node);
+        riter++;
+    }
+    assert(riter == ref.rend());
+    assert(dlist_empty(list) == ref.empty());
+}
+
+static void item_detach(Item *item, Ref &ref) {
+    dlist_detach(&item->node);
+    ref.remove(item);
+    item->list = -1;
+    // unlinked from its neighbors, and linked to itself
+    assert(item->node.next == &item->node && item->node.prev == &item->node);
+}
+
+// like conn_timer_touch
+static void item_touch(Item *item, DList *lists, Ref *refs, int to) {
+    dlist_detach(&item->node);
+    if (item->list >= 0) refs[item->list].remove(item);
+    dlist_insert_before(&lists[to], &item->node);
+    refs[to].push_back(item);
+    item->list = to;
+}
+
+int main(void) {
+    std::vector<Item> items(8);
+    for (size_t i = 0; i < items.size(); i++) {
+        items[i].id = (int)i;
+        dlist_init(&items[i].node);
+    }
+    DList list;
+    dlist_init(&list);
+    Ref ref;
+
+    // stage 1: empty, and detaching a node that isn't in a list
+    list_verify(&list, ref);
+    item_detach(&items[0], ref);
+    list_verify(&list, ref);
+
+    // stage 2: insert before the dummy node appends, before a node
+    // puts it in front of that one
+    for (int i = 0; i < 5; i++) {
+        dlist_insert_before(&list, &items[i].node);
+        ref.push_back(&items[i]);
+        items[i].list = 0;
+        list_verify(&list, ref);
+    }
+    dlist_insert_before(&items[2].node, &items[5].node); // 0 1 5 2 3 4
+    ref.insert(std::find(ref.begin(), ref.end(), &items[2]), &items[5]);
+    items[5].list = 0;
+    list_verify(&list, ref);
+    assert(container_of(list.next, Item, node)->id == 0);
+    assert(container_of(list.prev, Item, node)->id == 4);
+
+    // stage 3: detach the head, a middle node, the tail
+    item_detach(&items[0], ref);
+    list_verify(&list, ref);
+    assert(container_of(list.next, Item, node)->id == 1);
+    item_detach(&items[2], ref);
+    list_verify(&list, ref);
+    item_detach(&items[4], ref);
+    list_verify(&list, ref);
+    assert(container_of(list.prev, Item, node)->id == 3); // 1 5 3
+
+    // stage 4: touch moves a node to the back. the head, the back one
+    // (stays where it is), a detached one
+    item_touch(&items[1], &list, &ref, 0); // 5 3 1
+    list_verify(&list, ref);
+    item_touch(&items[1], &list, &ref, 0);
+    list_verify(&list, ref);
+    item_touch(&items[0], &list, &ref, 0); // 5 3 1 0
+    list_verify(&list, ref);
+    assert(container_of(list.next, Item, node)->id == 5);
+    assert(container_of(list.prev, Item, node)->id == 0);
+
+    // stage 5: detach every node, from the head: empty again
+    while (!dlist_empty(&list)) {
+        item_detach(container_of(list.next, Item, node), ref);
+        list_verify(&list, ref);
+    }
+    assert(ref.empty());
+
+    // stage 6: random touches between two lists (idle and busy) and
+    // detaches, like conns going back and forth and closing
+    std::vector<Item> conns(200);
+    for (size_t i = 0; i < conns.size(); i++) {
+        conns[i].id = (int)i;
+        dlist_init(&conns[i].node);
+    }
+    DList two[2];
+    Ref two_refs[2];
+    dlist_init(&two[0]);
+    dlist_init(&two[1]);
+    for (int i = 0; i < 20000; i++) {
+        Item *item = &conns[(size_t)rand_r(&rng_seed) % conns.size()];
+        if (rand_r(&rng_seed) % 8 == 0) {
+            if (item->list >= 0) item_detach(item, two_refs[item->list]);
+        } else {
+            item_touch(item, two, two_refs, rand_r(&rng_seed) % 2);
+        }
+        if (i % 64 == 0) {
+            list_verify(&two[0], two_refs[0]);
+            list_verify(&two[1], two_refs[1]);
+        }
+    }
+    list_verify(&two[0], two_refs[0]);
+    list_verify(&two[1], two_refs[1]);
+    for (Item &item : conns) {
+        if (item.list >= 0) item_detach(&item, two_refs[item.list]);
+    }
+    list_verify(&two[0], two_refs[0]);
+    list_verify(&two[1], two_refs[1]);
+    assert(dlist_empty(&two[0]) && dlist_empty(&two[1]));
+
+    printf("ok\n");
+    return 0;
+}
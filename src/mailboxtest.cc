@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "mailbox.h"
+
+// The mailbox against a std::deque with one producer, then with several
+// producer threads pushing tagged items while the owner pops: every item
+// comes out once, and each producer's items in the order it pushed them
+// (the only order an MPSC queue promises). and the stub node: an empty
+// box is just the stub, popping the last item puts it back behind.
+
+struct Item {
+    MailNode node;
+    uint32_t producer;
+    uint32_t seq;
+};
+
+static unsigned rng_seed = 1;
+
+static Item *pop_item(Mailbox &box) {
+    MailNode *node = mailbox_pop(&box);
+    return node ? container_of(node, Item, node) : NULL;
+}
+
+// no producer running: the box is only the stub again
+static void box_verify_empty(Mailbox &box) {
+    assert(mailbox_pop(&box) == NULL);
+    assert(box.tail == &box.stub && box.head.load() == &box.stub);
+    assert(box.stub.next.load() == NULL);
+}
+
+const uint32_t num_producers = 4;
+const uint32_t per_producer = 200000;
+
+static void producer(Mailbox *box, Item *items, uint32_t id, std::atomic<uint32_t> *done) {
+    for (uint32_t i = 0; i < per_producer; i++) {
+        items[i].producer = id;
+        items[i].seq = i;
+        mailbox_push(box, &items[i].node);
+        if (i % 1024 == 0) sched_yield(); // let the others in between
+    }
+    done->fetch_add(1);
+}
+
+int main(void) {
+    Mailbox box;
+    mailbox_init(&box);
+
+    // stage 1: empty, then one item at a time. the tail is the only item
+    // and the head at once, pop puts the stub behind it to hand it out
+    box_verify_empty(box);
+    std::vector<Item> items(1000);
+    for (int i = 0; i < 3; i++) {
+        mailbox_push(&box, &items[i].node);
+        assert(box.head.load() == &items[i].node);
+        assert(pop_item(box) == &items[i]);
+        box_verify_empty(box);
+    }
+
+    // stage 2: one producer, FIFO. a full box drained, then random
+    // pushes and pops against a deque, nodes pushed again once popped
+    for (size_t i = 0; i < items.size(); i++) {
+        items[i].seq = (uint32_t)i;
+        mailbox_push(&box, &items[i].node);
+    }
+    for (size_t i = 0; i < items.size(); i++) {
+        Item *item = pop_item(box);
+        assert(item == &items[i] && item->seq == i);
+    }
+    box_verify_empty(box);
+
+    std::deque<Item *> ref;
+    std::vector<Item *> free_items;
+    for (Item &item : items) free_items.push_back(&item);
+    uint32_t next_seq = 0;
+    for (int i = 0; i < 100000; i++) {
+        if (!free_items.empty() && rand_r(&rng_seed) % 2) {
+            Item *item = free_items.back();
+            free_items.pop_back();
+            item->seq = next_seq++;
+            mailbox_push(&box, &item->node);
+            ref.push_back(item);
+        } else {
+            Item *item = pop_item(box);
+            if (ref.empty()) {
+                assert(!item);
+                continue;
+            }
+            assert(item == ref.front() && item->seq == ref.front()->seq);
+            ref.pop_front();
+            free_items.push_back(item);
+        }
+    }
+    while (!ref.empty()) {
+        assert(pop_item(box) == ref.front());
+        ref.pop_front();
+    }
+    box_verify_empty(box);
+
+    // stage 3: producer threads against the owner popping meanwhile.
+    // per producer the next seq, and the total. a NULL pop while they
+    // run is either empty or a push half done, try again. once they're
+    // all done, an empty pop means the box is drained
+    std::vector<Item> tagged((size_t)num_producers * per_producer);
+    std::atomic<uint32_t> done{0};
+    std::vector<std::thread> threads;
+    for (uint32_t id = 0; id < num_producers; id++) {
+        threads.emplace_back(producer, &box, &tagged[(size_t)id * per_producer], id, &done);
+    }
+    std::vector<uint32_t> expect(num_producers, 0);
+    uint64_t total = 0;
+    uint64_t empty_pops = 0;
+    while (true) {
+        bool finished = done.load() == num_producers;
+        Item *item = pop_item(box);
+        if (!item) {
+            if (finished) break;
+            empty_pops++;
+            continue;
+        }
+        assert(item->producer < num_producers);
+        assert(item == &tagged[(size_t)item->producer * per_producer + item->seq]);
+        assert(item->seq == expect[item->producer]);
+        expect[item->producer]++;
+        total++;
+    }
+    for (std::thread &thread : threads) thread.join();
+    assert(total == (uint64_t)num_producers * per_producer);
+    for (uint32_t id = 0; id < num_producers; id++) {
+        assert(expect[id] == per_producer);
+    }
+    box_verify_empty(box);
+    printf("%u producers: %lu items, %lu empty pops\n", num_producers, (unsigned long)total,
+           (unsigned long)empty_pops);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util.h"
+
+// --output-hard-limit against pipelined requests whose replies come in
+// through the mailbox: a GET forwarded to the other shard, a KEYS
+// answered by a snapshot child. the reply that goes over the limit
+// closes the conn in the middle of a poll batch, while the conn's own
+// read event (the client keeps sending) may still be further down the
+// same batch. the server has to live through a few thousand of those and
+// still answer afterwards.
+//
+// usage: bin/outlimittest [path/to/server], from the repo root
+
+const int test_port = 12391;
+const int num_keys = 128; // their names alone are over it in KEYS
+const size_t value_len = 2000; // one reply is over the limit already
+const char *hard_limit = "1024"; // INFO still fits
+const int num_clients = 16;
+const int storm_secs = 2;
+
+static int test_connect() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)test_port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr.s_addr);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    return fd;
+}
+
+// append one request: u32 nwords, then (u32 len, bytes) for each word
+static void put_req(std::string &out, const std::vector<std::string> &cmd) {
+    uint32_t n = (uint32_t)cmd.size();
+    out.append((char *)&n, 4);
+    for (const std::string &word : cmd) {
+        uint32_t len = (uint32_t)word.size();
+        out.append((char *)&len, 4);
+        out.append(word);
+    }
+}
+
+// exactly len bytes, false on EOF/error
+static bool recv_exact(int fd, char *buff, size_t len) {
+    while (len > 0) {
+        ssize_t got = recv(fd, buff, len, 0);
+        if (got <= 0) return false;
+        buff += got;
+        len -= (size_t)got;
+    }
+    return true;
+}
+
+// one reply: u32 len, u32 status, data. false on EOF/error
+static bool read_res(int fd, uint32_t &status, std::string &data) {
+    uint32_t len;
+    if (!recv_exact(fd, (char *)&len, 4) || len < 4) return false;
+    std::string msg(len, '\0');
+    if (!recv_exact(fd, &msg[0], len)) return false;
+    memcpy(&status, msg.data(), 4);
+    data = msg.substr(4);
+    return true;
+}
+
+static bool call(int fd, const std::vector<std::string> &cmd, uint32_t &status, std::string &data) {
+    std::string req;
+    put_req(req, cmd);
+    return send_all(fd, &req[0], req.size()) == 0 && read_res(fd, status, data);
+}
+
+static pid_t spawn_server(const char *server, const std::string &args) {
+    fflush(stdout); // or the child prints our buffered lines again
+    pid_t pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        std::string cmd = std::string("exec ") + server + " " + args;
+        execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *)NULL);
+        _exit(127);
+    }
+    for (int i = 0; i < 100; i++) {
+        int fd = test_connect();
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        usleep(20 * 1000);
+    }
+    fprintf(stderr, "server did not come up: %s %s\n", server, args.c_str());
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    exit(1);
+}
+
+// the port stays taken for a moment after the process is gone
+static void wait_port_free() {
+    for (int i = 0; i < 100; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)test_port);
+        int rv = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        close(fd);
+        if (rv == 0) return;
+        usleep(20 * 1000);
+    }
+}
+
+// a client that never reads: a batch of GETs (and a KEYS) then more
+// batches right behind it, until the server hangs up on us. again and
+// again until the deadline
+static void storm_client(int id, time_t deadline, std::atomic<uint64_t> *conns) {
+    unsigned seed = (unsigned)id + 1;
+    while (time(NULL) < deadline) {
+        int fd = test_connect();
+        if (fd < 0) continue;
+        conns->fetch_add(1);
+        for (int batch = 0; batch < 64; batch++) {
+            std::string req;
+            for (int i = 0; i < 16; i++) {
+                put_req(req, {"get", "big:" + std::to_string(rand_r(&seed) % num_keys)});
+            }
+            if (rand_r(&seed) % 8 == 0) put_req(req, {"keys"});
+            if (send(fd, req.data(), req.size(), MSG_NOSIGNAL) < 0) break;
+            if (rand_r(&seed) % 2) usleep(rand_r(&seed) % 200);
+        }
+        close(fd);
+    }
+}
+
+static bool server_alive(pid_t pid) {
+    int wstatus;
+    pid_t got = waitpid(pid, &wstatus, WNOHANG);
+    if (got == 0) return true;
+    if (WIFSIGNALED(wstatus)) {
+        fprintf(stderr, "server died: signal %d\n", WTERMSIG(wstatus));
+    } else {
+        fprintf(stderr, "server exited: %d\n", WEXITSTATUS(wstatus));
+    }
+    return false;
+}
+
+static void test_server(const char *server, const std::string &args) {
+    std::string all_args = args + " --output-hard-limit " + hard_limit + " --port " +
+                           std::to_string(test_port);
+    pid_t pid = spawn_server(server, all_args);
+
+    // stage 1: keys on every shard with a value too big for one reply,
+    // and a small one to check on the server at the end
+    int fd = test_connect();
+    assert(fd >= 0);
+    uint32_t status;
+    std::string data;
+    std::string value(value_len, 'v');
+    for (int i = 0; i < num_keys; i++) {
+        assert(call(fd, {"set", "big:" + std::to_string(i), value}, status, data));
+        assert(status == RES_OK);
+    }
+    assert(call(fd, {"set", "small", "x"}, status, data) && status == RES_OK);
+    close(fd);
+
+    // stage 2: clients pipelining requests they never read the replies of
+    std::atomic<uint64_t> conns{0};
+    time_t deadline = time(NULL) + storm_secs;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_clients; i++) {
+        threads.emplace_back(storm_client, i, deadline, &conns);
+    }
+    for (std::thread &thread : threads) thread.join();
+    assert(server_alive(pid));
+
+    // stage 3: it still answers, and it did close conns over the limit
+    fd = test_connect();
+    assert(fd >= 0);
+    assert(call(fd, {"get", "small"}, status, data));
+    assert(status == RES_OK && data == "x");
+    assert(call(fd, {"info"}, status, data) && status == RES_OK);
+    std::string key = "output_hard_limit_closes:";
+    size_t pos = data.find(key);
+    assert(pos != std::string::npos);
+    long closes = atol(data.c_str() + pos + key.size());
+    assert(closes > 0);
+    close(fd);
+    assert(server_alive(pid));
+    printf("%s: %lu conns, %ld closed over the limit\n", args.c_str(),
+           (unsigned long)conns.load(), closes);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    wait_port_free();
+}
+
+int main(int argc, char *argv[]) {
+    const char *server = argc > 1 ? argv[1] : "bin/server";
+    // the forwarded replies, through each loop. --io-threads has one
+    // shard, its KEYS replies come through the mailbox all the same
+    test_server(server, "--poll --threads 2");
+    test_server(server, "--epoll --threads 2");
+    test_server(server, "--poll --io-threads 2");
+    test_server(server, "--io-uring --threads 2");
+    printf("ok\n");
+    return 0;
+}
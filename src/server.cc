@@ -5,50 +5,453 @@
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <stdarg.h>
+#include <math.h>
+#include <malloc.h>
 
 // syscall
 #include <poll.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <sys/wait.h>
 
 // C++ STL
 #include <vector>
 #include <string>
+#include <string_view>
 #include <map>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 
 // my modules
 #include "util.h"
 #include "common.h"
-#include "buffer.h"
+#include "chunkbuf.h"
 #include "hashtable.h"
 #include "zset.h"
+#include "poller.h"
+#include "mailbox.h"
+#include "uring.h"
+#include "value.h"
+#include "list.h"
+#include "iopool.h"
+#include "bgpool.h"
+#include "log.h"
 
-const int server_back_log = 10;
+const uint16_t port_default = 1234;
+// listen() queue, connections the kernel completed that we haven't
+// accepted yet. a reconnect storm overflows a short one, and a dropped
+// SYN is only retried after 1 s. capped by net.core.somaxconn
+const int backlog_default = 4096;
+// conns accepted per listener event, the rest wait for the next round
+const size_t accept_budget = 256;
 const size_t max_msg_len = 32 << 20;
-static Cache g_cache;
+// values this big are sent straight from the keyspace, not copied
+const size_t zero_copy_min = 16 * 1024;
+const size_t max_send_iov = 64;
+// recv straight into the tail chunk of Conn::incoming while it has this
+// much room left, into a new chunk after that
+const size_t read_min = 1024;
+// a request bigger than a chunk gets a chunk of its own (conn_in_prepare),
+// with this much room past the words known so far, for the ones after
+const size_t big_req_slack = 1024;
+// stop reading one conn after this much, so others get a turn
+const size_t read_budget = 256 * 1024;
+// pipelined requests parsed (and prefetched) ahead of running them
+const size_t max_batch = 128;
+// requests a conn runs per turn, then the others get theirs: the rest of
+// a deep pipeline waits in Reactor::ready for the next loop round
+const size_t conn_quantum = 256;
+// a map resize left over when requests stop moves this long per idle
+// round of the loop, then we poll again
+const uint64_t idle_rehash_ns = 1000 * 1000;
+// the expiry sweep removes keys in rounds of expire_batch, and stops for
+// this loop iteration after expire_budget_ns, so a million keys expiring
+// at once are spread over many iterations instead of one long stall
+const size_t expire_batch = 64;
+const uint64_t expire_budget_ns = 1000 * 1000;
+// slab pages freed since the last trim before an idle malloc_trim (4 MB)
+const size_t trim_pages = 64;
+// the deadline heap's array is cut down to size when the loop is idle
+// and it's under 1/ttl_shrink_ratio full, from ttl_shrink_min items (64 KB)
+const size_t ttl_shrink_ratio = 4;
+const size_t ttl_shrink_min = 4096;
+// keys sampled per eviction when over --maxmemory (Redis' default too)
+const size_t evict_samples_default = 5;
+// INFO MEMORY lists this many of the conns with the biggest buffers. a
+// busy reactor refreshes its list at most every conn_report_ms
+const size_t mem_top_conns = 5;
+const uint64_t conn_report_ms = 100;
+// a conn's output (replies + unsent pinned values) over the soft limit:
+// it stops reading and running requests until the client catches up,
+// so TCP pushes back on it. over the hard limit it's closed. 0 = none
+const size_t out_soft_default = 1 << 20;
+const size_t out_hard_default = 0;
+// close a conn after this long with nothing in flight (--timeout, 0 =
+// never, clients may keep a pool of idle conns), or stalled halfway
+// through a request or a reply (--io-timeout)
+const uint64_t idle_timeout_default_ms = 0;
+const uint64_t io_timeout_default_ms = 30 * 1000;
 
-static ZSet zset;
+// background threads (g_bg): malloc_trim, reaping snapshot children,
+// freeing big values
+const uint32_t bg_threads_default = 2;
+// values this big are freed on g_bg when their last ref goes (DEL, an
+// overwrite, the reply that pinned it), see value_lazy_free
+const size_t lazy_free_min = 64 * 1024;
+
+struct Reactor;
+struct Forward;
+struct Command;
+struct IoSlot;
+
+// one parsed request of a pipelined batch, see conn_run_batch
+struct BatchReq {
+    uint8_t *req; // raw bytes, in Conn::incoming or Reactor::linear
+    size_t len;
+    size_t word_begin; // its words are batch_words[word_begin, word_end)
+    size_t word_end;
+    const Command *command; // NULL: bad request, reply with the error
+    uint64_t hashval;
+    Reactor *owner;
+};
+
+// a value sent in place: it goes out right before byte `pos` of the
+// outgoing stream (counted from the first byte ever appended)
+struct OutRef {
+    uint64_t pos;
+    Value *value; // pinned until fully sent
+    size_t sent = 0;
+};
 
 struct Conn {
     int fd = -1;
     bool want_read = false;
     bool want_write = false;
     bool want_close = false;
+    uint32_t events = 0; // interest currently registered in the poller
+    Reactor *reactor = NULL; // the loop that owns this conn
+
+    // replies that can't go out yet because an earlier request is still
+    // at another shard. flushed in request order as they become ready
+    std::deque<Forward *> pending;
+    // a CMD_ALL_SHARDS request out: the next ones wait for its reply, so
+    // it can't see them (each shard runs its part when it gets to it)
+    Forward *barrier = NULL;
+    bool closed = false; // fd is gone, free when `pending` drains
+    bool read_again = false; // edge-triggered: ran out of budget, not EAGAIN
+    bool out_paused = false; // over the soft output limit, see conn_out_check
+    bool in_full = false; // read_budget of requests waiting to run, stop reading
+    bool ready = false; // in Reactor::ready, used up its quantum
+    // in Reactor::idle_conns or busy_conns, see conn_timer_touch
+    DList timer_node;
+    uint64_t last_io = 0; // loop clock (ms) at its last event
+
+    // io_uring only: the kernel reads `outgoing` while a send is in
+    // flight, so nothing may append (or move) it until it completes
+    bool sending = false;
+    uint32_t uring_ops = 0; // submitted requests still pointing to us
+    bool recv_armed = false; // a multishot recv is in flight
+    bool recv_cancel = false; // and it's being cancelled (paused)
+    std::vector<struct iovec> send_iov; // must outlive an io_uring sendmsg
+    struct msghdr send_msg = {};
+
+    ChunkBuf incoming;
+    ChunkBuf outgoing;
+    // output = outgoing bytes with the values in out_refs spliced in
+    std::deque<OutRef> out_refs;
+    uint64_t out_pos = 0; // stream position of outgoing.data()
+    size_t out_ref_bytes = 0; // unsent bytes in out_refs
+
+    // --io-threads: this round's recv/send, done by an I/O thread
+    bool io_queued = false; // in Reactor::io_fds
+    bool io_read = false;
+    bool io_write = false;
+    ssize_t io_res = 0; // what recv/send returned
+    int io_errno = 0;
+    // the requests it parsed, from the front of incoming:
+    // io_slot->batch[io_begin, io_end)
+    IoSlot *io_slot = NULL;
+    size_t io_begin = 0;
+    size_t io_end = 0;
+};
+
+// --io-threads: one I/O thread's share of a round (see io_round), and
+// where it parses to. only that thread touches it during the fan-out
+struct IoSlot {
+    std::vector<Conn *> conns;
+    uint64_t syscalls = 0;
+    std::vector<BatchReq> batch;
+    std::vector<std::string_view> words;
+    std::vector<std::string_view> cmd;
+};
+
+enum IoOp : uint8_t {
+    IO_READ, // recv + parse
+    IO_WRITE, // send
+};
+
+// a partition of the keyspace, only touched by its own reactor thread
+struct Shard {
+    uint32_t id = 0; // same as its reactor's
+    Cache cache;
+    ZSet zset;
+    size_t page_peak = 0; // most slab pages since the last malloc_trim
+    // --maxmemory split evenly (keys are), 0 = no limit. counted by
+    // shard_mem, conn buffers of the reactor included
+    size_t mem_limit = 0;
+    size_t evict_samples = evict_samples_default;
+    // the reactor's conns: ChunkBuf::track of each, and how many
+    size_t conn_bytes = 0;
+    size_t num_conns = 0;
+    uint64_t evicted = 0;
+};
+
+// where a shard's memory goes. MEM_SLAB_FREE and after don't count
+// against --maxmemory: spare space, reused before anything new is taken
+enum MemCategory : uint8_t {
+    MEM_SLOTS, // hash table slot arrays (+ control bytes)
+    MEM_ENTRIES, // Entry objects, at their slab class size
+    MEM_VALUES, // out of line values
+    MEM_TTL, // the deadline heap
+    MEM_ZNODES,
+    MEM_CONN_BUFS, // Conn::incoming + outgoing chunks
+    MEM_CONNS, // the Conn structs
+    MEM_SLAB_FREE, // slab pages not handed out yet (free lists, tails)
+    MEM_BUF_POOL, // freed chunks kept for the next ones
+    num_mem,
+};
+
+static const char *mem_names[num_mem] = {
+    "slots", "entries", "values", "ttl_heap", "znodes", "conn_buffers", "conns", "slab_free",
+    "buffer_pool",
+};
+
+// one line of the biggest-buffers list
+struct ConnMem {
+    uint32_t reactor = 0;
+    int fd = -1;
+    size_t in = 0; // allocated
+    size_t out = 0;
+    size_t pinned = 0; // unsent big values referenced by the conn
+    char peer[64] = "?";
+};
+
+// request for a key owned by another shard. the owner runs it, fill
+// the reply, and send the same Forward back to the origin mailbox.
+// also used as a plain reply slot for local requests queued behind it
+struct Forward {
+    MailNode node;
+    Reactor *origin = NULL;
+    Conn *conn = NULL;
+    std::string req; // raw request bytes, the owner parses them again
+    const Command *command = NULL; // already looked up at the origin
+    uint64_t hashval = 0;
+
+    bool done = false; // executed, set by the owner
+    bool ready = false; // back home, set by the origin
+    StatusCode status = RES_OK;
+    std::string data;
+    Value *value = NULL; // big GET reply, pinned instead of copied to `data`
+
+    // CMD_ALL_SHARDS: a part goes to every shard, its reply is merged
+    // into the parent, which is the one in Conn::pending
+    Forward *parent = NULL;
+    size_t parts_left = 0; // parent: parts not back yet
+    // parent: identical requests right behind it in the pipeline, they
+    // get the same reply (see batch_run)
+    std::vector<Forward *> copies;
+};
+
+// index into the command table (see `commands`), same order
+enum CmdId : uint8_t {
+    CMD_GET,
+    CMD_SET,
+    CMD_DEL,
+    CMD_INFO,
+    CMD_KEYS,
+    CMD_ZQUERY,
+    CMD_SCAN,
+    CMD_EXPIRE,
+    CMD_PEXPIRE,
+    CMD_TTL,
+    CMD_PTTL,
+    CMD_PERSIST,
+    num_commands,
+};
+
+// bumped on the owner thread without atomics, then published once per
+// loop iteration so `info` can read them from any reactor
+struct Stats {
+    uint64_t requests = 0;
+    // recv, send, accept, close, eventfd... poller and ring count their own
+    uint64_t syscalls = 0;
+    uint64_t cmd_calls[num_commands] = {}; // counted where the command runs
+    uint64_t expired = 0; // keys removed by the sweep (not on access)
+    uint64_t out_paused = 0; // conns going over the soft output limit
+    uint64_t out_closed = 0; // conns closed over the hard one
+    uint64_t yields = 0; // turns ended by the quantum, requests left
+    uint64_t idle_closes = 0; // conns closed by --timeout
+    uint64_t io_closes = 0; // and by --io-timeout
+    uint64_t snapshots = 0; // CMD_SNAPSHOT commands run by a forked child
+};
 
-    Buffer incoming;
-    Buffer outgoing;
+#ifdef COUNT_ALLOCS
+// heap allocations made by the calling thread, for `info` (bench shows
+// them per request). a measuring build only (make COUNT_ALLOCS=1), glibc
+// only: malloc and friends are replaced here and forward to glibc's own,
+// operator new ends up in malloc too. off, there's no `allocs` in `info`
+static thread_local uint64_t t_allocs = 0;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+
+void *malloc(size_t size) noexcept {
+    t_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) noexcept {
+    t_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    t_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+// aligned operator new comes here
+void *aligned_alloc(size_t align, size_t size) noexcept {
+    t_allocs++;
+    return __libc_memalign(align, size);
+}
+
+void *memalign(size_t align, size_t size) noexcept {
+    t_allocs++;
+    return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **out, size_t align, size_t size) noexcept {
+    if (align < sizeof(void *) || (align & (align - 1)) != 0) return EINVAL;
+    t_allocs++;
+    void *ptr = __libc_memalign(align, size);
+    if (!ptr) return ENOMEM;
+    *out = ptr;
+    return 0;
+}
+}
+#endif
+
+// one event loop thread: its own listener (SO_REUSEPORT), connections
+// and shard. other reactors talk to it only through the mailbox
+struct Reactor {
+    uint32_t id = 0;
+    Poller poller;
+    bool use_uring = false; // completion based loop instead of poller
+    Uring uring;
+    UringBufRing bufs; // multishot recv picks from here
+    int listenerfd = -1; // TCP, -1 with --port 0
+    int unixfd = -1; // --unix, one socket shared by all reactors
+    int wakefd = -1; // eventfd, poked after pushing into the mailbox
+    std::vector<Conn *> fdtoconn; // fd is small nat number, so vector is enough
+    std::vector<int> read_again; // fds to read again without a new edge
+    std::vector<int> ready; // fds with requests left after their quantum
+    std::vector<int> accept_again; // edge-triggered: listeners stopped at accept_budget
+    // CMD_SNAPSHOT, see snapshot_start: the running child (-1 = none),
+    // its pipe (nonblocking, in the poller or under a uring poll), what
+    // it wrote so far and the requests it answers. then the next ones
+    pid_t snap_pid = -1;
+    int snap_fd = -1;
+    std::string snap_out;
+    std::vector<Forward *> snap_fwds;
+    std::deque<Forward *> snap_waiting;
+    // every conn is in one of them, oldest activity first
+    DList idle_conns;
+    DList busy_conns;
+    uint64_t idle_timeout_ms = idle_timeout_default_ms;
+    uint64_t io_timeout_ms = io_timeout_default_ms;
+    // per conn output limits, see conn_out_check
+    size_t out_soft_limit = out_soft_default;
+    size_t out_hard_limit = out_hard_default;
+    Shard shard;
+    Mailbox mailbox;
+    std::vector<uint8_t> to_wake; // reactors we posted to in this iteration
+    // parsed words of the request being run, views into its bytes.
+    // reused for every request, so parsing doesn't allocate
+    std::vector<std::string_view> cmd;
+    // the batch being run by conn_run_batch, same idea
+    std::vector<BatchReq> batch;
+    std::vector<std::string_view> batch_words;
+    // a request split across chunks, copied out whole to be parsed
+    std::vector<uint8_t> linear;
+    // --io-threads N > 1: recv/parse and send fanned out to N threads
+    // (this one included), the shard still only touched here
+    uint32_t io_threads = 1;
+    IoPool io_pool;
+    std::vector<IoSlot> io_slots;
+    IoOp io_op = IO_READ; // of the running fan-out
+    std::vector<int> io_fds; // conns with I/O for the next round
+    std::vector<Conn *> io_conns; // the ones of the running fan-out
+
+    Stats stats;
+    std::atomic<uint64_t> pub_requests{0};
+    std::atomic<uint64_t> pub_syscalls{0};
+#ifdef COUNT_ALLOCS
+    std::atomic<uint64_t> pub_allocs{0};
+#endif
+    std::atomic<uint64_t> pub_expired{0};
+    std::atomic<uint64_t> pub_evicted{0};
+    std::atomic<uint64_t> pub_out_paused{0};
+    std::atomic<uint64_t> pub_out_closed{0};
+    std::atomic<uint64_t> pub_yields{0};
+    std::atomic<uint64_t> pub_idle_closes{0};
+    std::atomic<uint64_t> pub_io_closes{0};
+    std::atomic<uint64_t> pub_snapshots{0};
+    std::atomic<uint64_t> pub_mem[num_mem] = {};
+    // the conns with the biggest buffers, see reactor_report_conns
+    std::mutex report_mu;
+    std::vector<ConnMem> top_conns; // guarded by report_mu
+    uint64_t report_ms = 0; // when it was last built
+    size_t report_bytes = SIZE_MAX; // conn_bytes + num_conns back then
+    std::atomic<uint64_t> pub_cmd_calls[num_commands] = {};
+
+    // io_uring: the earliest OP_TIMER in flight (0 = none), and its time,
+    // read by the kernel when the sqe is submitted
+    uint64_t timer_deadline = 0;
+    struct __kernel_timespec timer_ts = {};
 };
 
+// filled before any thread starts, read-only after that
+static std::vector<Reactor *> g_reactors;
+
+// slow work off the loops, shared by all reactors
+static BgPool g_bg;
+static std::atomic<bool> g_trimming{false}; // a malloc_trim is queued or running
+
 
 struct Response {
     StatusCode status = RES_OK;
     uint8_t *data = NULL;
     size_t data_len = 0;
+    std::string text; // owns the reply when it's built on the fly
+    Value *value = NULL; // set when data is a stored value (can be pinned)
 };
 
 static void sock_set_nonblock(int fd) {
@@ -70,7 +473,9 @@ static void sock_set_nonblock(int fd) {
 
 // 	- Have `int parse_req(req, output)` return 0, -1 if fail
 // 	- so basically just parse each word into a vector 
-static ssize_t parse_req(uint8_t *req, size_t buff_len,std::vector<std::string> &cmd) {
+// note: the words are views into `req`, they are only good while those
+// bytes are (copy what must outlive the request)
+static ssize_t parse_req(uint8_t *req, size_t buff_len, std::vector<std::string_view> &cmd) {
     // check num words
     assert(buff_len >= 4);
     uint32_t num_words;
@@ -92,8 +497,7 @@ static ssize_t parse_req(uint8_t *req, size_t buff_len,std::vector<std::string>
         if (cur_word_len > bytes_left - 4) break;
 
         // push to cmd
-        std::string cur_word = std::string((char *)(cursor + 4), cur_word_len);
-        cmd.push_back(cur_word);
+        cmd.emplace_back((char *)(cursor + 4), cur_word_len);
 
         bytes_read += cur_word_len + 4;
     }
@@ -104,342 +508,2784 @@ static ssize_t parse_req(uint8_t *req, size_t buff_len,std::vector<std::string>
 }
 
 
-static void do_get(std::vector<std::string> &cmd, Response &res) {
-    assert(cmd[0] == "get");
-    // create dummy Entry for look up
-    Entry target_dummy; 
-    target_dummy.key.swap(cmd[1]); // assign use O(N), swap use O(1)
-    target_dummy.node.hashval = str_hash(
-        (uint8_t *)(target_dummy.key.data()), 
-        target_dummy.key.size()
-    );
+// use the key's shard as the owner. low bits pick the HTable slot, so
+// take the high bits here, otherwise every shard only use some slots
+static Reactor *key_owner(uint64_t hashval) {
+    return g_reactors[(hashval >> 32) % g_reactors.size()];
+}
+
+// reply RES_ERR with a short reason
+static void res_error(Response &res, const char *fmt, ...) {
+    char msg[128];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    res.status = RES_ERR;
+    res.text = msg;
+    res.data = (uint8_t *)res.text.data();
+    res.data_len = res.text.size();
+}
+
+// strtod/strtoll want a NUL, the words are views into the request
+static bool str2dbl(std::string_view word, double &out) {
+    std::string str(word);
+    char *end = NULL;
+    out = strtod(str.c_str(), &end);
+    return !str.empty() && end == str.c_str() + str.size() && !isnan(out);
+}
+
+static bool str2int(std::string_view word, int64_t &out) {
+    std::string str(word);
+    char *end = NULL;
+    errno = 0;
+    out = strtoll(str.c_str(), &end, 10);
+    return !str.empty() && end == str.c_str() + str.size() && errno == 0;
+}
+
+static uint64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// keys can't live longer than this (ms), so now + ttl can't wrap
+const int64_t max_ttl_ms = (int64_t)100 * 365 * 24 * 3600 * 1000;
+
+// the key's entry, NULL if it's not there or past its deadline. the
+// expired one is removed right here, the sweep may not have got to it yet
+static Entry *entry_find(Shard *shard, std::string_view key, uint64_t hashval) {
+    // create dummy key for look up, it points into the request
+    LookupKey dummy;
+    dummy.key = key;
+    dummy.node.hashval = hashval;
+    HNode *node = hm_lookup(&shard->cache.map, &dummy.node, &entry_key_eq);
+    if (!node) return NULL;
+    Entry *entry = container_of(node, Entry, node);
+    uint64_t deadline = entry_deadline(&shard->cache, entry);
+    if (deadline != 0 && deadline <= monotonic_ms()) {
+        cache_remove(&shard->cache, entry);
+        return NULL;
+    }
+    entry_touch(&shard->cache, entry);
+    return entry;
+}
+
+static void shard_mem_usage(Shard *shard, size_t mem[num_mem]) {
+    Slab *slab = &shard->cache.slab;
+    mem[MEM_SLOTS] = hm_mem(&shard->cache.map) + hm_mem(&shard->zset.map);
+    mem[MEM_ENTRIES] = slab->used_bytes;
+    mem[MEM_VALUES] = shard->cache.value_bytes;
+    mem[MEM_TTL] = shard->cache.ttl.capacity() * sizeof(HeapItem);
+    mem[MEM_ZNODES] = shard->zset.node_bytes;
+    mem[MEM_CONN_BUFS] = shard->conn_bytes;
+    mem[MEM_CONNS] = shard->num_conns * sizeof(Conn);
+    // used_bytes has the big (malloc'ed) entries too
+    mem[MEM_SLAB_FREE] = slab_mem(slab) - slab->used_bytes;
+    mem[MEM_BUF_POOL] = chunk_pool_bytes(); // the reactor's thread calls this
+}
+
+// what the shard's memory limit counts
+static size_t shard_mem(Shard *shard) {
+    size_t mem[num_mem];
+    shard_mem_usage(shard, mem);
+    size_t total = 0;
+    for (size_t i = 0; i < MEM_SLAB_FREE; i++) {
+        total += mem[i];
+    }
+    return total;
+}
+
+// before a write of about `need` bytes: evict keys until it fits. false
+// if it can't (no eviction, or nothing left to evict), the write fails.
+// a sample per key, never a walk of the keyspace
+static bool shard_make_room(Shard *shard, size_t need) {
+    if (shard->mem_limit == 0) return true;
+    while (shard_mem(shard) + need > shard->mem_limit) {
+        if (shard->cache.evict == EVICT_NONE) return false;
+        if (!cache_evict(&shard->cache, shard->evict_samples)) return false;
+        shard->evicted++;
+    }
+    return true;
+}
 
-    HNode *target_node = hm_lookup(&g_cache.map, &target_dummy.node, &entry_eq);
-    if (!target_node) {
+// note: hashval is str_hash(cmd[1]), already computed for routing
+static void do_get(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    Entry *target_entry = entry_find(shard, cmd[1], hashval);
+    if (!target_entry) {
         res.status = RES_NOTFOUND;
         return;
     }
 
     // assign the value + status code to the response
     res.status = RES_OK;
-    Entry *target_entry = container_of(target_node, Entry, node);
-    std::string target_val = target_entry->value;
-    assert(target_val.size() <= max_msg_len);
-    res.data = (uint8_t *)(target_val.data());
-    res.data_len = target_val.size();
-}
-
-static void do_set(std::vector<std::string> &cmd, Response &res) {
-    // write a dummy for looking up
-    Entry dummy;
-    dummy.key.swap(cmd[1]);
-    dummy.value.swap(cmd[2]);
-    dummy.node.hashval = str_hash(
-        (uint8_t *)dummy.key.data(),
-        dummy.key.size()
-    );
-
-    HNode *target = hm_lookup(&g_cache.map, &dummy.node, &entry_eq);
-    if (!target) {
-        // insert new entry
-        Entry *target_entry = new Entry(dummy);
-        hm_insert(&g_cache.map, &(target_entry->node));
+    // an inline value is copied out before anything can change it, a
+    // big one can be referenced by the reply
+    std::string_view val = entry_val(target_entry);
+    assert(val.size() <= max_msg_len);
+    res.data = (uint8_t *)val.data();
+    res.data_len = val.size();
+    res.value = entry_value(target_entry);
+}
+
+// case-insensitive, like command names
+static bool word_is(std::string_view word, std::string_view name) {
+    return word.size() == name.size() && strncasecmp(word.data(), name.data(), word.size()) == 0;
+}
+
+// "EX seconds" or "PX ms" at cmd[pos], as a deadline
+static bool parse_expiry(std::vector<std::string_view> &cmd, size_t pos, uint64_t &deadline) {
+    if (pos + 2 != cmd.size()) return false;
+    int64_t ttl = 0;
+    if (!str2int(cmd[pos + 1], ttl) || ttl <= 0) return false;
+    if (word_is(cmd[pos], "ex")) {
+        if (ttl > max_ttl_ms / 1000) return false;
+        ttl *= 1000;
+    } else if (!word_is(cmd[pos], "px")) {
+        return false;
+    }
+    if (ttl > max_ttl_ms) return false;
+    deadline = monotonic_ms() + (uint64_t)ttl;
+    return true;
+}
+
+//  receive command = SET key value [EX seconds | PX ms]
+//  a SET without an expiry clears the key's old one
+// the only place request bytes get copied: the value, and the key when
+// it's new
+static void do_set(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    uint64_t deadline = 0;
+    if (cmd.size() > 3 && !parse_expiry(cmd, 3, deadline)) {
+        return res_error(res, "expect EX seconds or PX milliseconds");
+    }
+    // the whole key + value, even for an overwrite: close enough
+    if (!shard_make_room(shard, sizeof(Entry) + cmd[1].size() + cmd[2].size())) {
+        return res_error(res, "OOM: over maxmemory");
+    }
+
+    Entry *target_entry = entry_find(shard, cmd[1], hashval);
+    if (!target_entry) {
+        // insert new entry, key and (small) value in one slab object
+        target_entry = entry_new(&shard->cache, cmd[1], hashval, cmd[2]);
+        hm_insert(&shard->cache.map, &(target_entry->node));
     } else {
-        Entry *target_entry = container_of(target, Entry, node);
-        target_entry->value.swap(dummy.value); // set value
+        // a reply may still be sending the old value, it holds its own ref
+        target_entry = entry_set_value(&shard->cache, target_entry, cmd[2]);
     }
+    entry_set_deadline(&shard->cache, target_entry, deadline);
     res.status = RES_OK;
 }
 
 // plan
-// 1. create dummy to lookup
-// 2. hm_delete()
+// 1. find it (an expired one counts as gone)
+// 2. take it out and free it
 // 3. set RES_OK;
-static void do_del(std::vector<std::string> &cmd, Response &res) {
-    Entry dummy; 
-    dummy.key.swap(cmd[1]);
-    dummy.node.hashval = str_hash(
-        (uint8_t *)dummy.key.data(), 
-        dummy.key.size()
-    );
-
-    HNode *detached_node = hm_delete(&g_cache.map, &dummy.node, &entry_eq);
-    if (detached_node != NULL) {
+static void do_del(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    Entry *entry = entry_find(shard, cmd[1], hashval);
+    if (entry) {
+        cache_remove(&shard->cache, entry);
         res.status = RES_OK;
-        Entry *detached_entry = container_of(detached_node, Entry, node);
-        delete detached_entry; // free up allocated entry
     } else {
         res.status = RES_NOTFOUND;
     }
 }
 
-static bool output_key(HNode *node, void *buff_void) {
-    Buffer *buff = (Buffer *)buff_void;
+static void expire_key(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval,
+                       Response &res, int64_t unit_ms) {
+    int64_t ttl = 0;
+    if (!str2int(cmd[2], ttl) || ttl > max_ttl_ms / unit_ms) {
+        return res_error(res, "expect integer");
+    }
+    Entry *entry = entry_find(shard, cmd[1], hashval);
+    if (!entry) {
+        res.status = RES_NOTFOUND;
+        return;
+    }
+    // already past it
+    if (ttl <= 0) {
+        cache_remove(&shard->cache, entry);
+    } else {
+        entry_set_deadline(&shard->cache, entry, monotonic_ms() + (uint64_t)(ttl * unit_ms));
+    }
+    res.status = RES_OK;
+}
+
+//  receive command = EXPIRE key seconds (PEXPIRE: ms)
+//  a ttl <= 0 deletes the key
+static void do_expire(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    expire_key(shard, cmd, hashval, res, 1000);
+}
+
+static void do_pexpire(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    expire_key(shard, cmd, hashval, res, 1);
+}
+
+// remaining ms, -1 without a deadline
+static void ttl_key(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval,
+                    Response &res, int64_t unit_ms) {
+    Entry *entry = entry_find(shard, cmd[1], hashval);
+    if (!entry) {
+        res.status = RES_NOTFOUND;
+        return;
+    }
+    int64_t ttl = -1;
+    uint64_t deadline = entry_deadline(&shard->cache, entry);
+    if (deadline != 0) {
+        uint64_t now = monotonic_ms();
+        // rounded, like a ttl that was just set comes back the same
+        ttl = (int64_t)(deadline > now ? deadline - now : 0);
+        ttl = (ttl + unit_ms / 2) / unit_ms;
+    }
+    res.status = RES_OK;
+    res.text = std::to_string(ttl);
+    res.data = (uint8_t *)res.text.data();
+    res.data_len = res.text.size();
+}
+
+//  receive command = TTL key (PTTL: ms)
+//  reply the time left, -1 if the key has no deadline
+static void do_ttl(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    ttl_key(shard, cmd, hashval, res, 1000);
+}
+
+static void do_pttl(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    ttl_key(shard, cmd, hashval, res, 1);
+}
+
+//  receive command = PERSIST key
+//  drop the deadline, the key lives until deleted
+static void do_persist(Shard *shard, std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    Entry *entry = entry_find(shard, cmd[1], hashval);
+    if (!entry) {
+        res.status = RES_NOTFOUND;
+        return;
+    }
+    entry_set_deadline(&shard->cache, entry, 0);
+    res.status = RES_OK;
+}
+
+struct KeysCtx {
+    std::string *text;
+    Cache *cache;
+    uint64_t now; // keys past their deadline are left out, like GET does
+};
+
+static bool output_key(HNode *node, void *arg) {
+    KeysCtx *ctx = (KeysCtx *)arg;
     Entry *entry = container_of(node, Entry, node);
-    std::string key = entry->key;
-    buff->out_str(key.data(), key.size());
+    uint64_t deadline = entry_deadline(ctx->cache, entry);
+    if (deadline != 0 && deadline <= ctx->now) return true;
+    *ctx->text += entry_key(entry);
+    *ctx->text += '\n';
     return true;
 }
 
 // plan
-// 1. write an array size of how many keys
-// 2. for each node in map, we will output the key
-static void do_keys(Buffer &out) {
-    uint32_t hm_size32 = (uint32_t)hm_size(&g_cache.map);
-    out.out_array(hm_size32);
-    hm_foreach(&g_cache.map, &output_key, (void *)&out);
+// 1. for each node in map, we will output the key, one per line
+// note: this shard's keys. every shard runs it (CMD_ALL_SHARDS), the
+// conn's reactor puts the parts together
+// note: the whole keyspace in one go. it runs on a snapshot in a child
+// process (CMD_SNAPSHOT), the loop doesn't wait for it. SCAN walks it a
+// bit at a time instead
+static void do_keys(Shard *shard, std::vector<std::string_view> &, uint64_t, Response &res) {
+    KeysCtx ctx = {&res.text, &shard->cache, monotonic_ms()};
+    hm_foreach(&shard->cache.map, &output_key, (void *)&ctx);
+    res.status = RES_OK;
+    res.data = (uint8_t *)res.text.data();
+    res.data_len = res.text.size();
+}
+
+// the top bits of a SCAN cursor are the shard, the rest is hm_scan's
+const int cursor_shard_shift = 56;
+const uint64_t cursor_pos_mask = ((uint64_t)1 << cursor_shard_shift) - 1;
+const int64_t scan_default_count = 10;
+
+static bool str2u64(std::string_view word, uint64_t &out) {
+    std::string str(word);
+    char *end = NULL;
+    errno = 0;
+    out = strtoull(str.c_str(), &end, 10);
+    return !str.empty() && str[0] != '-' && end == str.c_str() + str.size() && errno == 0;
+}
+
+// the shard a SCAN cursor points at, NULL if it's not a cursor we made
+static Reactor *cursor_owner(std::string_view word) {
+    uint64_t cursor = 0;
+    if (!str2u64(word, cursor) || (cursor >> cursor_shard_shift) >= g_reactors.size()) {
+        return NULL;
+    }
+    return g_reactors[cursor >> cursor_shard_shift];
+}
+
+struct ScanCtx {
+    std::string_view match; // empty = everything
+    bool has_match = false;
+    size_t seen = 0;
+    std::string *text;
+    Cache *cache;
+    uint64_t now; // keys past their deadline are left out
+};
+
+static void scan_key(HNode *node, void *arg) {
+    ScanCtx *ctx = (ScanCtx *)arg;
+    Entry *entry = container_of(node, Entry, node);
+    std::string_view key = entry_key(entry);
+    ctx->seen++;
+    uint64_t deadline = entry_deadline(ctx->cache, entry);
+    if (deadline != 0 && deadline <= ctx->now) return;
+    if (ctx->has_match && !glob_match(ctx->match, key)) return;
+    *ctx->text += key;
+    *ctx->text += '\n';
+}
+
+//  receive command = SCAN cursor [COUNT n] [MATCH pattern]
+//  1. Walk hm_scan steps from the cursor until about COUNT keys were
+//     looked at (MATCH filters after that, so a reply can be short or
+//     empty while the walk isn't done). empty buckets count too, so a
+//     sparse map can't make one call walk all of it.
+//  2. Reply the next cursor on the first line, then the keys, one per
+//     line. cursor 0 = done. a key that's there for the whole walk comes
+//     back at least once, maybe twice.
+//  the shard in the cursor runs it (CMD_CURSOR), the walk goes shard by
+//  shard
+static void do_scan(Shard *shard, std::vector<std::string_view> &cmd, uint64_t, Response &res) {
+    uint64_t cursor = 0;
+    if (!str2u64(cmd[1], cursor) || (cursor >> cursor_shard_shift) != shard->id) {
+        return res_error(res, "invalid cursor");
+    }
+    int64_t count = scan_default_count;
+    ScanCtx ctx;
+    for (size_t i = 2; i < cmd.size(); i += 2) {
+        if (i + 1 >= cmd.size()) {
+            return res_error(res, "syntax error");
+        } else if (word_is(cmd[i], "count")) {
+            if (!str2int(cmd[i + 1], count) || count <= 0) return res_error(res, "expect positive count");
+        } else if (word_is(cmd[i], "match")) {
+            ctx.match = cmd[i + 1];
+            ctx.has_match = true;
+        } else {
+            return res_error(res, "syntax error");
+        }
+    }
+
+    std::string keys;
+    ctx.text = &keys;
+    ctx.cache = &shard->cache;
+    ctx.now = monotonic_ms();
+    uint64_t pos = cursor & cursor_pos_mask;
+    size_t steps = (size_t)count * 10;
+    do {
+        pos = hm_scan(&shard->cache.map, pos, &scan_key, &ctx);
+    } while (pos != 0 && ctx.seen < (size_t)count && --steps > 0);
+
+    // this shard is done: the next one from its start
+    uint64_t next = ((uint64_t)shard->id << cursor_shard_shift) | pos;
+    if (pos == 0) {
+        next = shard->id + 1 < g_reactors.size() ? (uint64_t)(shard->id + 1) << cursor_shard_shift : 0;
+    }
+    res.text = std::to_string(next) + "\n" + keys;
+    res.status = RES_OK;
+    res.data = (uint8_t *)res.text.data();
+    res.data_len = res.text.size();
 }
 
 //  receive command = ZQUERY key score name offset limit
 //  1. Seek to the first pair where pair >= (score, name).
 //  2. Walk to the n-th successor/predecessor (offset).
-//  3. Iterate and output.
-static void do_zquery(std::vector<std::string> &cmd, Buffer &out) {
-    assert(cmd.size() == 6); 
-    assert(cmd[0] == "ZQUERY");
-
+//  3. Iterate and output "name score" per line.
+static void do_zquery(Shard *shard, std::vector<std::string_view> &cmd, uint64_t, Response &res) {
     // parse the score
-    double score = std::stod(cmd[2]);
-    char *name = cmd[3].data();
+    double score = 0;
+    int64_t offset = 0;
+    int64_t limit = 0;
+    if (!str2dbl(cmd[2], score) || !str2int(cmd[4], offset) || !str2int(cmd[5], limit)) {
+        return res_error(res, "expect number");
+    }
+    const char *name = cmd[3].data();
     size_t name_len = cmd[3].size();
-    int64_t offset = std::stoll(cmd[4]);
-    int64_t limit = std::stoll(cmd[5]);
 
     // seek the first pair where pair >= (score, name)
-    ZNode *znode = zset_seekge(&zset, score, name, name_len);
+    ZNode *znode = zset_seekge(&shard->zset, score, name, name_len);
 
     // walk to offset
-    znode = znode_offset(znode, offset);
+    if (znode) {
+        znode = znode_offset(znode, offset);
+    }
 
     // output start from znode -> walk forward until limit
-    size_t arr_head_idx = out.arr_begin();
-    int64_t num_nodes = 0;
-    for (; znode && num_nodes < limit; num_nodes++) {
-        out.out_str(znode->name, znode->len);
-        out.out_dbl(znode->score);
+    char line[64];
+    for (int64_t num_nodes = 0; znode && num_nodes < limit; num_nodes++) {
+        res.text.append(znode->name, znode->len);
+        snprintf(line, sizeof(line), " %g\n", znode->score);
+        res.text += line;
         znode = znode_offset(znode, 1);
     }
+    res.status = RES_OK;
+    res.data = (uint8_t *)res.text.data();
+    res.data_len = res.text.size();
+}
 
-    // #elements = #num
-    out.arr_end(arr_head_idx, num_nodes * 2);
+static void do_info(Shard *, std::vector<std::string_view> &, uint64_t, Response &res);
 
-}
+////// command table
+// name, arity, flags and handler of every command, all known at compile
+// time. the lookup is a perfect hash over the lowercased name, with the
+// seed searched by the compiler, so finding a command is one hash + one
+// compare no matter how many there are.
 
-static void do_cmd(std::vector<std::string> cmd, Response &res) {
-    if (cmd.size() == 2 && cmd[0] == "get") {
-        do_get(cmd, res);
-    } else if (cmd.size() == 3 && cmd[0] == "set") {
-        do_set(cmd, res);
-    } else if (cmd.size() == 2 && cmd[0]== "del") {
-        do_del(cmd, res);
-    } else {
-        res.status = RES_ERR; // invalid command
-        return;
-    }
-}
+typedef void (*CmdHandler)(Shard *shard, std::vector<std::string_view> &cmd,
+                           uint64_t hashval, Response &res);
 
-// - write response length first
-// - then write statuscode
-// - then write message
-static void make_res(Buffer &output, Response res) {
-    uint32_t msg_len = 4 + res.data_len;
-    output.append((uint8_t *)&msg_len, 4);
-    output.append((uint8_t *)&res.status, 4);
-    output.append(res.data, res.data_len);
+enum CmdFlags : uint8_t {
+    CMD_READ = 1 << 0,
+    CMD_WRITE = 1 << 1,
+    CMD_KEYED = 1 << 2, // cmd[1] is a key, the key's shard runs it
+    CMD_CURSOR = 1 << 3, // cmd[1] is a SCAN cursor, the shard in it runs it
+    CMD_SNAPSHOT = 1 << 4, // walks the whole shard, run on a snapshot (snapshot_queue)
+    CMD_ALL_SHARDS = 1 << 5, // every shard runs it, the replies are concatenated
+};
+
+struct Command {
+    std::string_view name; // lowercase
+    int arity; // words incl. the name. -n means at least n
+    uint8_t flags;
+    CmdHandler fn;
+};
+
+static constexpr Command commands[] = {
+    {"get", 2, CMD_READ | CMD_KEYED, do_get},
+    {"set", -3, CMD_WRITE | CMD_KEYED, do_set},
+    {"del", 2, CMD_WRITE | CMD_KEYED, do_del},
+    {"info", -1, CMD_READ, do_info},
+    {"keys", 1, CMD_READ | CMD_SNAPSHOT | CMD_ALL_SHARDS, do_keys},
+    {"zquery", 6, CMD_READ | CMD_KEYED, do_zquery},
+    {"scan", -2, CMD_READ | CMD_CURSOR, do_scan},
+    {"expire", 3, CMD_WRITE | CMD_KEYED, do_expire},
+    {"pexpire", 3, CMD_WRITE | CMD_KEYED, do_pexpire},
+    {"ttl", 2, CMD_READ | CMD_KEYED, do_ttl},
+    {"pttl", 2, CMD_READ | CMD_KEYED, do_pttl},
+    {"persist", 2, CMD_WRITE | CMD_KEYED, do_persist},
+};
+static_assert(sizeof(commands) / sizeof(commands[0]) == num_commands,
+              "commands[] and CmdId are out of sync");
+
+const size_t cmd_slots = 32; // 2^n, keep it > 2x num_commands
+const size_t cmd_max_len = 16; // longer than any name, rejected unhashed
+
+constexpr uint8_t ascii_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (uint8_t)(c - 'A' + 'a') : (uint8_t)c;
 }
 
-// 1. Parse the command to some struct <- we use `vector<string>`
-// 2. Create response based on that struct
-// 3. Append the response back to output buffer
-static bool try_one_request(Conn *conn) {
-    if (conn->incoming.size() < 4) {
-        return false;
-    } 
-    uint8_t *req = conn->incoming.data();
-    std::vector<std::string> cmd;
-    size_t read_buff_size = conn->incoming.size();
-    ssize_t req_len;
-    if ((req_len = parse_req(req, read_buff_size, cmd)) <= 0) {
-        return false;
+// FNV-1a over the lowercased name, folded so the low bits see it all
+constexpr uint32_t cmd_hash(std::string_view name, uint32_t seed) {
+    uint32_t h = seed;
+    for (char c : name) {
+        h = (h ^ ascii_lower(c)) * 16777619u;
     }
-    Response res;
-    do_cmd(cmd, res);
-    make_res(conn->outgoing, res);
-    conn->incoming.consume(req_len);
-    return true;
+    return h ^ (h >> 16);
 }
 
-// just send what you can
-// remove from the outgoing
-// catch some error
-static void handle_write(Conn *conn) {
-    ssize_t bytes_sent = 
-        send(conn->fd, conn->outgoing.data(), conn->outgoing.size(), 0);
-    // in case client not ready (we use non-block send)
-    if (bytes_sent <= 0 && errno == EAGAIN) {
-        return;
-    }
-    // actual err
-    if (bytes_sent <= 0) {
-        conn->want_close = true;
-        return; 
+// first seed where no two names share a slot
+constexpr uint32_t cmd_find_seed() {
+    for (uint32_t seed = 1; seed < 100000; seed++) {
+        bool used[cmd_slots] = {};
+        bool ok = true;
+        for (const Command &c : commands) {
+            size_t slot = cmd_hash(c.name, seed) & (cmd_slots - 1);
+            if (used[slot]) {
+                ok = false;
+                break;
+            }
+            used[slot] = true;
+        }
+        if (ok) return seed;
     }
-    conn->outgoing.consume((size_t)bytes_sent);
+    return 0;
+}
 
-    // switch back the state
-    if (conn->outgoing.size() == 0) {
-        conn->want_read = true;
-        conn->want_write = false;
+constexpr uint32_t cmd_seed = cmd_find_seed();
+static_assert(cmd_seed != 0, "no perfect hash seed for the command table, grow cmd_slots");
+
+// slot -> index into commands, -1 if empty
+struct CmdSlots {
+    int8_t idx[cmd_slots];
+};
+
+constexpr CmdSlots cmd_build_slots() {
+    CmdSlots slots = {};
+    for (size_t i = 0; i < cmd_slots; i++) {
+        slots.idx[i] = -1;
+    }
+    for (size_t i = 0; i < num_commands; i++) {
+        slots.idx[cmd_hash(commands[i].name, cmd_seed) & (cmd_slots - 1)] = (int8_t)i;
     }
+    return slots;
 }
 
-// 1. Do non-blocking read
-// 2. Add new data to Conn::incoming buffer
-//  we need a buf_append(vec, src, len)
-// 3. Use `try_one_request(conn)`
-static void handle_read(Conn *conn) {
-    uint8_t buff[64 * 1024];
-    ssize_t bytes_read = recv(conn->fd, buff, sizeof(buff), 0);
-    if (bytes_read <= 0) {
-        conn->want_close = true;
-        return;
+static constexpr CmdSlots cmd_slot_table = cmd_build_slots();
+
+// NULL if there is no such command (any case)
+static const Command *cmd_lookup(std::string_view name) {
+    if (name.size() > cmd_max_len) return NULL;
+    int8_t idx = cmd_slot_table.idx[cmd_hash(name, cmd_seed) & (cmd_slots - 1)];
+    if (idx < 0) return NULL;
+    const Command *command = &commands[idx];
+    if (command->name.size() != name.size()) return NULL;
+    for (size_t i = 0; i < name.size(); i++) {
+        if (ascii_lower(name[i]) != (uint8_t)command->name[i]) return NULL;
     }
-    
-    conn->incoming.append(buff, (size_t)bytes_read);
+    return command;
+}
 
-    while(try_one_request(conn));
-    // switch back the state
-    if (conn->outgoing.size() > 0) {
-        conn->want_read = false;
-        conn->want_write = true;
+static bool cmd_arity_ok(const Command *command, size_t num_words) {
+    size_t arity = (size_t)abs(command->arity);
+    return command->arity > 0 ? num_words == arity : num_words >= arity;
+}
 
-        // client should be ready to recv after sending requests
-        // in chunk, therefore, we don't wait for next iteration
-        // and just write right away.
-        return handle_write(conn);
-    }
+// NULL if the request is empty, unknown or has the wrong arity
+static const Command *cmd_check(std::vector<std::string_view> &cmd) {
+    if (cmd.empty()) return NULL;
+    const Command *command = cmd_lookup(cmd[0]);
+    if (!command || !cmd_arity_ok(command, cmd.size())) return NULL;
+    return command;
 }
 
-// 1. accept
-// 2. print out the ip addr of new conn
-// 3. translate it to conn*
-//  - we want to read from it
-static Conn *handle_accept(int listenerfd) {
-    struct sockaddr_in newsock;
-    socklen_t newsock_len = sizeof(newsock);
-    int connfd = accept(listenerfd, (struct sockaddr *)&newsock, &newsock_len); 
-    if (connfd == -1) {
-        perror("accept");
+// find the command and check its arity, or fill an error reply
+static const Command *cmd_resolve(std::vector<std::string_view> &cmd, Response &res) {
+    if (cmd.empty()) {
+        res_error(res, "empty command");
         return NULL;
     }
-
-    char connip[INET_ADDRSTRLEN];
-    if (inet_ntop(AF_INET, &(newsock.sin_addr.s_addr), connip, INET_ADDRSTRLEN) == NULL) {
-        perror("inet_ntop");
+    const Command *command = cmd_lookup(cmd[0]);
+    if (!command) {
+        res_error(res, "unknown command '%.*s'", (int)min(cmd[0].size(), cmd_max_len), cmd[0].data());
+        return NULL;
+    }
+    if (!cmd_arity_ok(command, cmd.size())) {
+        res_error(res, "wrong number of arguments for '%s'", command->name.data());
         return NULL;
     }
-    printf("new connection from %s\n", connip);
+    return command;
+}
 
-    sock_set_nonblock(connfd); // set to nonblocking mode
+// every reactor's memory by category, as of its last loop round. the
+// return is what --maxmemory counts
+static size_t mem_totals(size_t mem[num_mem]) {
+    for (size_t i = 0; i < num_mem; i++) {
+        mem[i] = 0;
+        for (Reactor *reactor : g_reactors) {
+            mem[i] += reactor->pub_mem[i].load(std::memory_order_relaxed);
+        }
+    }
+    size_t limited = 0;
+    for (size_t i = 0; i < MEM_SLAB_FREE; i++) {
+        limited += mem[i];
+    }
+    return limited;
+}
 
-    Conn *new_conn = new Conn{};
-    new_conn->fd = connfd;
-    new_conn->want_read = true;
-    return new_conn;
+static void info_add(Response &res, const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    res.text += line;
 }
 
-int main() {
-    // fd is always small nat number. So just use array/vector is enough
-    std::vector<Conn *> fdtoconn; 
-    std::vector<struct pollfd> pfds;
+static int64_t self_rss() {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp) return -1;
+    long pages = 0, resident = 0;
+    int got = fscanf(fp, "%ld %ld", &pages, &resident);
+    fclose(fp);
+    if (got != 2) return -1;
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
 
-    ////// prepare listener
-    int listenerfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listenerfd == -1) {
-        perror("socket");
-        exit(1);
+static bool conn_mem_more(const ConnMem &a, const ConnMem &b) {
+    return a.in + a.out + a.pinned > b.in + b.out + b.pinned;
+}
+
+// INFO MEMORY: where the memory goes, how much of the RSS that explains
+// (the rest is malloc's own overhead and free space, thread stacks, the
+// binary...), and the conns holding the most buffer space
+static void info_memory(Response &res) {
+    size_t mem[num_mem];
+    size_t used = mem_totals(mem);
+    size_t accounted = 0;
+    for (size_t i = 0; i < num_mem; i++) {
+        accounted += mem[i];
     }
-    
-    int yes = 1;
-    setsockopt(listenerfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
-    struct sockaddr_in serveraddr;
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_port = htons(1234);
-    serveraddr.sin_addr.s_addr = htonl(0);
-    if (bind(listenerfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) == -1) {
-        perror("bind");
-        exit(1);
+    int64_t rss = self_rss();
+    // walks malloc's arenas, fine for a command nobody runs in a loop
+    struct mallinfo2 mi = mallinfo2();
+
+    info_add(res, "used_memory:%zu\n", used);
+    info_add(res, "maxmemory:%zu\n", g_reactors[0]->shard.mem_limit * g_reactors.size());
+    info_add(res, "accounted:%zu\n", accounted);
+    info_add(res, "rss:%ld\n", (long)rss);
+    info_add(res, "fragmentation_ratio:%.2f\n", accounted ? (double)rss / accounted : 0.0);
+    // in use by the program vs taken from the OS by malloc
+    info_add(res, "malloc_in_use:%zu\n", mi.uordblks + mi.hblkhd);
+    info_add(res, "malloc_held:%zu\n", mi.arena + mi.hblkhd);
+    for (size_t i = 0; i < num_mem; i++) {
+        info_add(res, "mem_%s:%zu\n", mem_names[i], mem[i]);
     }
 
-    sock_set_nonblock(listenerfd);
+    std::vector<ConnMem> top;
+    for (Reactor *reactor : g_reactors) {
+        std::lock_guard<std::mutex> lock(reactor->report_mu);
+        top.insert(top.end(), reactor->top_conns.begin(), reactor->top_conns.end());
+    }
+    std::sort(top.begin(), top.end(), conn_mem_more);
+    for (size_t i = 0; i < top.size() && i < mem_top_conns; i++) {
+        ConnMem &cm = top[i];
+        info_add(res, "top_conn_%zu:reactor=%u fd=%d peer=%s in=%zu out=%zu pinned=%zu\n",
+                 i, cm.reactor, cm.fd, cm.peer, cm.in, cm.out, cm.pinned);
+    }
+}
 
-    if (listen(listenerfd, server_back_log) == -1) {
-        perror("listen");
-        exit(1);
+// server wide counters, summed over every reactor. "key:value" per line
+//  receive command = INFO [MEMORY]
+static void do_info(Shard *, std::vector<std::string_view> &cmd, uint64_t, Response &res) {
+    if (cmd.size() > 2 || (cmd.size() == 2 && !word_is(cmd[1], "memory"))) {
+        return res_error(res, "unknown INFO section");
+    }
+    if (cmd.size() == 2) {
+        info_memory(res);
+        res.status = RES_OK;
+        res.data = (uint8_t *)res.text.data();
+        res.data_len = res.text.size();
+        return;
     }
 
-    while (true) {
-        ////// prepare pfds
-        pfds.clear();
-        struct pollfd listener = {listenerfd, POLLIN, 0};
-        pfds.push_back(listener);
-        for (Conn *conn : fdtoconn) {
-            if (conn == NULL) continue;
-            struct pollfd new_pollfd = { conn->fd, POLLERR, 0 };
-            if (conn->want_read) {
-                new_pollfd.events |= POLLIN;
-            }
-            if (conn->want_write) {
-                new_pollfd.events |= POLLOUT;
-            }
-            if (conn->want_close) {
-                new_pollfd.events |= POLLHUP;
-            }
-            pfds.push_back(new_pollfd);
+    uint64_t requests = 0;
+    uint64_t syscalls = 0;
+    uint64_t expired = 0;
+    uint64_t evicted = 0;
+    uint64_t out_paused = 0;
+    uint64_t out_closed = 0;
+    uint64_t yields = 0;
+    uint64_t idle_closes = 0;
+    uint64_t io_closes = 0;
+    uint64_t snapshots = 0;
+    size_t mem[num_mem];
+    size_t used_memory = mem_totals(mem);
+    uint64_t cmd_calls[num_commands] = {};
+    for (Reactor *reactor : g_reactors) {
+        requests += reactor->pub_requests.load(std::memory_order_relaxed);
+        expired += reactor->pub_expired.load(std::memory_order_relaxed);
+        evicted += reactor->pub_evicted.load(std::memory_order_relaxed);
+        out_paused += reactor->pub_out_paused.load(std::memory_order_relaxed);
+        out_closed += reactor->pub_out_closed.load(std::memory_order_relaxed);
+        yields += reactor->pub_yields.load(std::memory_order_relaxed);
+        idle_closes += reactor->pub_idle_closes.load(std::memory_order_relaxed);
+        io_closes += reactor->pub_io_closes.load(std::memory_order_relaxed);
+        snapshots += reactor->pub_snapshots.load(std::memory_order_relaxed);
+        syscalls += reactor->pub_syscalls.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < num_commands; i++) {
+            cmd_calls[i] += reactor->pub_cmd_calls[i].load(std::memory_order_relaxed);
         }
+    }
+    char line[128];
+    snprintf(line, sizeof(line), "reactors:%zu\n", g_reactors.size());
+    res.text += line;
+    snprintf(line, sizeof(line), "io_threads:%u\n", g_reactors[0]->io_threads);
+    res.text += line;
+    snprintf(line, sizeof(line), "requests:%lu\n", (unsigned long)requests);
+    res.text += line;
+    snprintf(line, sizeof(line), "syscalls:%lu\n", (unsigned long)syscalls);
+    res.text += line;
+#ifdef COUNT_ALLOCS
+    uint64_t allocs = 0;
+    for (Reactor *reactor : g_reactors) {
+        allocs += reactor->pub_allocs.load(std::memory_order_relaxed);
+    }
+    snprintf(line, sizeof(line), "allocs:%lu\n", (unsigned long)allocs);
+    res.text += line;
+#endif
+    snprintf(line, sizeof(line), "expired:%lu\n", (unsigned long)expired);
+    res.text += line;
+    snprintf(line, sizeof(line), "evicted:%lu\n", (unsigned long)evicted);
+    res.text += line;
+    snprintf(line, sizeof(line), "output_soft_limit_hits:%lu\n", (unsigned long)out_paused);
+    res.text += line;
+    snprintf(line, sizeof(line), "output_hard_limit_closes:%lu\n", (unsigned long)out_closed);
+    res.text += line;
+    snprintf(line, sizeof(line), "quantum_yields:%lu\n", (unsigned long)yields);
+    res.text += line;
+    snprintf(line, sizeof(line), "timeout_idle_closes:%lu\n", (unsigned long)idle_closes);
+    res.text += line;
+    snprintf(line, sizeof(line), "timeout_io_closes:%lu\n", (unsigned long)io_closes);
+    res.text += line;
+    snprintf(line, sizeof(line), "snapshot_reads:%lu\n", (unsigned long)snapshots);
+    res.text += line;
+    snprintf(line, sizeof(line), "lazy_freed:%lu\n", (unsigned long)value_lazy_freed());
+    res.text += line;
+    snprintf(line, sizeof(line), "used_memory:%lu\n", (unsigned long)used_memory);
+    res.text += line;
+    snprintf(line, sizeof(line), "maxmemory:%lu\n",
+             (unsigned long)(g_reactors[0]->shard.mem_limit * g_reactors.size()));
+    res.text += line;
+    for (size_t i = 0; i < num_commands; i++) {
+        snprintf(line, sizeof(line), "cmd_%s:%lu\n", commands[i].name.data(), (unsigned long)cmd_calls[i]);
+        res.text += line;
+    }
 
-        ////// wait for readiness
-        int num_events = poll(pfds.data(), (nfds_t)pfds.size(), -1);
-        // don't care if process got interupting signal by OS.
-        if (num_events < 0 && errno == EINTR) {
-            continue;
-        }
-        if (num_events < 0) {
-            perror("poll");
-            exit(1);
-        }
+    res.status = RES_OK;
+    res.data = (uint8_t *)res.text.data();
+    res.data_len = res.text.size();
+}
 
-        ////// handle listener socket
-        if (pfds[0].revents & POLLIN) {
-            Conn *new_conn = handle_accept(listenerfd);
-            if (new_conn != NULL) {
-                // resize if too small
-                if (fdtoconn.size() <= (size_t)new_conn->fd) {
-                    fdtoconn.resize(new_conn->fd + 1);
-                }
-                fdtoconn[new_conn->fd] = new_conn;
-            }
-        }
+// run an already resolved command on this reactor's shard
+static void do_cmd(Reactor *reactor, const Command *command,
+                   std::vector<std::string_view> &cmd, uint64_t hashval, Response &res) {
+    reactor->stats.cmd_calls[command - commands]++;
+    command->fn(&reactor->shard, cmd, hashval, res);
+}
+
+static size_t conn_out_size(Conn *conn) {
+    return conn->outgoing.size() + conn->out_ref_bytes;
+}
+
+// splice a value into the output at the current end, no copy
+static void conn_out_value(Conn *conn, Value *value) {
+    value_ref(value);
+    OutRef ref;
+    ref.pos = conn->out_pos + conn->outgoing.size();
+    ref.value = value;
+    conn->out_refs.push_back(ref);
+    conn->out_ref_bytes += value->len;
+}
+
+// - write response length first
+// - then write statuscode
+// - then write message (big stored values are referenced, not copied)
+static void make_res(Conn *conn, Response &res) {
+    ChunkBuf &output = conn->outgoing;
+    uint32_t msg_len = 4 + res.data_len;
+    output.append((uint8_t *)&msg_len, 4);
+    output.append((uint8_t *)&res.status, 4);
+    if (res.value && res.data_len >= zero_copy_min) {
+        conn_out_value(conn, res.value);
+        return;
+    }
+    output.append(res.data, res.data_len);
+}
+
+// the output as iovecs, in order: outgoing chunks, value, outgoing
+// chunks... stops early at max_iov, that's fine, we only send a prefix
+static size_t conn_out_iov(Conn *conn, struct iovec *iov, size_t max_iov) {
+    ChunkBuf &out = conn->outgoing;
+    size_t buf_off = 0;
+    size_t n = 0;
+    for (OutRef &ref : conn->out_refs) {
+        size_t ref_off = (size_t)(ref.pos - conn->out_pos);
+        if (ref_off > buf_off) {
+            n += out.iov(buf_off, ref_off - buf_off, iov + n, max_iov - n);
+            buf_off = ref_off;
+        }
+        if (n == max_iov) return n;
+        iov[n++] = iovec{ref.value->data + ref.sent, ref.value->len - ref.sent};
+    }
+    if (buf_off < out.size()) {
+        n += out.iov(buf_off, out.size() - buf_off, iov + n, max_iov - n);
+    }
+    return n;
+}
+
+// drop `len` sent bytes from the front of the output, unpin sent values
+static void conn_out_consume(Conn *conn, size_t len) {
+    while (len > 0) {
+        size_t head = conn->outgoing.size();
+        if (!conn->out_refs.empty()) {
+            head = (size_t)(conn->out_refs.front().pos - conn->out_pos);
+        }
+        if (head > 0) {
+            size_t n = min(head, len);
+            conn->outgoing.consume(n);
+            conn->out_pos += n;
+            len -= n;
+            continue;
+        }
+        OutRef &ref = conn->out_refs.front();
+        size_t n = min(ref.value->len - ref.sent, len);
+        ref.sent += n;
+        conn->out_ref_bytes -= n;
+        len -= n;
+        if (ref.sent == ref.value->len) {
+            value_unref(ref.value);
+            conn->out_refs.pop_front();
+        }
+    }
+}
+
+static void conn_out_clear(Conn *conn) {
+    for (OutRef &ref : conn->out_refs) {
+        value_unref(ref.value);
+    }
+    conn->out_refs.clear();
+    conn->out_ref_bytes = 0;
+}
+
+// queue the forward in the target mailbox, the eventfd is poked once per
+// target at the end of this loop iteration (see reactor_flush_wakes)
+static void reactor_post(Reactor *from, Reactor *to, Forward *fwd) {
+    mailbox_push(&to->mailbox, &fwd->node);
+    from->to_wake[to->id] = 1;
+}
+
+// keep the reply, the value can change (or be on another thread) later.
+// big values are pinned instead, the refcount is atomic for this
+static void forward_fill(Forward *fwd, Response &res) {
+    fwd->status = res.status;
+    if (res.value && res.data_len >= zero_copy_min) {
+        value_ref(res.value);
+        fwd->value = res.value;
+    } else {
+        fwd->data.assign((char *)res.data, res.data_len);
+    }
+    fwd->done = true;
+}
+
+static void forward_free(Forward *fwd) {
+    if (fwd->value) value_unref(fwd->value);
+    delete fwd;
+}
+
+// move the ready prefix of conn->pending to the outgoing buffer
+static void conn_flush_pending(Conn *conn) {
+    if (conn->sending && !conn->closed) return; // after the send completes
+    while (!conn->pending.empty() && conn->pending.front()->ready) {
+        Forward *fwd = conn->pending.front();
+        conn->pending.pop_front();
+        if (!conn->closed) {
+            Response res;
+            res.status = fwd->status;
+            res.data = (uint8_t *)fwd->data.data();
+            res.data_len = fwd->data.size();
+            if (fwd->value) {
+                res.data = (uint8_t *)fwd->value->data;
+                res.data_len = fwd->value->len;
+                res.value = fwd->value;
+            }
+            make_res(conn, res);
+        }
+        forward_free(fwd);
+    }
+}
+
+////// snapshot reads
+// a CMD_SNAPSHOT command walks the whole shard, inline it would hold up
+// every client of the loop until it's done (KEYS over 1M keys: ~300 ms).
+// so instead:
+// 1. fork: the child has a copy-on-write snapshot of the process as of
+//    now, runs the handler on our shard and writes the reply to a pipe
+// 2. the loop watches the pipe like a socket and takes what's there,
+//    the child waits while it's full. at EOF the reply goes out through
+//    our own mailbox, like one from another shard, and a g_bg thread
+//    reaps the child (it's exiting already, that's quick)
+// 3. Conn::pending keeps the replies in order meanwhile, like for a
+//    forwarded request
+// one child per shard at a time: the fork copies the page tables, and
+// every child pins a copy-on-write image of the heap. requests that
+// come in meanwhile wait in snap_waiting, and the identical ones (a
+// burst of KEYS) are all answered by the next child.
+// no fork (out of memory, too many processes): run it inline
+
+// what the child writes first: status, then the length of the data
+const size_t snap_header = 4 + 8;
+
+// in the child only this thread exists: no locks the others may hold
+// (malloc's are reset by glibc), no stdio, _exit. the client sockets
+// are closed right away, the parent may want them gone before we are
+static void snapshot_child(Reactor *reactor, const Command *command,
+                           std::vector<std::string_view> &cmd, int fd) {
+    close_range(3, fd - 1, 0);
+    close_range(fd + 1, ~0U, 0);
+    Response res;
+    command->fn(&reactor->shard, cmd, 0, res);
+    uint64_t len = res.data_len;
+    std::string out((char *)&res.status, 4);
+    out.append((char *)&len, 8);
+    out.append((char *)res.data, res.data_len);
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t n = write(fd, out.data() + done, out.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) _exit(1);
+        done += (size_t)n;
+    }
+    _exit(0);
+}
+
+// on a g_bg thread
+static void snapshot_reap(void *arg) {
+    pid_t pid = (pid_t)(intptr_t)arg;
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+}
+
+static void uring_arm_snapshot(Reactor *reactor);
+
+// a child for snap_fwds, reactor->cmd has the words of their request.
+// false: couldn't fork, nothing was done
+static bool snapshot_fork(Reactor *reactor) {
+    const Command *command = reactor->snap_fwds[0]->command;
+    int fds[2];
+    reactor->stats.syscalls++;
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        return false;
+    }
+    reactor->stats.syscalls++;
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        snapshot_child(reactor, command, reactor->cmd, fds[1]);
+    }
+    close(fds[1]);
+    sock_set_nonblock(fds[0]);
+    reactor->stats.syscalls += 3;
+    reactor->stats.snapshots++;
+    reactor->snap_pid = pid;
+    reactor->snap_fd = fds[0];
+    if (reactor->use_uring) {
+        uring_arm_snapshot(reactor);
+    } else {
+        poller_add(&reactor->poller, fds[0], EV_READ);
+    }
+    return true;
+}
+
+// the reply to every request in snap_fwds, through the mailbox of each
+// one's origin (maybe us)
+static void snapshot_reply(Reactor *reactor, StatusCode status, std::string &data) {
+    std::vector<Forward *> &fwds = reactor->snap_fwds;
+    for (size_t i = 0; i < fwds.size(); i++) {
+        Forward *fwd = fwds[i];
+        fwd->status = status;
+        if (i + 1 == fwds.size()) {
+            fwd->data.swap(data);
+        } else {
+            fwd->data = data;
+        }
+        fwd->done = true;
+        reactor_post(reactor, fwd->origin, fwd);
+    }
+    fwds.clear();
+}
+
+// no child running: start one for the first waiting request and every
+// waiting one identical to it
+static void snapshot_start(Reactor *reactor) {
+    std::deque<Forward *> &waiting = reactor->snap_waiting;
+    while (reactor->snap_pid < 0 && !waiting.empty()) {
+        Forward *first = waiting.front();
+        std::deque<Forward *> rest;
+        for (Forward *fwd : waiting) {
+            if (fwd->command == first->command && fwd->req == first->req) {
+                reactor->snap_fwds.push_back(fwd);
+            } else {
+                rest.push_back(fwd);
+            }
+        }
+        waiting.swap(rest);
+        // it parsed fine at the origin
+        parse_req((uint8_t *)first->req.data(), first->req.size(), reactor->cmd);
+        if (snapshot_fork(reactor)) return;
+
+        Response res;
+        first->command->fn(&reactor->shard, reactor->cmd, 0, res);
+        std::string data((char *)res.data, res.data_len);
+        snapshot_reply(reactor, res.status, data);
+    }
+}
+
+// a CMD_SNAPSHOT request for our shard, with a copy of its bytes. the
+// reply comes back through the mailbox
+static void snapshot_queue(Reactor *reactor, Forward *fwd) {
+    reactor->stats.cmd_calls[fwd->command - commands]++;
+    reactor->snap_waiting.push_back(fwd);
+    snapshot_start(reactor);
+}
+
+// the pipe is readable: take what's in it. at EOF the child is done,
+// reply and start the next one
+static void snapshot_read(Reactor *reactor) {
+    std::string &out = reactor->snap_out;
+    char buf[64 * 1024];
+    while (true) {
+        reactor->stats.syscalls++;
+        ssize_t n = read(reactor->snap_fd, buf, sizeof(buf));
+        if (n > 0) {
+            out.append(buf, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) {
+            if (reactor->use_uring) uring_arm_snapshot(reactor);
+            return;
+        }
+        break; // EOF, or the pipe broke
+    }
+    if (!reactor->use_uring) {
+        poller_del(&reactor->poller, reactor->snap_fd);
+    }
+    close(reactor->snap_fd);
+    reactor->stats.syscalls++;
+    bg_submit(&g_bg, snapshot_reap, (void *)(intptr_t)reactor->snap_pid);
+    reactor->snap_fd = -1;
+    reactor->snap_pid = -1;
+
+    // all of it, or the child died on the way
+    StatusCode status = RES_ERR;
+    uint64_t len = 0;
+    std::string data = "snapshot failed";
+    if (out.size() >= snap_header) memcpy(&len, out.data() + 4, 8);
+    if (out.size() >= snap_header && out.size() - snap_header == len) {
+        memcpy(&status, out.data(), 4);
+        out.erase(0, snap_header);
+        data.swap(out);
+    }
+    std::string().swap(out); // a big reply's buffer goes too
+    snapshot_reply(reactor, status, data);
+    snapshot_start(reactor);
+}
+
+// a CMD_ALL_SHARDS request: a part for every shard, ours too (through
+// our own mailbox, like the others), merged as they come back
+// (forward_merge). the parent holds the conn's place in `pending`
+static void run_all_shards(Conn *conn, BatchReq &br) {
+    Reactor *reactor = conn->reactor;
+    Forward *whole = new Forward{};
+    whole->origin = reactor;
+    whole->conn = conn;
+    whole->command = br.command;
+    whole->parts_left = g_reactors.size();
+    conn->pending.push_back(whole);
+    conn->barrier = whole;
+    for (Reactor *owner : g_reactors) {
+        Forward *part = new Forward{};
+        part->origin = reactor;
+        part->conn = conn;
+        part->req.assign((char *)br.req, br.len);
+        part->command = br.command;
+        part->parent = whole;
+        reactor_post(reactor, owner, part);
+    }
+}
+
+// a part's reply into its parent: the data one after the other, in the
+// order they came back, or the first error
+static void forward_merge(Forward *whole, Forward *part) {
+    if (whole->status != RES_OK) return;
+    if (part->status != RES_OK) {
+        whole->status = part->status;
+        whole->data.swap(part->data);
+    } else if (whole->data.empty()) {
+        whole->data.swap(part->data);
+    } else {
+        whole->data += part->data;
+    }
+}
+
+// 1. Create response for one request of the batch
+// 2. If another shard owns the key, forward it instead. a CMD_ALL_SHARDS
+//    one goes to every shard, a CMD_SNAPSHOT one to a child process
+//    (snapshot_queue)
+// 3. Append the response back to output buffer, or queue it behind an
+//    earlier forwarded request so the order stays the same
+static void run_request(Conn *conn, BatchReq &br, std::vector<std::string_view> &cmd) {
+    Reactor *reactor = conn->reactor;
+    reactor->stats.requests++;
+
+    if (br.command && (br.command->flags & CMD_ALL_SHARDS)) {
+        run_all_shards(conn, br);
+        return;
+    }
+
+    if (br.owner != reactor) {
+        // the bytes leave with the request, one copy for all the words
+        Forward *fwd = new Forward{};
+        fwd->origin = reactor;
+        fwd->conn = conn;
+        fwd->req.assign((char *)br.req, br.len);
+        fwd->command = br.command;
+        fwd->hashval = br.hashval;
+        conn->pending.push_back(fwd);
+        reactor_post(reactor, br.owner, fwd);
+        return;
+    }
+
+    if (br.command && (br.command->flags & CMD_SNAPSHOT)) {
+        Forward *fwd = new Forward{};
+        fwd->origin = reactor;
+        fwd->conn = conn;
+        fwd->req.assign((char *)br.req, br.len);
+        fwd->command = br.command;
+        conn->pending.push_back(fwd);
+        snapshot_queue(reactor, fwd);
+        return;
+    }
+
+    Response res;
+    if (br.command) {
+        do_cmd(reactor, br.command, cmd, br.hashval, res);
+    } else {
+        // bad commands are answered right here, wherever the key would live
+        cmd_resolve(cmd, res);
+    }
+    if (conn->pending.empty()) {
+        make_res(conn, res);
+    } else {
+        Forward *slot = new Forward{};
+        forward_fill(slot, res);
+        slot->ready = true;
+        conn->pending.push_back(slot);
+    }
+}
+
+// length of the request at the front of `in`, -1 while it isn't all
+// there. *need: the least it can be, from the word lengths seen so far
+static ssize_t req_len_chunks(ChunkBuf &in, size_t *need) {
+    uint32_t num_words = 0;
+    size_t len = 4;
+    *need = len;
+    if (!in.peek(0, &num_words, 4)) return -1;
+    for (uint32_t i = 0; i < num_words; i++) {
+        uint32_t word_len = 0;
+        *need = len + 4;
+        if (!in.peek(len, &word_len, 4)) return -1;
+        len += 4 + (size_t)word_len;
+        *need = len;
+        if (len > in.size()) return -1;
+    }
+    return (ssize_t)len;
+}
+
+// after the complete requests ran, what's left is the start of the next
+// one. once its word lengths say it won't fit the chunk it's in, it gets
+// a chunk of its own: the rest arrives in one piece and is parsed in
+// place, only the part already here is copied. too big: close the conn.
+// whole requests left over can't run yet (paused, or an io_uring send in
+// flight): with read_budget of them waiting, stop reading for now
+static void conn_in_prepare(Conn *conn) {
+    ChunkBuf &in = conn->incoming;
+    conn->in_full = false;
+    if (in.size() == 0) {
+        in.consume(0); // a chunk reserved for a recv that got nothing
+        return;
+    }
+    size_t need = 0;
+    if (req_len_chunks(in, &need) >= 0) {
+        conn->in_full = in.size() >= read_budget;
+        return;
+    }
+    if (need > max_msg_len) {
+        conn->want_close = true;
+        return;
+    }
+    if (need > chunk_len) {
+        in.reserve_whole(need, big_req_slack);
+    }
+}
+
+// parse the complete requests in data[0, size) into batch, up to
+// max_batch more: resolve the command, hash the key (and prefetch its
+// slot when `map` is given and the key is ours). views into data.
+// returns the bytes parsed
+static size_t batch_parse(Reactor *reactor, uint8_t *data, size_t size, std::vector<BatchReq> &batch,
+                          std::vector<std::string_view> &words, std::vector<std::string_view> &cmd,
+                          HMap *map) {
+    size_t start = batch.size();
+    size_t offset = 0;
+    while (batch.size() - start < max_batch && size - offset >= 4) {
+        ssize_t req_len = parse_req(data + offset, size - offset, cmd);
+        if (req_len <= 0) break;
+
+        BatchReq br;
+        br.req = data + offset;
+        br.len = (size_t)req_len;
+        br.word_begin = words.size();
+        words.insert(words.end(), cmd.begin(), cmd.end());
+        br.word_end = words.size();
+        br.command = cmd_check(cmd);
+        br.hashval = 0;
+        br.owner = reactor;
+        // every keyed command has the key at cmd[1]
+        if (br.command && (br.command->flags & CMD_KEYED)) {
+            br.hashval = str_hash((uint8_t *)cmd[1].data(), cmd[1].size());
+            br.owner = key_owner(br.hashval);
+            if (map && br.owner == reactor) {
+                hm_prefetch_slot(map, br.hashval);
+            }
+        } else if (br.command && (br.command->flags & CMD_CURSOR)) {
+            // not a cursor: the handler here says so
+            Reactor *owner = cursor_owner(cmd[1]);
+            if (owner) br.owner = owner;
+        }
+        batch.push_back(br);
+        offset += (size_t)req_len;
+    }
+    return offset;
+}
+
+// prefetch the chain heads of our keys, then run the batch in order.
+// returns how many ran: it stops after one that set Conn::barrier
+static size_t batch_run(Conn *conn, BatchReq *reqs, size_t num_reqs, std::vector<std::string_view> &words) {
+    Reactor *reactor = conn->reactor;
+    HMap *map = &reactor->shard.cache.map;
+    std::vector<std::string_view> &cmd = reactor->cmd;
+    for (size_t i = 0; i < num_reqs; i++) {
+        BatchReq &br = reqs[i];
+        if (br.owner == reactor && br.command && (br.command->flags & CMD_KEYED)) {
+            hm_prefetch_head(map, br.hashval);
+        }
+    }
+    for (size_t i = 0; i < num_reqs; i++) {
+        BatchReq &br = reqs[i];
+        cmd.assign(words.begin() + br.word_begin, words.begin() + br.word_end);
+        run_request(conn, br, cmd);
+        if (!conn->barrier) continue;
+        // nothing can run between it and identical requests right behind
+        // it (a pipelined burst of KEYS), so they share its reply
+        size_t next = i + 1;
+        while (next < num_reqs && reqs[next].command == br.command && reqs[next].len == br.len &&
+               memcmp(reqs[next].req, br.req, br.len) == 0) {
+            reactor->stats.requests++;
+            Forward *copy = new Forward{};
+            copy->origin = reactor;
+            copy->conn = conn;
+            copy->command = br.command;
+            conn->pending.push_back(copy);
+            conn->barrier->copies.push_back(copy);
+            next++;
+        }
+        return next;
+    }
+    return num_reqs;
+}
+
+// bytes from `data` to the end of the last request that ran
+static size_t batch_used(uint8_t *data, BatchReq *reqs, size_t num_ran) {
+    BatchReq &last = reqs[num_ran - 1];
+    return (size_t)(last.req + last.len - data);
+}
+
+// pipelined requests run as a batch, so the HTable misses overlap:
+// 1. Parse every complete request in the head chunk of incoming (up to
+//    max_batch), views into it (batch_parse). the first one going on
+//    past the chunk is copied out whole to Reactor::linear and runs alone
+// 2. Prefetch the slots of the keys this shard owns, then the chain heads
+// 3. Run them in order, up to a CMD_ALL_SHARDS one (Conn::barrier)
+// 4. Only then consume what ran, the views point into incoming
+// return false if there was no complete request, or we wait
+static bool conn_run_batch(Conn *conn) {
+    if (conn->sending || conn->barrier) {
+        return false;
+    }
+    Reactor *reactor = conn->reactor;
+    std::vector<BatchReq> &batch = reactor->batch;
+    std::vector<std::string_view> &words = reactor->batch_words;
+    batch.clear();
+    words.clear();
+
+    uint8_t *data = conn->incoming.data();
+    size_t size = conn->incoming.head_size();
+    if (size < conn->incoming.size() && (size < 4 || parse_req(data, size, reactor->cmd) < 0)) {
+        size_t need = 0;
+        ssize_t len = req_len_chunks(conn->incoming, &need);
+        if (len < 0) {
+            return false;
+        }
+        reactor->linear.resize((size_t)len);
+        conn->incoming.peek(0, reactor->linear.data(), (size_t)len);
+        data = reactor->linear.data();
+        size = (size_t)len;
+    }
+    batch_parse(reactor, data, size, batch, words, reactor->cmd, &reactor->shard.cache.map);
+    if (batch.empty()) {
+        return false;
+    }
+    size_t ran = batch_run(conn, batch.data(), batch.size(), words);
+    conn->incoming.consume(batch_used(data, batch.data(), ran));
+    if (reactor->linear.capacity() > chunk_len) {
+        std::vector<uint8_t>().swap(reactor->linear);
+    }
+    return true;
+}
+
+// one send of the output's prefix, nothing consumed: plain send when
+// it's one piece, sendmsg when it spans chunks or values are spliced in
+static ssize_t conn_out_send(Conn *conn) {
+    struct iovec iov[max_send_iov];
+    size_t num_iov = conn_out_iov(conn, iov, max_send_iov);
+    if (num_iov == 1) {
+        return send(conn->fd, iov[0].iov_base, iov[0].iov_len, MSG_NOSIGNAL);
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = num_iov;
+    return sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+}
+
+// just send what you can
+// remove from the outgoing
+// catch some error
+// note: edge-triggered poller won't notify again, so keep sending until
+// the socket is full or we have nothing left.
+static void handle_write(Conn *conn) {
+    do {
+        conn->reactor->stats.syscalls++;
+        ssize_t bytes_sent = conn_out_send(conn);
+        // in case client not ready (we use non-block send)
+        if (bytes_sent <= 0 && errno == EAGAIN) {
+            return;
+        }
+        // actual err
+        if (bytes_sent <= 0) {
+            conn->want_close = true;
+            return; 
+        }
+        conn_out_consume(conn, (size_t)bytes_sent);
+    } while (conn->reactor->poller.edge_triggered && conn_out_size(conn) > 0);
+}
+
+static void uring_send(Conn *conn);
+
+// --io-threads: its recv/send waits for the next fan-out (io_round).
+// set Conn::io_read / io_write first
+static void io_queue(Conn *conn) {
+    if (conn->io_queued) return;
+    conn->io_queued = true;
+    conn->reactor->io_fds.push_back(conn->fd);
+}
+
+static void conn_send(Conn *conn) {
+    if (conn->reactor->use_uring) {
+        uring_send(conn);
+    } else if (conn->reactor->io_threads > 1) {
+        conn->io_write = true;
+        io_queue(conn);
+    } else {
+        handle_write(conn);
+    }
+}
+
+// read and write interest from the output size:
+// - over the soft limit: pause, no reading and no running requests (the
+//   ones already read wait in incoming). the socket fills up and TCP
+//   slows the client down instead of our memory growing
+// - back under it: resume, the caller runs what was waiting
+// - over the hard limit: close
+// returns true when it just resumed
+static bool conn_out_check(Conn *conn) {
+    Reactor *reactor = conn->reactor;
+    size_t out = conn_out_size(conn);
+    if (reactor->out_hard_limit && out > reactor->out_hard_limit && !conn->want_close) {
+        reactor->stats.out_closed++;
+        conn->want_close = true;
+    }
+    bool over = reactor->out_soft_limit && out >= reactor->out_soft_limit;
+    if (over && !conn->out_paused) {
+        reactor->stats.out_paused++;
+    }
+    bool resumed = conn->out_paused && !over;
+    conn->out_paused = over;
+    conn->want_read = !over && !conn->in_full;
+    conn->want_write = out > 0;
+    return resumed;
+}
+
+// end of this conn's turn with requests left: queue it behind the others
+static void conn_yield(Conn *conn) {
+    if (conn->ready) return;
+    conn->ready = true;
+    conn->reactor->ready.push_back(conn->fd);
+    conn->reactor->stats.yields++;
+}
+
+// run the complete requests we have, up to conn_quantum (and until the
+// output is over the soft limit), then write right away if we have
+// something to say: the client should be ready to recv after sending
+// requests. a write that drains it under the limit again runs the rest
+// (poller only, io_uring comes back here when its send completes).
+// --io-threads: the write is queued for the round's send fan-out.
+// the requests still run in order, a turn just stops between two.
+// start: stats.requests when the turn began, a batch may have run already
+static void conn_turn(Conn *conn, uint64_t start) {
+    Reactor *reactor = conn->reactor;
+    do {
+        while (!conn->out_paused && !conn->want_close &&
+               reactor->stats.requests - start < conn_quantum && conn_run_batch(conn)) {
+            conn_out_check(conn);
+        }
+        if (reactor->stats.requests - start >= conn_quantum) {
+            conn_yield(conn);
+        }
+        conn_in_prepare(conn);
+        conn_out_check(conn);
+        if (conn_out_size(conn) == 0 || conn->want_close) return;
+        conn_send(conn);
+    } while (!conn->reactor->use_uring && conn_out_check(conn));
+}
+
+static void conn_process(Conn *conn) {
+    conn_turn(conn, conn->reactor->stats.requests);
+}
+
+// 1. recv straight into the tail chunk of Conn::incoming (no stack buffer)
+// 2. keep going while the socket has more, up to read_budget
+// 3. Run the requests (conn_run_batch) via conn_process
+// note: level-triggered can stop at a short read, poll reports the rest.
+// edge-triggered must reach EAGAIN, or remember to come back
+// (Reactor::read_again) since no new edge will tell us
+static void handle_read(Conn *conn) {
+    Reactor *reactor = conn->reactor;
+    bool edge = reactor->poller.edge_triggered;
+    size_t total = 0;
+    while (true) {
+        if (total >= read_budget) {
+            if (edge && !conn->read_again) {
+                conn->read_again = true;
+                reactor->read_again.push_back(conn->fd);
+            }
+            break;
+        }
+        uint8_t *dst = conn->incoming.reserve(read_min);
+        size_t room = conn->incoming.tail_room();
+        reactor->stats.syscalls++;
+        ssize_t bytes_read = recv(conn->fd, dst, room, 0);
+        if (bytes_read < 0 && errno == EAGAIN) {
+            break; // drained
+        }
+        if (bytes_read <= 0) {
+            conn->want_close = true;
+            return;
+        }
+        conn->incoming.commit((size_t)bytes_read);
+        total += (size_t)bytes_read;
+        if (!edge && (size_t)bytes_read < room) {
+            break; // short read, nothing left for now
+        }
+    }
+
+    conn_process(conn);
+}
+
+// every event of a conn stamps it and moves it to the tail of its list,
+// so both lists stay ordered by last activity and their heads are the
+// first to time out (reactor_close_stale):
+// - idle_conns: nothing in flight, --timeout
+// - busy_conns: half a request in, replies not taken, or forwards out:
+//   the client stalled (or stopped reading), --io-timeout
+static void conn_timer_touch(Conn *conn) {
+    Reactor *reactor = conn->reactor;
+    bool busy = conn->incoming.size() > 0 || conn_out_size(conn) > 0 || !conn->pending.empty();
+    conn->last_io = reactor->shard.cache.clock;
+    dlist_detach(&conn->timer_node);
+    dlist_insert_before(busy ? &reactor->busy_conns : &reactor->idle_conns, &conn->timer_node);
+}
+
+// tcp = false: a unix socket conn, no Nagle there
+static Conn *conn_new(Reactor *reactor, int connfd, bool tcp) {
+    // replies from other shards go out one by one, don't let
+    // Nagle hold them back waiting for the client's delayed ACK
+    if (tcp) {
+        int yes = 1;
+        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        reactor->stats.syscalls++;
+    }
+
+    Conn *new_conn = new Conn{};
+    new_conn->fd = connfd;
+    new_conn->want_read = true;
+    new_conn->reactor = reactor;
+    new_conn->incoming.track(&reactor->shard.conn_bytes);
+    new_conn->outgoing.track(&reactor->shard.conn_bytes);
+    reactor->shard.num_conns++;
+    dlist_init(&new_conn->timer_node);
+    conn_timer_touch(new_conn);
+
+    std::vector<Conn *> &fdtoconn = reactor->fdtoconn;
+    // resize if too small
+    if (fdtoconn.size() <= (size_t)connfd) {
+        fdtoconn.resize(connfd + 1);
+    }
+    fdtoconn[connfd] = new_conn;
+    return new_conn;
+}
+
+// 1. accept, already nonblocking (accept4, no fcntl pair)
+// 2. log the ip addr of new conn, if the log has room this second
+//    (unix socket clients have no name to log). sockaddr_storage: the
+//    unix socket's peer address doesn't fit a sockaddr_in
+// 3. translate it to conn*
+//  - we want to read from it
+static Conn *handle_accept(Reactor *reactor, int listenfd) {
+    struct sockaddr_storage newsock;
+    socklen_t newsock_len = sizeof(newsock);
+    reactor->stats.syscalls++;
+    int connfd = accept4(listenfd, (struct sockaddr *)&newsock, &newsock_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (connfd == -1) {
+        // EAGAIN: queue drained. another reactor may have taken the
+        // unix socket's conn first, that's EAGAIN too
+        if (errno != EAGAIN && log_allow()) log_printf("accept: %s", strerror(errno));
+        return NULL;
+    }
+
+    bool tcp = listenfd == reactor->listenerfd;
+    char connip[INET_ADDRSTRLEN];
+    struct sockaddr_in *in = (struct sockaddr_in *)&newsock;
+    if (newsock.ss_family != AF_INET) {
+        if (log_allow()) log_printf("new connection on the unix socket");
+    } else if (log_allow() && inet_ntop(AF_INET, &in->sin_addr.s_addr, connip, sizeof(connip))) {
+        log_printf("new connection from %s:%u", connip, ntohs(in->sin_port));
+    }
+    return conn_new(reactor, connfd, tcp);
+}
+
+static uint32_t conn_interest(Conn *conn) {
+    uint32_t events = 0;
+    if (conn->want_read) events |= EV_READ;
+    if (conn->want_write) events |= EV_WRITE;
+    return events;
+}
+
+static void uring_update_recv(Conn *conn);
+
+// only touch the poller when the interest actually changes
+static void conn_update_interest(Conn *conn) {
+    if (conn->reactor->use_uring) return uring_update_recv(conn);
+    uint32_t events = conn_interest(conn);
+    if (events == conn->events) return;
+    poller_mod(&conn->reactor->poller, conn->fd, events);
+    conn->events = events;
+}
+
+// free only when nothing points to us anymore:
+// no forwarded request out there, no io_uring request in the kernel
+static void conn_try_free(Conn *conn) {
+    if (conn->closed && conn->pending.empty() && conn->uring_ops == 0) {
+        conn_out_clear(conn);
+        conn->reactor->shard.num_conns--;
+        delete conn;
+    }
+}
+
+// the fd can go now, but the Conn must stay alive while a forwarded
+// request (or an io_uring request) still points to it
+static void conn_destroy(Conn *conn) {
+    Reactor *reactor = conn->reactor;
+    if (!conn->closed) {
+        if (reactor->use_uring) {
+            // in-flight recv/send keep the socket alive, this ends them
+            shutdown(conn->fd, SHUT_RDWR);
+            reactor->stats.syscalls++;
+        } else {
+            poller_del(&reactor->poller, conn->fd);
+        }
+        close(conn->fd);
+        reactor->stats.syscalls++;
+        reactor->fdtoconn[conn->fd] = NULL;
+        dlist_detach(&conn->timer_node);
+        conn->closed = true;
+    }
+    conn_flush_pending(conn);
+    conn_try_free(conn);
+}
+
+static void conn_after_io(Conn *conn) {
+    if (conn->want_close) {
+        conn_destroy(conn);
+    } else {
+        conn_update_interest(conn);
+        conn_timer_touch(conn);
+    }
+}
+
+// drain the mailbox. a Forward is either
+// - a request for our shard: run it (a CMD_SNAPSHOT one when its child
+//   is done), send the reply back to the origin
+// - our own request coming back: flush what is now in order. a part of
+//   a CMD_ALL_SHARDS one is merged, the last part completes the parent
+static void handle_mail(Reactor *reactor) {
+    uint64_t counter;
+    reactor->stats.syscalls++;
+    if (read(reactor->wakefd, &counter, sizeof(counter)) < 0 && errno != EAGAIN) {
+        perror("read(eventfd)");
+    }
+
+    MailNode *node;
+    while ((node = mailbox_pop(&reactor->mailbox)) != NULL) {
+        Forward *fwd = container_of(node, Forward, node);
+        if (!fwd->done && (fwd->command->flags & CMD_SNAPSHOT)) {
+            snapshot_queue(reactor, fwd);
+            continue;
+        }
+        if (!fwd->done) {
+            Response res;
+            // it parsed fine at the origin
+            parse_req((uint8_t *)fwd->req.data(), fwd->req.size(), reactor->cmd);
+            do_cmd(reactor, fwd->command, reactor->cmd, fwd->hashval, res);
+            forward_fill(fwd, res);
+            reactor_post(reactor, fwd->origin, fwd);
+            continue;
+        }
+
+        if (fwd->parent) {
+            Forward *whole = fwd->parent;
+            forward_merge(whole, fwd);
+            forward_free(fwd);
+            if (--whole->parts_left > 0) continue;
+            whole->done = true;
+            whole->conn->barrier = NULL;
+            for (Forward *copy : whole->copies) {
+                copy->status = whole->status;
+                copy->data = whole->data;
+                copy->done = copy->ready = true;
+            }
+            fwd = whole;
+        }
+        Conn *conn = fwd->conn;
+        fwd->ready = true;
+        conn_flush_pending(conn);
+        if (conn->closed) {
+            conn_try_free(conn);
+            continue;
+        }
+        conn_process(conn);
+        conn_after_io(conn);
+    }
+}
+
+static void reactor_flush_wakes(Reactor *reactor) {
+    for (size_t i = 0; i < reactor->to_wake.size(); i++) {
+        if (!reactor->to_wake[i]) continue;
+        reactor->to_wake[i] = 0;
+        uint64_t one = 1;
+        reactor->stats.syscalls++;
+        if (write(g_reactors[i]->wakefd, &one, sizeof(one)) < 0) {
+            perror("write(eventfd)");
+        }
+    }
+}
+
+static void reactor_publish_stats(Reactor *reactor) {
+    uint64_t syscalls = reactor->stats.syscalls + reactor->poller.syscalls + reactor->uring.syscalls;
+    reactor->pub_requests.store(reactor->stats.requests, std::memory_order_relaxed);
+    reactor->pub_syscalls.store(syscalls, std::memory_order_relaxed);
+#ifdef COUNT_ALLOCS
+    reactor->pub_allocs.store(t_allocs, std::memory_order_relaxed);
+#endif
+    reactor->pub_expired.store(reactor->stats.expired, std::memory_order_relaxed);
+    reactor->pub_evicted.store(reactor->shard.evicted, std::memory_order_relaxed);
+    reactor->pub_out_paused.store(reactor->stats.out_paused, std::memory_order_relaxed);
+    reactor->pub_out_closed.store(reactor->stats.out_closed, std::memory_order_relaxed);
+    reactor->pub_yields.store(reactor->stats.yields, std::memory_order_relaxed);
+    reactor->pub_idle_closes.store(reactor->stats.idle_closes, std::memory_order_relaxed);
+    reactor->pub_io_closes.store(reactor->stats.io_closes, std::memory_order_relaxed);
+    reactor->pub_snapshots.store(reactor->stats.snapshots, std::memory_order_relaxed);
+    size_t mem[num_mem];
+    shard_mem_usage(&reactor->shard, mem);
+    for (size_t i = 0; i < num_mem; i++) {
+        reactor->pub_mem[i].store(mem[i], std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < num_commands; i++) {
+        reactor->pub_cmd_calls[i].store(reactor->stats.cmd_calls[i], std::memory_order_relaxed);
+    }
+}
+
+// "ip:port" of the other end
+static void peer_name(int fd, char *out, size_t len) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr *)&addr, &addr_len) == -1) return;
+    char ip[INET6_ADDRSTRLEN] = "?";
+    uint16_t port = 0;
+    if (addr.ss_family == AF_INET) {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+        port = ntohs(in->sin_port);
+    } else if (addr.ss_family == AF_INET6) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+        inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+        port = ntohs(in6->sin6_port);
+    } else if (addr.ss_family == AF_UNIX) {
+        snprintf(out, len, "unix");
+        return;
+    }
+    snprintf(out, len, "%s:%u", ip, port);
+}
+
+// rebuild the biggest-buffers list for INFO MEMORY when the conns have
+// changed (a buffer grew or went, a conn came or went). a busy loop does
+// it at most every conn_report_ms, one about to block right away, or the
+// list would stay stale while it sleeps. O(conns) per rebuild
+static void reactor_report_conns(Reactor *reactor, bool blocking) {
+    Shard *shard = &reactor->shard;
+    size_t state = shard->conn_bytes + shard->num_conns;
+    if (state == reactor->report_bytes) return;
+    uint64_t now = shard->cache.clock;
+    if (!blocking && now - reactor->report_ms < conn_report_ms) return;
+    reactor->report_ms = now;
+    reactor->report_bytes = state;
+
+    std::vector<ConnMem> top;
+    for (Conn *conn : reactor->fdtoconn) {
+        if (!conn) continue;
+        ConnMem cm;
+        cm.reactor = reactor->id;
+        cm.fd = conn->fd;
+        cm.in = conn->incoming.capacity();
+        cm.out = conn->outgoing.capacity();
+        cm.pinned = conn->out_ref_bytes;
+        top.push_back(cm);
+    }
+    size_t keep = std::min(top.size(), mem_top_conns);
+    std::partial_sort(top.begin(), top.begin() + keep, top.end(), conn_mem_more);
+    top.resize(keep);
+    for (ConnMem &cm : top) {
+        peer_name(cm.fd, cm.peer, sizeof(cm.peer));
+        reactor->stats.syscalls++;
+    }
+    std::lock_guard<std::mutex> lock(reactor->report_mu);
+    reactor->top_conns.swap(top);
+}
+
+static bool shard_rehashing(Shard *shard) {
+    return hm_rehashing(&shard->cache.map) || hm_rehashing(&shard->zset.map);
+}
+
+// a vector never gives memory back by itself: after a wave of keys with
+// a TTL is gone, the heap would keep its peak
+static bool shard_ttl_oversized(Shard *shard) {
+    std::vector<HeapItem> &ttl = shard->cache.ttl;
+    return ttl.capacity() >= ttl_shrink_min && ttl.size() * ttl_shrink_ratio < ttl.capacity();
+}
+
+// work for when the loop is idle: a map resize to finish, memory that a
+// delete wave gave back to malloc but malloc keeps, or a deadline heap
+// much bigger than its keys
+static bool shard_idle_pending(Shard *shard) {
+    size_t pages = shard->cache.slab.num_pages;
+    shard->page_peak = std::max(shard->page_peak, pages);
+    return shard_rehashing(shard) || shard->page_peak - pages >= trim_pages ||
+           shard_ttl_oversized(shard);
+}
+
+// on a g_bg thread: after a big delete wave malloc_trim walks every
+// free chunk, 30 ms per 1M of them. the loop only waits for it if it
+// mallocs meanwhile (an arena is locked while it's trimmed), most
+// requests don't
+static void bg_trim(void *) {
+    malloc_trim(0);
+    g_trimming.store(false, std::memory_order_release);
+}
+
+// only when there's nothing else to do: requests move the resize along
+// themselves. trim once the resizes are done (a shrink frees the old
+// table), one trim at a time for all reactors: it's for the whole process
+static void shard_idle(Shard *shard) {
+    hm_rehash_step(&shard->cache.map, idle_rehash_ns);
+    hm_rehash_step(&shard->zset.map, idle_rehash_ns);
+    // a copy of the keys still there, under 1/4 of the array. the items
+    // point at their entries, which don't move
+    if (shard_ttl_oversized(shard)) {
+        shard->cache.ttl.shrink_to_fit();
+    }
+    if (!shard_rehashing(shard) && shard->page_peak - shard->cache.slab.num_pages >= trim_pages) {
+        if (!g_trimming.exchange(true, std::memory_order_acq_rel)) {
+            bg_submit(&g_bg, bg_trim, NULL);
+        }
+        shard->page_peak = shard->cache.slab.num_pages;
+    }
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the nearest deadline, 0 = no key has one
+static uint64_t shard_next_deadline(Shard *shard) {
+    return shard->cache.ttl.empty() ? 0 : shard->cache.ttl[0].val;
+}
+
+// some keys are past their deadline: the loop mustn't block
+static bool shard_expire_pending(Shard *shard) {
+    uint64_t deadline = shard_next_deadline(shard);
+    return deadline != 0 && deadline <= monotonic_ms();
+}
+
+// active expiry, every loop iteration: keys nobody asks for again go
+// too. bounded by expire_budget_ns, the rest waits for the next round
+static void reactor_expire(Reactor *reactor) {
+    Shard *shard = &reactor->shard;
+    if (!shard_expire_pending(shard)) return;
+    uint64_t start = monotonic_ns();
+    uint64_t now = monotonic_ms();
+    size_t n;
+    do {
+        n = cache_expire(&shard->cache, now, expire_batch);
+        reactor->stats.expired += n;
+    } while (n == expire_batch && monotonic_ns() - start < expire_budget_ns);
+}
+
+// conns that used up their quantum, one more turn each, in the order
+// they yielded. swap first: whoever yields again waits for the next round
+static void reactor_run_ready(Reactor *reactor, std::vector<int> &ready) {
+    ready.swap(reactor->ready);
+    for (int fd : ready) {
+        Conn *conn = reactor->fdtoconn[fd];
+        // closed meanwhile (maybe fd reused by a new conn)
+        if (!conn || !conn->ready) continue;
+        conn->ready = false;
+        conn_process(conn);
+        conn_after_io(conn);
+    }
+    ready.clear();
+}
+
+////// --io-threads
+// the loop only notes which conns to read and write (io_collect), then
+// once per round (io_round):
+// 1. fan out the reads: every I/O thread (this one too) recvs into the
+//    tail chunk of its conns and parses what came in, wait for all
+// 2. run the parsed requests here, conn by conn in order: the shard,
+//    the chunk pool and the memory counters stay with this thread, so
+//    nothing needs a lock
+// 3. fan out the sends (replies of step 2 included), wait, and consume
+//    what went out here
+// the fan-out only pays off with a few conns to split, below
+// io_fanout_min this thread does it alone
+const size_t io_fanout_min = 2;
+
+// recv what fits the tail chunk (io_round reserved it: a new one would
+// be allocated and counted off the loop thread), parse the complete
+// requests of the head chunk. one spanning chunks is left to
+// conn_process. level-triggered: a full chunk means more, poll says so
+static void io_read(IoSlot *slot, Conn *conn) {
+    ChunkBuf &in = conn->incoming;
+    uint8_t *dst = in.reserve(read_min); // room already there, no new chunk
+    size_t room = in.tail_room();
+    slot->syscalls++;
+    conn->io_res = recv(conn->fd, dst, room, 0);
+    conn->io_errno = errno;
+    conn->io_slot = slot;
+    conn->io_begin = conn->io_end = slot->batch.size();
+    if (conn->io_res <= 0) return;
+    in.commit((size_t)conn->io_res);
+    batch_parse(conn->reactor, in.data(), in.head_size(), slot->batch, slot->words,
+                                  slot->cmd, NULL);
+    conn->io_end = slot->batch.size();
+}
+
+// send only, the loop thread consumes
+static void io_write(IoSlot *slot, Conn *conn) {
+    slot->syscalls++;
+    conn->io_res = conn_out_send(conn);
+    conn->io_errno = errno;
+}
+
+// IoPool callback, on every I/O thread
+static void io_thread_main(void *arg, uint32_t idx) {
+    Reactor *reactor = (Reactor *)arg;
+    IoSlot *slot = &reactor->io_slots[idx];
+    if (reactor->io_op == IO_READ) {
+        slot->batch.clear();
+        slot->words.clear();
+        for (Conn *conn : slot->conns) io_read(slot, conn);
+    } else {
+        for (Conn *conn : slot->conns) io_write(slot, conn);
+    }
+}
+
+// deal reactor->io_conns round-robin to the I/O threads, run `op` on
+// them and wait
+static void io_fanout(Reactor *reactor, IoOp op) {
+    std::vector<Conn *> &conns = reactor->io_conns;
+    size_t num_slots = conns.size() < io_fanout_min ? 1 : reactor->io_threads;
+    for (IoSlot &slot : reactor->io_slots) slot.conns.clear();
+    for (size_t i = 0; i < conns.size(); i++) {
+        reactor->io_slots[i % num_slots].conns.push_back(conns[i]);
+    }
+    reactor->io_op = op;
+    if (num_slots == 1) {
+        io_thread_main(reactor, 0);
+    } else {
+        io_pool_run(&reactor->io_pool, io_thread_main, reactor);
+    }
+    for (IoSlot &slot : reactor->io_slots) {
+        reactor->stats.syscalls += slot.syscalls;
+        slot.syscalls = 0;
+    }
+}
+
+// what an I/O thread read: run it as the first batch of the conn's turn,
+// under the same checks as the others (quantum, output limit, barrier),
+// then the rest of the turn. what didn't run stays in incoming and is
+// parsed again when its turn comes
+static void io_read_done(Conn *conn) {
+    if (conn->io_res == 0 || (conn->io_res < 0 && conn->io_errno != EAGAIN)) {
+        conn->want_close = true;
+        return;
+    }
+    // used up its quantum already: the ready list runs it, bytes and all
+    if (conn->ready) return;
+    Reactor *reactor = conn->reactor;
+    IoSlot *slot = conn->io_slot;
+    uint64_t start = reactor->stats.requests;
+    if (conn->io_end > conn->io_begin && !conn->out_paused && !conn->want_close && !conn->barrier) {
+        BatchReq *reqs = slot->batch.data() + conn->io_begin;
+        size_t num_reqs = conn->io_end - conn->io_begin;
+        for (size_t i = 0; i < num_reqs; i++) {
+            BatchReq &br = reqs[i];
+            if (br.owner == reactor && br.command && (br.command->flags & CMD_KEYED)) {
+                hm_prefetch_slot(&reactor->shard.cache.map, br.hashval);
+            }
+        }
+        size_t ran = batch_run(conn, reqs, num_reqs, slot->words);
+        conn->incoming.consume(batch_used(conn->incoming.data(), reqs, ran));
+        conn_out_check(conn);
+    }
+    conn_turn(conn, start);
+}
+
+// same as the end of handle_write
+static void io_write_done(Conn *conn) {
+    if (conn->io_res > 0) {
+        conn_out_consume(conn, (size_t)conn->io_res);
+    } else if (conn->io_errno != EAGAIN) {
+        conn->want_close = true;
+    }
+    if (conn_out_check(conn)) {
+        conn_process(conn); // what waited for the client to catch up
+    }
+}
+
+// a poller event of a conn, handled in the next io_round
+static void io_collect(Conn *conn, uint32_t events) {
+    if (conn->want_read && (events & EV_READ)) conn->io_read = true;
+    if (conn->want_write && (events & EV_WRITE)) conn->io_write = true;
+    if (events & EV_ERR) conn->want_close = true;
+    io_queue(conn);
+}
+
+// sends queued while it runs (a conn resumed in step 3) wait for the
+// next round. a stale fd in the list (conn closed, fd reused) finds
+// the flags clear and is skipped
+static void io_round(Reactor *reactor, std::vector<int> &fds) {
+    fds.swap(reactor->io_fds);
+    std::vector<Conn *> &conns = reactor->io_conns;
+
+    conns.clear();
+    for (int fd : fds) {
+        Conn *conn = reactor->fdtoconn[fd];
+        if (!conn || !conn->io_read) continue;
+        conn->io_read = false;
+        if (conn->want_close || !conn->want_read) continue;
+        conn->incoming.reserve(read_min);
+        conns.push_back(conn);
+    }
+    io_fanout(reactor, IO_READ);
+    for (Conn *conn : conns) io_read_done(conn);
+
+    conns.clear();
+    for (int fd : fds) {
+        Conn *conn = reactor->fdtoconn[fd];
+        if (!conn || !conn->io_write) continue;
+        conn->io_write = false;
+        if (conn->want_close || conn_out_size(conn) == 0) continue;
+        conns.push_back(conn);
+    }
+    io_fanout(reactor, IO_WRITE);
+    for (Conn *conn : conns) io_write_done(conn);
+    conns.clear();
+
+    for (int fd : fds) {
+        Conn *conn = reactor->fdtoconn[fd];
+        if (!conn || !conn->io_queued) continue;
+        conn->io_queued = false;
+        if (conn->io_read || conn->io_write) io_queue(conn);
+        conn_after_io(conn);
+    }
+    fds.clear();
+}
+
+// when the head of `list` times out, 0 = never
+static uint64_t conn_list_deadline(DList *list, uint64_t timeout_ms) {
+    if (timeout_ms == 0 || dlist_empty(list)) return 0;
+    return container_of(list->next, Conn, timer_node)->last_io + timeout_ms;
+}
+
+// the nearest of: a key's deadline, the oldest conn of either list
+// timing out. 0 = none
+static uint64_t reactor_next_deadline(Reactor *reactor) {
+    uint64_t deadlines[] = {
+        shard_next_deadline(&reactor->shard),
+        conn_list_deadline(&reactor->idle_conns, reactor->idle_timeout_ms),
+        conn_list_deadline(&reactor->busy_conns, reactor->io_timeout_ms),
+    };
+    uint64_t next = 0;
+    for (uint64_t deadline : deadlines) {
+        if (deadline != 0 && (next == 0 || deadline < next)) next = deadline;
+    }
+    return next;
+}
+
+// close the conns at the head of `list` that timed out, the rest are
+// younger: O(1) when none has
+static void conn_list_expire(Reactor *reactor, DList *list, uint64_t timeout_ms, uint64_t &closes) {
+    if (timeout_ms == 0) return;
+    uint64_t now = reactor->shard.cache.clock;
+    while (!dlist_empty(list)) {
+        Conn *conn = container_of(list->next, Conn, timer_node);
+        if (conn->last_io + timeout_ms > now) break;
+        closes++;
+        conn_destroy(conn); // unlinks it
+    }
+}
+
+static void reactor_close_stale(Reactor *reactor) {
+    conn_list_expire(reactor, &reactor->idle_conns, reactor->idle_timeout_ms, reactor->stats.idle_closes);
+    conn_list_expire(reactor, &reactor->busy_conns, reactor->io_timeout_ms, reactor->stats.io_closes);
+}
+
+// poll timeout: 0 with work waiting, otherwise until the nearest
+// deadline (-1 = none)
+static int reactor_timeout_ms(Reactor *reactor, bool idle_work) {
+    if (!reactor->read_again.empty() || !reactor->ready.empty() || !reactor->io_fds.empty() ||
+        !reactor->accept_again.empty() || idle_work) {
+        return 0;
+    }
+    uint64_t deadline = reactor_next_deadline(reactor);
+    if (deadline == 0) return -1;
+    uint64_t now = monotonic_ms();
+    if (deadline <= now) return 0;
+    return (int)std::min<uint64_t>(deadline - now, INT32_MAX);
+}
+
+// up to accept_budget conns off the listen queue: a storm drains it in a
+// few rounds without starving the conns we have. level-triggered reports
+// the rest again, edge-triggered won't: come back next round
+static void reactor_accept(Reactor *reactor, int listenfd) {
+    for (size_t i = 0; i < accept_budget; i++) {
+        Conn *new_conn = handle_accept(reactor, listenfd);
+        if (!new_conn) return;
+        new_conn->events = conn_interest(new_conn);
+        poller_add(&reactor->poller, new_conn->fd, new_conn->events);
+    }
+    if (reactor->poller.edge_triggered) {
+        reactor->accept_again.push_back(listenfd);
+    }
+}
+
+static void reactor_run(Reactor *reactor) {
+    std::vector<PollerEvent> events;
+    std::vector<int> read_again;
+    std::vector<int> ready;
+    std::vector<int> io_fds;
+    std::vector<int> accept_again;
+    while (true) {
+        ////// wait for readiness
+        // don't block if some conn still has unread data (edge-triggered)
+        // or requests, or there's idle work, and only until the next key
+        // expires
+        bool idle_work = shard_idle_pending(&reactor->shard);
+        int timeout_ms = reactor_timeout_ms(reactor, idle_work);
+        reactor_report_conns(reactor, timeout_ms != 0);
+        int num_events = poller_wait(&reactor->poller, events, timeout_ms);
+        // don't care if process got interupting signal by OS.
+        if (num_events < 0 && errno == EINTR) {
+            continue;
+        }
+        if (num_events < 0) {
+            perror("poll");
+            exit(1);
+        }
+        // one clock read per round for the keys' access stamps
+        reactor->shard.cache.clock = monotonic_ms();
 
-        ////// handle connection socket
-        for (size_t i = 1; i < pfds.size(); i++) {
-            Conn *conn = fdtoconn[pfds[i].fd];
-            struct pollfd pfd = pfds[i];
-            int readiness = pfd.revents;
-            if (conn->want_read && (readiness & POLLIN)) {
+        for (PollerEvent &ev : events) {
+            ////// handle listener sockets
+            if (ev.fd == reactor->listenerfd || ev.fd == reactor->unixfd) {
+                reactor_accept(reactor, ev.fd);
+                continue;
+            }
+
+            ////// handle other shards
+            if (ev.fd == reactor->wakefd) {
+                handle_mail(reactor);
+                continue;
+            }
+
+            ////// a snapshot child's reply
+            if (ev.fd == reactor->snap_fd) {
+                snapshot_read(reactor);
+                continue;
+            }
+
+            ////// handle connection socket
+            Conn *conn = reactor->fdtoconn[ev.fd];
+            // closed earlier in this batch: a reply from the mailbox put
+            // it over the hard limit, or an error. its event is stale
+            if (!conn || conn->closed) continue;
+            if (reactor->io_threads > 1) {
+                io_collect(conn, ev.events);
+                continue;
+            }
+            if (conn->want_read && (ev.events & EV_READ)) {
                 handle_read(conn);
             }
-            if (conn->want_write && (readiness & POLLOUT)) {
+            if (conn->want_write && (ev.events & EV_WRITE)) {
                 handle_write(conn);
+                if (conn_out_check(conn)) {
+                    conn_process(conn); // what waited for the client to catch up
+                }
             }
             // why handle error after read/write? cuz handle function might
             // toggle want_close after it found some err
-            if ((readiness & POLLERR) || conn->want_close) {
-                // only deal with conn. pfds will be reset in each loop.
-                close(conn->fd);
-                fdtoconn[conn->fd] = NULL;
-                delete conn;
+            if (ev.events & EV_ERR) {
+                conn->want_close = true;
+            }
+            conn_after_io(conn);
+        }
+
+        ////// conns that stopped at read_budget, one more round each
+        // swap first: whoever runs out again waits for the next iteration
+        read_again.swap(reactor->read_again);
+        for (int fd : read_again) {
+            Conn *conn = reactor->fdtoconn[fd];
+            // closed meanwhile (maybe fd reused by a new conn)
+            if (!conn || !conn->read_again) continue;
+            conn->read_again = false;
+            if (conn->want_read) {
+                handle_read(conn);
+            }
+            conn_after_io(conn);
+        }
+        read_again.clear();
+        accept_again.swap(reactor->accept_again);
+        for (int fd : accept_again) {
+            reactor_accept(reactor, fd);
+        }
+        accept_again.clear();
+
+        ////// conns with requests left after their quantum
+        reactor_run_ready(reactor, ready);
+        ////// --io-threads: the reads, requests and sends of this round
+        if (reactor->io_threads > 1) {
+            io_round(reactor, io_fds);
+        }
+        reactor_close_stale(reactor);
+
+        reactor_expire(reactor);
+        if (idle_work && num_events == 0 && reactor->read_again.empty() && reactor->ready.empty() &&
+            reactor->io_fds.empty()) {
+            shard_idle(&reactor->shard);
+        }
+
+        reactor_flush_wakes(reactor);
+        reactor_publish_stats(reactor);
+    }
+}
+
+////// io_uring backend
+// same Conn state machine, but completion based:
+// - one multishot accept on the listener
+// - one multishot recv per conn, the kernel picks buffers from a ring
+// - one send per conn in flight, covering the whole output (sendmsg
+//   when it spans chunks or values are spliced in)
+// - one io_uring_enter per loop iteration submits and waits
+
+const uint32_t uring_entries = 1024;
+const uint32_t uring_buf_count = 256; // 2^n
+const uint32_t uring_buf_len = 16 * 1024;
+
+// user_data = Conn pointer (8-byte aligned) | op in the low bits.
+// OP_ACCEPT has the listener fd << 3 in place of the pointer
+enum UringOp : uint64_t {
+    OP_ACCEPT = 1,
+    OP_RECV = 2,
+    OP_SEND = 3,
+    OP_WAKE = 4,
+    OP_TIMER = 5,
+    OP_CANCEL = 6,
+    OP_SNAPSHOT = 7,
+};
+const uint64_t uring_op_mask = 7;
+
+static void uring_arm_accept(Reactor *reactor, int listenfd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+    uring_prep_accept_multishot(sqe, listenfd);
+    sqe->user_data = ((uint64_t)listenfd << 3) | OP_ACCEPT;
+}
+
+static void uring_arm_wake(Reactor *reactor) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+    uring_prep_poll_multishot(sqe, reactor->wakefd, POLLIN);
+    sqe->user_data = OP_WAKE;
+}
+
+// one-shot: snapshot_read re-arms it until EOF, then closes the pipe
+static void uring_arm_snapshot(Reactor *reactor) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+    uring_prep_poll(sqe, reactor->snap_fd, POLLIN);
+    sqe->user_data = OP_SNAPSHOT;
+}
+
+static void uring_arm_recv(Conn *conn) {
+    Reactor *reactor = conn->reactor;
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+    uring_prep_recv_multishot(sqe, conn->fd, reactor->bufs.bgid);
+    sqe->user_data = (uint64_t)conn | OP_RECV;
+    conn->uring_ops++;
+    conn->recv_armed = true;
+}
+
+// no interest list here: reading means having a recv armed. a paused
+// conn's recv is cancelled, new data waits in the socket meanwhile
+static void uring_update_recv(Conn *conn) {
+    if (conn->closed || conn->want_close) return;
+    if (conn->want_read && !conn->recv_armed) {
+        return uring_arm_recv(conn);
+    }
+    if (!conn->want_read && conn->recv_armed && !conn->recv_cancel) {
+        struct io_uring_sqe *sqe = uring_get_sqe(&conn->reactor->uring);
+        uring_prep_cancel(sqe, (uint64_t)conn | OP_RECV);
+        sqe->user_data = OP_CANCEL;
+        conn->recv_cancel = true;
+    }
+}
+
+static void uring_send(Conn *conn) {
+    if (conn->sending || conn->closed || conn_out_size(conn) == 0) return;
+    struct io_uring_sqe *sqe = uring_get_sqe(&conn->reactor->uring);
+    conn->send_iov.resize(max_send_iov);
+    size_t num_iov = conn_out_iov(conn, conn->send_iov.data(), max_send_iov);
+    if (num_iov == 1) {
+        struct iovec &iov = conn->send_iov[0];
+        uring_prep_send(sqe, conn->fd, iov.iov_base, iov.iov_len);
+    } else {
+        conn->send_msg = msghdr{};
+        conn->send_msg.msg_iov = conn->send_iov.data();
+        conn->send_msg.msg_iovlen = num_iov;
+        uring_prep_sendmsg(sqe, conn->fd, &conn->send_msg);
+    }
+    sqe->user_data = (uint64_t)conn | OP_SEND;
+    conn->sending = true;
+    conn->uring_ops++;
+}
+
+static void uring_on_accept(Reactor *reactor, int listenfd, int res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept(reactor, listenfd);
+    }
+    if (res < 0) {
+        if (log_allow()) log_printf("accept: %s", strerror(-res));
+        return;
+    }
+    uring_arm_recv(conn_new(reactor, res, listenfd == reactor->listenerfd));
+}
+
+// the data is in a ring buffer: copy it to incoming, give the buffer back
+static void uring_on_recv(Conn *conn, int res, uint32_t flags) {
+    Reactor *reactor = conn->reactor;
+    bool more = flags & IORING_CQE_F_MORE;
+    if (!more) {
+        // the kernel ends the multishot when the ring runs dry, or we
+        // cancelled it. conn_after_io arms a new one if we still read
+        conn->uring_ops--;
+        conn->recv_armed = false;
+        conn->recv_cancel = false;
+    }
+
+    if (res > 0) {
+        uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!conn->closed) {
+            conn->incoming.append(uring_buf(&reactor->bufs, bid), (size_t)res);
+        }
+        uring_buf_recycle(&reactor->bufs, bid);
+    } else if (res != -ENOBUFS && res != -ECANCELED) {
+        conn->want_close = true; // EOF or error
+    }
+    if (conn->closed) return conn_try_free(conn);
+
+    if (!conn->want_close) {
+        conn_process(conn);
+    }
+    conn_after_io(conn);
+}
+
+// the kernel is done with outgoing, so the queued work can run now
+static void uring_on_send(Conn *conn, int res) {
+    conn->uring_ops--;
+    conn->sending = false;
+    if (conn->closed) return conn_try_free(conn);
+    if (res < 0) {
+        conn->want_close = true;
+        return conn_after_io(conn);
+    }
+
+    conn_out_consume(conn, (size_t)res);
+    conn_flush_pending(conn);
+    conn_process(conn); // also resend the rest after a short send
+    conn_after_io(conn);
+}
+
+// io_uring has no poll timeout: a timeout op wakes us up for the
+// nearest deadline instead. only armed when it's earlier than the one
+// in flight, a late one that fires for nothing is harmless
+static void uring_arm_timer(Reactor *reactor) {
+    uint64_t deadline = reactor_next_deadline(reactor);
+    if (deadline == 0) return;
+    if (reactor->timer_deadline != 0 && reactor->timer_deadline <= deadline) return;
+    uint64_t now = monotonic_ms();
+    uint64_t wait = deadline > now ? deadline - now : 0;
+    reactor->timer_ts.tv_sec = (int64_t)(wait / 1000);
+    reactor->timer_ts.tv_nsec = (long long)(wait % 1000) * 1000000;
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->uring);
+    uring_prep_timeout(sqe, &reactor->timer_ts);
+    sqe->user_data = OP_TIMER;
+    reactor->timer_deadline = deadline;
+}
+
+static void reactor_run_uring(Reactor *reactor) {
+    Uring *ring = &reactor->uring;
+    if (reactor->listenerfd >= 0) uring_arm_accept(reactor, reactor->listenerfd);
+    if (reactor->unixfd >= 0) uring_arm_accept(reactor, reactor->unixfd);
+    uring_arm_wake(reactor);
+    std::vector<int> ready;
+    while (true) {
+        // idle work to do (or keys to expire, or conns with requests
+        // left): just look for completions, don't wait. otherwise wait,
+        // for the next deadline at most
+        bool idle_work = shard_idle_pending(&reactor->shard);
+        bool busy = idle_work || shard_expire_pending(&reactor->shard) || !reactor->ready.empty();
+        if (!busy) uring_arm_timer(reactor);
+        reactor_report_conns(reactor, !busy);
+        int rv = uring_submit(ring, busy ? 0 : 1);
+        if (rv < 0 && rv != -EINTR) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(-rv));
+            exit(1);
+        }
+        reactor->shard.cache.clock = monotonic_ms();
+
+        struct io_uring_cqe *cqe;
+        bool idle = true;
+        while ((cqe = uring_peek_cqe(ring)) != NULL) {
+            idle = false;
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uring_cqe_seen(ring);
+
+            Conn *conn = (Conn *)(user_data & ~uring_op_mask);
+            switch (user_data & uring_op_mask) {
+            case OP_ACCEPT:
+                uring_on_accept(reactor, (int)(user_data >> 3), res, flags);
+                break;
+            case OP_RECV:
+                uring_on_recv(conn, res, flags);
+                break;
+            case OP_SEND:
+                uring_on_send(conn, res);
+                break;
+            case OP_WAKE:
+                if (!(flags & IORING_CQE_F_MORE)) uring_arm_wake(reactor);
+                handle_mail(reactor);
+                break;
+            case OP_SNAPSHOT:
+                snapshot_read(reactor); // an error shows up in the read too
+                break;
+            case OP_CANCEL:
+                break; // the recv's own completion says it's gone
+            case OP_TIMER:
+                // maybe not the earliest one, then the next arm is early
+                reactor->timer_deadline = 0;
+                break;
+            }
+        }
+
+        reactor_run_ready(reactor, ready);
+        reactor_close_stale(reactor);
+        reactor_expire(reactor);
+        if (idle_work && idle && reactor->ready.empty()) {
+            shard_idle(&reactor->shard);
+        }
+
+        reactor_flush_wakes(reactor);
+        reactor_publish_stats(reactor);
+    }
+}
+
+// where to take connections: --bind/--port (TCP, port 0 = none),
+// --unix, --backlog for both
+struct ListenConfig {
+    struct in_addr addr = {htonl(INADDR_ANY)};
+    uint16_t port = port_default;
+    std::string unix_path; // empty = no unix socket
+    int backlog = backlog_default;
+};
+
+// SO_REUSEPORT: every reactor binds its own listener to the same port
+// and the kernel spreads new connections between them
+static int listener_open(const ListenConfig &listen_cfg, bool reuse_port) {
+    int listenerfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenerfd == -1) {
+        perror("socket");
+        exit(1);
+    }
+    
+    int yes = 1;
+    setsockopt(listenerfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+    if (reuse_port && setsockopt(listenerfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+        perror("setsockopt(SO_REUSEPORT)");
+        exit(1);
+    }
+    struct sockaddr_in serveraddr;
+    serveraddr.sin_family = AF_INET;
+    serveraddr.sin_port = htons(listen_cfg.port);
+    serveraddr.sin_addr = listen_cfg.addr;
+    if (bind(listenerfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) == -1) {
+        perror("bind");
+        exit(1);
+    }
+
+    sock_set_nonblock(listenerfd);
+
+    if (listen(listenerfd, listen_cfg.backlog) == -1) {
+        perror("listen");
+        exit(1);
+    }
+    return listenerfd;
+}
+
+// a path can't be bound twice, so there's one unix socket and every
+// reactor polls it (or arms an accept on it): whoever accept4s first
+// gets the conn, the others see EAGAIN. the conn is then served like a
+// TCP one. a file left by a previous run is replaced
+static int listener_open_unix(const ListenConfig &listen_cfg) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (listen_cfg.unix_path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "unix socket path too long: %s\n", listen_cfg.unix_path.c_str());
+        exit(1);
+    }
+    memcpy(addr.sun_path, listen_cfg.unix_path.data(), listen_cfg.unix_path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        exit(1);
+    }
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("bind");
+        exit(1);
+    }
+    if (listen(fd, listen_cfg.backlog) == -1) {
+        perror("listen");
+        exit(1);
+    }
+    return fd;
+}
+
+// io_uring first if asked, otherwise (or if it fails) the poller
+static bool reactor_init_uring(Reactor *reactor) {
+    if (!uring_init(&reactor->uring, uring_entries)) {
+        return false;
+    }
+    if (!uring_buf_ring_init(&reactor->uring, &reactor->bufs, 0, uring_buf_count, uring_buf_len)) {
+        uring_destroy(&reactor->uring);
+        return false;
+    }
+    reactor->use_uring = true;
+    return true;
+}
+
+static Reactor *reactor_new(uint32_t id, uint32_t num_reactors, PollerBackend backend,
+                            bool edge_triggered, bool want_uring, HMapKind map_kind,
+                            const ListenConfig &listen_cfg, int unixfd) {
+    Reactor *reactor = new Reactor{};
+    reactor->id = id;
+    reactor->shard.id = id;
+    reactor->shard.cache.map.kind = map_kind;
+    reactor->shard.zset.map.kind = map_kind;
+    if (want_uring && !reactor_init_uring(reactor)) {
+        fprintf(stderr, "io_uring setup failed, falling back to poller\n");
+    }
+    if (!reactor->use_uring && !poller_init(&reactor->poller, backend, edge_triggered)) {
+        fprintf(stderr, "falling back to poll\n");
+        poller_init(&reactor->poller, BACKEND_POLL, false);
+    }
+    mailbox_init(&reactor->mailbox);
+    reactor->to_wake.resize(num_reactors);
+    dlist_init(&reactor->idle_conns);
+    dlist_init(&reactor->busy_conns);
+
+    if (listen_cfg.port != 0) {
+        reactor->listenerfd = listener_open(listen_cfg, num_reactors > 1);
+    }
+    reactor->unixfd = unixfd;
+    reactor->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->wakefd == -1) {
+        perror("eventfd");
+        exit(1);
+    }
+    if (!reactor->use_uring) {
+        if (reactor->listenerfd >= 0) poller_add(&reactor->poller, reactor->listenerfd, EV_READ);
+        if (reactor->unixfd >= 0) poller_add(&reactor->poller, reactor->unixfd, EV_READ);
+        poller_add(&reactor->poller, reactor->wakefd, EV_READ);
+    }
+    return reactor;
+}
+
+static void reactor_main(Reactor *reactor) {
+    if (reactor->use_uring) {
+        reactor_run_uring(reactor);
+    } else {
+        reactor_run(reactor);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--poll | --epoll | --epoll-et | --io-uring] [--threads N]\n"
+                    "          [--map chain|swiss] [--maxmemory BYTES[k|m|g]]\n"
+                    "          [--maxmemory-policy lru|lfu|noeviction] [--maxmemory-samples N]\n"
+                    "          [--output-soft-limit BYTES] [--output-hard-limit BYTES]\n"
+                    "          [--timeout SECONDS] [--io-timeout SECONDS] [--io-threads N]\n"
+                    "          [--bg-threads N] [--backlog N] [--bind ADDR] [--port N]\n"
+                    "          [--unix PATH]\n", prog);
+}
+
+// "100m" -> 100 << 20. false on junk
+static bool parse_bytes(const char *arg, size_t &out) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long val = strtoull(arg, &end, 10);
+    if (end == arg || errno != 0) return false;
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end == 'b' || *end == 'B') end++;
+    if (*end != '\0' || val > (SIZE_MAX >> shift)) return false;
+    out = (size_t)val << shift;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    PollerBackend backend = BACKEND_EPOLL;
+    bool edge_triggered = false;
+    bool want_uring = false;
+    uint32_t num_threads = 1;
+    HMapKind map_kind = HMAP_CHAIN;
+    size_t maxmemory = 0;
+    EvictPolicy evict = EVICT_LRU;
+    size_t evict_samples = evict_samples_default;
+    size_t out_soft = out_soft_default;
+    size_t out_hard = out_hard_default;
+    uint64_t idle_timeout_ms = idle_timeout_default_ms;
+    uint64_t io_timeout_ms = io_timeout_default_ms;
+    uint32_t io_threads = 1;
+    uint32_t bg_threads = bg_threads_default;
+    ListenConfig listen_cfg;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--poll") == 0) {
+            backend = BACKEND_POLL;
+        } else if (strcmp(argv[i], "--epoll") == 0) {
+            backend = BACKEND_EPOLL;
+            edge_triggered = false;
+        } else if (strcmp(argv[i], "--epoll-et") == 0) {
+            backend = BACKEND_EPOLL;
+            edge_triggered = true;
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            want_uring = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = (uint32_t)atoi(argv[++i]);
+            if (num_threads == 0) {
+                usage(argv[0]);
+                return 1;
             }
+        } else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+            const char *kind = argv[++i];
+            if (strcmp(kind, "chain") == 0) {
+                map_kind = HMAP_CHAIN;
+            } else if (strcmp(kind, "swiss") == 0) {
+                map_kind = HMAP_SWISS;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--maxmemory") == 0 && i + 1 < argc) {
+            if (!parse_bytes(argv[++i], maxmemory)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--maxmemory-policy") == 0 && i + 1 < argc) {
+            const char *policy = argv[++i];
+            if (strcmp(policy, "lru") == 0) {
+                evict = EVICT_LRU;
+            } else if (strcmp(policy, "lfu") == 0) {
+                evict = EVICT_LFU;
+            } else if (strcmp(policy, "noeviction") == 0) {
+                evict = EVICT_NONE;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--maxmemory-samples") == 0 && i + 1 < argc) {
+            int samples = atoi(argv[++i]);
+            if (samples <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            evict_samples = (size_t)samples;
+        } else if (strcmp(argv[i], "--output-soft-limit") == 0 && i + 1 < argc) {
+            if (!parse_bytes(argv[++i], out_soft)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output-hard-limit") == 0 && i + 1 < argc) {
+            if (!parse_bytes(argv[++i], out_hard)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "--timeout") == 0 || strcmp(argv[i], "--io-timeout") == 0) &&
+                   i + 1 < argc) {
+            bool idle = strcmp(argv[i], "--timeout") == 0;
+            int secs = atoi(argv[++i]);
+            if (secs < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            (idle ? idle_timeout_ms : io_timeout_ms) = (uint64_t)secs * 1000;
+        } else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+            io_threads = (uint32_t)atoi(argv[++i]);
+            if (io_threads == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bg-threads") == 0 && i + 1 < argc) {
+            bg_threads = (uint32_t)atoi(argv[++i]);
+            if (bg_threads == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            listen_cfg.backlog = atoi(argv[++i]);
+            if (listen_cfg.backlog <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bind") == 0 && i + 1 < argc) {
+            if (inet_pton(AF_INET, argv[++i], &listen_cfg.addr) != 1) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            int port = atoi(argv[++i]);
+            if (port < 0 || port > 65535) {
+                usage(argv[0]);
+                return 1;
+            }
+            listen_cfg.port = (uint16_t)port;
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            listen_cfg.unix_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (listen_cfg.port == 0 && listen_cfg.unix_path.empty()) {
+        fprintf(stderr, "--port 0 needs --unix\n");
+        return 1;
+    }
+
+    // the I/O threads serve one shard, and read once per round
+    if (io_threads > 1 && (num_threads > 1 || want_uring || edge_triggered)) {
+        fprintf(stderr, "--io-threads needs one reactor on a level-triggered poller\n");
+        return 1;
+    }
+
+    if (want_uring && !uring_probe_multishot()) {
+        fprintf(stderr, "io_uring multishot recv not supported, falling back to poller\n");
+        want_uring = false;
+    }
+
+    // a new hash seed per process, before any thread hashes a key
+    uint64_t seed;
+    if (getrandom(&seed, sizeof(seed), 0) != (ssize_t)sizeof(seed)) {
+        perror("getrandom");
+        exit(1);
+    }
+    str_hash_seed(seed);
+    log_init();
+
+    // all reactors must exist before any of them starts routing
+    int unixfd = listen_cfg.unix_path.empty() ? -1 : listener_open_unix(listen_cfg);
+    for (uint32_t i = 0; i < num_threads; i++) {
+        g_reactors.push_back(reactor_new(i, num_threads, backend, edge_triggered, want_uring, map_kind,
+                                         listen_cfg, unixfd));
+    }
+    // no limit: no access stamps to keep up either
+    for (Reactor *reactor : g_reactors) {
+        Shard *shard = &reactor->shard;
+        shard->mem_limit = maxmemory / num_threads;
+        shard->cache.evict = maxmemory ? evict : EVICT_NONE;
+        shard->cache.rng = seed ^ (0x9e3779b97f4a7c15ull * (reactor->id + 1));
+        shard->evict_samples = evict_samples;
+        reactor->out_soft_limit = out_soft;
+        reactor->out_hard_limit = out_hard;
+        reactor->idle_timeout_ms = idle_timeout_ms;
+        reactor->io_timeout_ms = io_timeout_ms;
+        if (io_threads > 1) {
+            reactor->io_threads = io_threads;
+            reactor->io_slots.resize(io_threads);
+            io_pool_init(&reactor->io_pool, io_threads);
         }
     }
+    Reactor *first = g_reactors[0];
+    printf("event loop: %s, %u reactor(s), %s hashmap\n",
+           first->use_uring ? "io_uring" : poller_name(&first->poller), num_threads,
+           hm_kind_name(map_kind));
+    if (io_threads > 1) {
+        printf("io threads: %u\n", io_threads);
+    }
+    if (listen_cfg.port != 0) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &listen_cfg.addr, ip, sizeof(ip));
+        printf("listening on %s:%u\n", ip, listen_cfg.port);
+    }
+    if (unixfd >= 0) {
+        printf("listening on %s\n", listen_cfg.unix_path.c_str());
+    }
+    if (maxmemory) {
+        const char *names[] = {"noeviction", "lru", "lfu"};
+        printf("maxmemory: %zu bytes, %s\n", maxmemory, names[evict]);
+    }
+
+    bg_pool_init(&g_bg, bg_threads);
+    value_lazy_free(&g_bg, lazy_free_min);
+
+    // reactor 0 runs on the main thread
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(reactor_main, g_reactors[i]);
+    }
+    reactor_main(first);
 }
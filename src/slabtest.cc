@@ -0,0 +1,199 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "slab.h"
+
+// The slab against a plain map of what's allocated: objects of every
+// class don't overlap and keep their bytes, the page counts follow the
+// allocations (a page that empties out goes back, except the last one
+// of its class with room), and a freed object is the next one handed out.
+
+struct Obj {
+    size_t len;
+    uint8_t tag;
+};
+
+typedef std::map<uint8_t *, Obj> Live;
+
+static unsigned rng_seed = 1;
+
+static uintptr_t page_of(void *ptr) {
+    return (uintptr_t)ptr & ~(uintptr_t)(slab_page_size - 1);
+}
+
+// objects of one class a page holds
+static size_t per_page(size_t len) {
+    size_t hdr = (sizeof(SlabPage) + 15) & ~(size_t)15;
+    return (slab_page_size - hdr) / slab_size(len);
+}
+
+static uint8_t *obj_alloc(Slab &slab, Live &live, size_t len) {
+    uint8_t *ptr = (uint8_t *)slab_alloc(&slab, len);
+    assert(ptr && live.count(ptr) == 0);
+    uint8_t tag = (uint8_t)rand_r(&rng_seed);
+    memset(ptr, tag, len);
+    live[ptr] = Obj{len, tag};
+    return ptr;
+}
+
+static void obj_free(Slab &slab, Live &live, uint8_t *ptr) {
+    auto iter = live.find(ptr);
+    assert(iter != live.end());
+    slab_free(&slab, ptr, iter->second.len);
+    live.erase(iter);
+}
+
+// cons: verify the slab against what's live
+// 1. no two objects overlap (at their rounded size), and each one still
+//    holds its bytes
+// 2. slab objects sit 16-byte aligned in a page, and the pages counted
+//    are at least the ones they're in
+// 3. used_bytes and big_bytes add up
+static void slab_verify(Slab &slab, Live &live) {
+    size_t used = 0;
+    size_t big = 0;
+    std::set<uintptr_t> pages;
+    uint8_t *prev_end = NULL;
+    for (auto &kv : live) {
+        uint8_t *ptr = kv.first;
+        Obj &obj = kv.second;
+        assert(!prev_end || ptr >= prev_end);
+        prev_end = ptr + slab_size(obj.len);
+        for (size_t i = 0; i < obj.len; i++) assert(ptr[i] == obj.tag);
+        used += slab_size(obj.len);
+        if (obj.len > slab_max_obj) {
+            big += obj.len;
+            continue;
+        }
+        assert((uintptr_t)ptr % 16 == 0);
+        assert(ptr >= (uint8_t *)page_of(ptr) + sizeof(SlabPage));
+        assert(page_of(ptr) == page_of(ptr + slab_size(obj.len) - 1));
+        pages.insert(page_of(ptr));
+    }
+    assert(slab.used_bytes == used && slab.big_bytes == big);
+    assert(slab.num_pages >= pages.size());
+    assert(slab_mem(&slab) == slab.num_pages * slab_page_size + big);
+}
+
+int main(void) {
+    // stage 1: sizes round up to the class, big ones stay as they are
+    assert(slab_size(1) == 32 && slab_size(32) == 32);
+    assert(slab_size(33) == 48 && slab_size(48) == 48 && slab_size(49) == 64);
+    assert(slab_size(500) == 512 && slab_size(512) == 512);
+    assert(slab_size(513) == 513 && slab_size(100000) == 100000);
+
+    Slab slab;
+    Live live;
+    slab_verify(slab, live);
+
+    // stage 2: a few objects of every class, and a big one. one page a
+    // class
+    for (size_t len = 1; len <= slab_max_obj + 100; len += 7) {
+        obj_alloc(slab, live, len);
+        slab_verify(slab, live);
+    }
+    assert(slab.num_pages == slab_num_classes);
+
+    // stage 3: a freed object is the next one handed out (per page free
+    // list, last in first out), from its class only
+    {
+        auto iter = live.begin();
+        while (iter->second.len > slab_max_obj - slab_step) iter++;
+        uint8_t *ptr = iter->first;
+        size_t len = iter->second.len;
+        obj_free(slab, live, ptr);
+        assert(obj_alloc(slab, live, slab_size(len) + 1) != ptr); // the next class
+        assert(obj_alloc(slab, live, len) == ptr);
+        slab_verify(slab, live);
+    }
+
+    // stage 4: one class over several pages. the first pages fill up,
+    // freeing every object of one gives it back, the last one with room
+    // stays
+    const size_t len = 100;
+    size_t pages_before = slab.num_pages;
+    size_t n = per_page(len) * 4;
+    std::vector<uint8_t *> objs;
+    for (size_t i = 0; i < n; i++) {
+        objs.push_back(obj_alloc(slab, live, len));
+    }
+    slab_verify(slab, live);
+    size_t class_pages = slab.num_pages - pages_before + 1; // + stage 2's
+    assert(class_pages >= 4 && class_pages <= 5);
+
+    uintptr_t victim = page_of(objs[per_page(len) * 2]);
+    size_t freed = 0;
+    for (uint8_t *&ptr : objs) {
+        if (page_of(ptr) != victim) continue;
+        obj_free(slab, live, ptr);
+        ptr = NULL;
+        freed++;
+    }
+    assert(freed == per_page(len));
+    // gone once the last object went, there's a page with room left
+    assert(slab.num_pages == pages_before + class_pages - 2);
+    slab_verify(slab, live);
+
+    // the other pages too: only one page of the class is left, empty or
+    // with stage 2's objects
+    for (uint8_t *&ptr : objs) {
+        if (ptr) obj_free(slab, live, ptr);
+        ptr = NULL;
+    }
+    assert(slab.num_pages == pages_before);
+    slab_verify(slab, live);
+
+    // stage 5: a second wave of the same size takes as many pages as the
+    // first, nothing is left behind
+    for (size_t i = 0; i < n / 2; i++) {
+        objs[i] = obj_alloc(slab, live, len);
+    }
+    size_t wave_pages = slab.num_pages;
+    for (size_t i = 0; i < n / 2; i++) {
+        obj_free(slab, live, objs[i]);
+    }
+    for (size_t i = 0; i < n / 2; i++) {
+        objs[i] = obj_alloc(slab, live, len);
+    }
+    assert(slab.num_pages == wave_pages);
+    for (size_t i = 0; i < n / 2; i++) {
+        obj_free(slab, live, objs[i]);
+    }
+    slab_verify(slab, live);
+
+    // stage 6: random alloc and free over every class and big sizes
+    for (int i = 0; i < 50000; i++) {
+        if (live.empty() || rand_r(&rng_seed) % 2) {
+            size_t obj_len = 1 + (size_t)rand_r(&rng_seed) % (slab_max_obj + 64);
+            obj_alloc(slab, live, obj_len);
+        } else {
+            auto iter = live.begin();
+            std::advance(iter, (size_t)rand_r(&rng_seed) % std::min<size_t>(live.size(), 64));
+            obj_free(slab, live, iter->first);
+        }
+        if (i % 256 == 0) slab_verify(slab, live);
+    }
+    slab_verify(slab, live);
+
+    // everything freed: a page per class at most
+    while (!live.empty()) {
+        obj_free(slab, live, live.begin()->first);
+    }
+    slab_verify(slab, live);
+    assert(slab.used_bytes == 0 && slab.big_bytes == 0);
+    assert(slab.num_pages <= slab_num_classes);
+
+    // stage 7: destroy hands back the rest
+    slab_destroy(&slab);
+    assert(slab.num_pages == 0 && slab_mem(&slab) == 0);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include "bgpool.h"
+
+static void bg_thread(BgPool *pool) {
+    while (true) {
+        BgJob job;
+        {
+            std::unique_lock<std::mutex> lock(pool->mu);
+            pool->cv.wait(lock, [&] { return !pool->jobs.empty() || pool->stopping; });
+            if (pool->jobs.empty()) return; // stopping, nothing left
+            job = pool->jobs.front();
+            pool->jobs.pop_front();
+        }
+        job.fn(job.arg);
+    }
+}
+
+void bg_pool_init(BgPool *pool, uint32_t num_threads) {
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pool->threads.emplace_back(bg_thread, pool);
+    }
+}
+
+void bg_pool_destroy(BgPool *pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mu);
+        pool->stopping = true;
+    }
+    pool->cv.notify_all();
+    for (std::thread &thread : pool->threads) thread.join();
+    pool->threads.clear();
+    pool->stopping = false; // bg_pool_init may start it again
+}
+
+void bg_submit(BgPool *pool, void (*fn)(void *arg), void *arg) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mu);
+        pool->jobs.push_back(BgJob{fn, arg});
+    }
+    pool->cv.notify_one();
+}
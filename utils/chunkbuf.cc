@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "chunkbuf.h"
+
+// freed chunk_len chunks wait here for the next chain of the same
+// thread, at most chunk_pool_max of them (1 MB)
+const size_t chunk_pool_max = 64;
+
+struct ChunkPool {
+    std::vector<void *> chunks;
+
+    ~ChunkPool() {
+        for (void *chunk : chunks) free(chunk);
+    }
+};
+
+static thread_local ChunkPool chunk_pool;
+
+size_t chunk_pool_bytes() {
+    return chunk_pool.chunks.size() * chunk_len;
+}
+
+ChunkBuf::~ChunkBuf() {
+    while (head) {
+        Chunk *next = head->next;
+        chunk_free(head);
+        head = next;
+    }
+}
+
+ChunkBuf::Chunk *ChunkBuf::chunk_new(size_t cap) {
+    void *mem;
+    if (cap == chunk_len && !chunk_pool.chunks.empty()) {
+        mem = chunk_pool.chunks.back();
+        chunk_pool.chunks.pop_back();
+    } else {
+        mem = malloc(sizeof(Chunk) + cap);
+        if (!mem) {
+            perror("malloc(chunk)");
+            abort();
+        }
+    }
+    Chunk *chunk = (Chunk *)mem;
+    chunk->next = NULL;
+    chunk->cap = cap;
+    chunk->begin = chunk->end = 0;
+    cap_bytes += cap;
+    if (mem_counter) *mem_counter += cap;
+    return chunk;
+}
+
+void ChunkBuf::chunk_free(Chunk *chunk) {
+    cap_bytes -= chunk->cap;
+    if (mem_counter) *mem_counter -= chunk->cap;
+    if (chunk->cap == chunk_len && chunk_pool.chunks.size() < chunk_pool_max) {
+        if (chunk_pool.chunks.capacity() == 0) chunk_pool.chunks.reserve(chunk_pool_max);
+        chunk_pool.chunks.push_back(chunk);
+        return;
+    }
+    free(chunk);
+}
+
+// link an empty chunk at the tail
+void ChunkBuf::push_chunk(size_t cap) {
+    Chunk *chunk = chunk_new(cap);
+    if (tail) tail->next = chunk;
+    else head = chunk;
+    tail = chunk;
+}
+
+size_t ChunkBuf::size() {
+    return bytes;
+}
+
+size_t ChunkBuf::capacity() {
+    return cap_bytes;
+}
+
+void ChunkBuf::track(size_t *counter) {
+    assert(!mem_counter);
+    mem_counter = counter;
+    *mem_counter += cap_bytes;
+}
+
+void ChunkBuf::append(const uint8_t *src, size_t len) {
+    while (len > 0) {
+        if (!tail || tail->end == tail->cap) push_chunk(chunk_len);
+        size_t n = std::min(len, tail->cap - tail->end);
+        memcpy(tail->buf + tail->end, src, n);
+        tail->end += n;
+        bytes += n;
+        src += n;
+        len -= n;
+    }
+}
+
+// the tail's leftover room is skipped when it's too small, so a chunk
+// can end a little short of its capacity
+uint8_t *ChunkBuf::reserve(size_t len) {
+    assert(len <= chunk_len);
+    if (!tail || tail->cap - tail->end < len) push_chunk(chunk_len);
+    return tail->buf + tail->end;
+}
+
+size_t ChunkBuf::tail_room() {
+    return tail ? tail->cap - tail->end : 0;
+}
+
+void ChunkBuf::commit(size_t len) {
+    assert(tail && tail->end + len <= tail->cap);
+    tail->end += len;
+    bytes += len;
+}
+
+// drained chunks are unlinked right away, the tail too: an idle conn
+// holds nothing
+void ChunkBuf::consume(size_t len) {
+    assert(len <= bytes);
+    bytes -= len;
+    while (len > 0 || (head && head->begin == head->end)) {
+        size_t n = std::min(len, head->end - head->begin);
+        head->begin += n;
+        len -= n;
+        if (head->begin < head->end) break;
+        Chunk *next = head->next;
+        chunk_free(head);
+        head = next;
+        if (!head) tail = NULL;
+    }
+}
+
+uint8_t *ChunkBuf::data() {
+    return head ? head->buf + head->begin : NULL;
+}
+
+size_t ChunkBuf::head_size() {
+    return head ? head->end - head->begin : 0;
+}
+
+bool ChunkBuf::peek(size_t off, void *dst, size_t len) {
+    if (off + len > bytes) return false;
+    uint8_t *out = (uint8_t *)dst;
+    for (Chunk *chunk = head; len > 0; chunk = chunk->next) {
+        size_t have = chunk->end - chunk->begin;
+        if (off >= have) {
+            off -= have;
+            continue;
+        }
+        size_t n = std::min(len, have - off);
+        memcpy(out, chunk->buf + chunk->begin + off, n);
+        out += n;
+        len -= n;
+        off = 0;
+    }
+    return true;
+}
+
+size_t ChunkBuf::iov(size_t off, size_t len, struct iovec *out, size_t max_iov) {
+    assert(off + len <= bytes);
+    size_t n = 0;
+    for (Chunk *chunk = head; len > 0 && n < max_iov; chunk = chunk->next) {
+        size_t have = chunk->end - chunk->begin;
+        if (off >= have) {
+            off -= have;
+            continue;
+        }
+        size_t take = std::min(len, have - off);
+        out[n++] = iovec{chunk->buf + chunk->begin + off, take};
+        len -= take;
+        off = 0;
+    }
+    return n;
+}
+
+// plan
+// 1. it already fits: the data is all in the head chunk and the chunk
+//    has room for the rest
+// 2. otherwise copy the data into a new chunk, free the old ones
+void ChunkBuf::reserve_whole(size_t total, size_t extra) {
+    assert(total >= bytes);
+    if (head == tail && head && head->cap - head->begin >= total) return;
+
+    Chunk *whole = chunk_new(std::max(total + extra, chunk_len));
+    peek(0, whole->buf, bytes);
+    whole->end = bytes;
+    while (head) {
+        Chunk *next = head->next;
+        chunk_free(head);
+        head = next;
+    }
+    head = tail = whole;
+}
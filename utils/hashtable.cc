@@ -1,5 +1,12 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utility>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "hashtable.h"
 #include "common.h"
@@ -8,20 +15,90 @@
 // chaining hash table allow > 1 load factor
 const size_t max_load_factor = 4;
 const size_t rehash_work = 128;
+// shrink when under 1/8 full (either kind), a delete wave shouldn't
+// leave a huge mostly-empty table behind
+const size_t shrink_ratio = 8;
+const size_t chain_min_slots = 4;
+
+// word-at-a-time hash in the style of wyhash:
+// - the whole mixing step is one 64x64 -> 128 bit multiply, then xor
+//   the two halves together (hash_mix)
+// - keys > 16 bytes eat 16 bytes per multiply, > 48 bytes run three
+//   independent lanes so the multiplies overlap
+// - keys <= 16 bytes are read with a few overlapping loads, no loop
+// - seeded: str_hash_seed() at startup, so nobody outside can pick keys
+//   that all land in one slot
+static const uint64_t hash_p0 = 0xa0761d6478bd642full;
+static const uint64_t hash_p1 = 0xe7037ed1a0b428dbull;
+static const uint64_t hash_p2 = 0x8ebc6af09c88c6e3ull;
+static const uint64_t hash_p3 = 0x589965cc75374cc3ull;
+
+static constexpr uint64_t hash_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// seed already mixed with the constants, see str_hash_seed
+static uint64_t hash_seed = hash_mix(0 ^ hash_p0, hash_p1);
+
+void str_hash_seed(uint64_t seed) {
+    hash_seed = seed ^ hash_mix(seed ^ hash_p0, hash_p1);
+}
+
+static uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint64_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
 
-// - The key of this hash is we will have `offset_basis` and `prime`
-// - for every byte in our string, `xor` it with `acc` , which start with `basis`
-// - then `*=` with `prime` 
-// - search google for `basis` and `prime` for FNV hash 
-// - return `acc` (whihc is our hash)
 uint64_t str_hash(uint8_t *data, size_t len) {
-    uint64_t hash = 0xcbf29ce484222325; // start with offset basis
-    const uint64_t prime = 0x00000100000001b3;
-    for (size_t i = 0; i < len; i++) {
-        hash ^= data[i]; 
-        hash *= prime;
+    const uint8_t *p = data;
+    uint64_t seed = hash_seed;
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            // 4..16 bytes: two 32-bit loads from each end, they overlap
+            size_t mid = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + mid);
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        }
+    } else {
+        size_t left = len;
+        if (left > 48) {
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = hash_mix(read64(p) ^ hash_p1, read64(p + 8) ^ seed);
+                seed1 = hash_mix(read64(p + 16) ^ hash_p2, read64(p + 24) ^ seed1);
+                seed2 = hash_mix(read64(p + 32) ^ hash_p3, read64(p + 40) ^ seed2);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (left > 16) {
+            seed = hash_mix(read64(p) ^ hash_p1, read64(p + 8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        // the last 16 bytes, may overlap what the loop already ate
+        a = read64(p + left - 16);
+        b = read64(p + left - 8);
     }
-    return hash;
+
+    a ^= hash_p1;
+    b ^= seed;
+    __uint128_t r = (__uint128_t)a * b;
+    return hash_mix((uint64_t)r ^ hash_p0 ^ len, (uint64_t)(r >> 64) ^ hash_p1);
 }
 
 static void h_init(HTable *htab, size_t num_slots) {
@@ -67,15 +144,310 @@ static HNode *h_detach(HTable *htab, HNode **target_ptr) {
     return node;
 }
 
-static void hm_rehash_init(HMap *map) {
+////// swiss table (HMAP_SWISS)
+// open addressing: HTable::table holds the HNode pointers, and next to
+// it HTable::ctrl has one control byte per slot:
+//  - 0x80 empty, 0xfe deleted (tombstone)
+//  - 0b0xxxxxxx full, x = low 7 bits of the hash (h2)
+// slots are probed in aligned groups of 16: load the group's control
+// bytes into one SSE2 register and compare all 16 against h2 at once.
+// a lookup usually reads one control line and the one slot that matches,
+// instead of walking a chain of dependent pointers.
+// - the rest of the hash (h1) picks the first group, then +1, +2, +3...
+//   groups (triangular), which visits every group once since it's 2^n
+// - a group with an empty byte ends the probe, nothing went past it
+// - max load 7/8, tombstones count
+
+const uint8_t ctrl_empty = 0x80;
+const uint8_t ctrl_deleted = 0xfe;
+const size_t group_width = 16;
+const size_t swiss_min_slots = 16; // one group
+const size_t swiss_npos = (size_t)-1;
+
+static uint8_t s_h2(uint64_t hashval) {
+    return (uint8_t)(hashval & 0x7f);
+}
+
+static size_t s_first_group(HTable *htab, uint64_t hashval) {
+    return (size_t)(hashval >> 7) & ((htab->mask + 1) / group_width - 1);
+}
+
+// bit i is set if ctrl[i] == byte
+static uint32_t group_match(const uint8_t *ctrl, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t bits = 0;
+    for (size_t i = 0; i < group_width; i++) {
+        if (ctrl[i] == byte) bits |= 1u << i;
+    }
+    return bits;
+#endif
+}
+
+// empty or deleted, both have the high bit set
+static uint32_t group_match_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+    uint32_t bits = 0;
+    for (size_t i = 0; i < group_width; i++) {
+        if (ctrl[i] & 0x80) bits |= 1u << i;
+    }
+    return bits;
+#endif
+}
+
+static void s_init(HTable *htab, size_t num_slots) {
+    // check n = 2^k, whole groups
+    assert(num_slots >= group_width && ((num_slots & (num_slots - 1)) == 0));
+    htab->table = (HNode **)malloc(num_slots * sizeof(HNode *));
+    htab->ctrl = (uint8_t *)aligned_alloc(group_width, num_slots);
+    memset(htab->ctrl, ctrl_empty, num_slots);
+    htab->mask = num_slots - 1;
+    htab->size = 0;
+    htab->deleted = 0;
+}
+
+static void s_free(HTable *htab) {
+    free(htab->table);
+    free(htab->ctrl);
+    *htab = HTable{};
+}
+
+static bool s_too_full(HTable *htab) {
+    return (htab->size + htab->deleted) * 8 >= (htab->mask + 1) * 7;
+}
+
+// no duplicate check, same as h_insert
+static void s_insert(HTable *htab, HNode *node) {
+    size_t groups = (htab->mask + 1) / group_width;
+    size_t group = s_first_group(htab, node->hashval);
+    for (size_t step = 1; ; step++) {
+        uint8_t *ctrl = htab->ctrl + group * group_width;
+        uint32_t free_bits = group_match_free(ctrl);
+        if (free_bits) {
+            size_t idx = group * group_width + __builtin_ctz(free_bits);
+            if (htab->ctrl[idx] == ctrl_deleted) htab->deleted--;
+            htab->ctrl[idx] = s_h2(node->hashval);
+            htab->table[idx] = node;
+            htab->size++;
+            return;
+        }
+        // the load factor keeps a free slot somewhere
+        assert(step < groups);
+        group = (group + step) & (groups - 1);
+    }
+}
+
+// slot index of the match, or swiss_npos
+static size_t s_lookup(HTable *htab, HNode *target, bool (* eq)(HNode *, HNode *)) {
+    if (!htab->table) return swiss_npos;
+    size_t groups = (htab->mask + 1) / group_width;
+    size_t group = s_first_group(htab, target->hashval);
+    uint8_t h2 = s_h2(target->hashval);
+    for (size_t step = 1; step <= groups; step++) {
+        uint8_t *ctrl = htab->ctrl + group * group_width;
+        for (uint32_t bits = group_match(ctrl, h2); bits; bits &= bits - 1) {
+            size_t idx = group * group_width + __builtin_ctz(bits);
+            HNode *cur = htab->table[idx];
+            if (cur->hashval == target->hashval && eq(cur, target)) {
+                return idx;
+            }
+        }
+        if (group_match(ctrl, ctrl_empty)) break;
+        group = (group + step) & (groups - 1);
+    }
+    return swiss_npos;
+}
+
+// a group that still has an empty byte never had a probe go past it,
+// so the slot can go back to empty. otherwise leave a tombstone
+static HNode *s_detach(HTable *htab, size_t idx) {
+    HNode *node = htab->table[idx];
+    uint8_t *group = htab->ctrl + (idx & ~(group_width - 1));
+    if (group_match(group, ctrl_empty)) {
+        htab->ctrl[idx] = ctrl_empty;
+    } else {
+        htab->ctrl[idx] = ctrl_deleted;
+        htab->deleted++;
+    }
+    htab->size--;
+    return node;
+}
+
+// slot array + control bytes
+static size_t s_mem(HTable *htab) {
+    if (!htab->table) return 0;
+    return (htab->mask + 1) * (sizeof(HNode *) + 1);
+}
+
+// the first group of the probe: its control bytes, and its slots
+static void s_prefetch_slot(HTable *htab, uint64_t hashval) {
+    if (!htab->table) return;
+    size_t first = s_first_group(htab, hashval) * group_width;
+    __builtin_prefetch(htab->ctrl + first);
+    __builtin_prefetch(&htab->table[first]);
+}
+
+// the node behind the first h2 match: the start of its Entry, key included
+static void s_prefetch_head(HTable *htab, uint64_t hashval) {
+    if (!htab->table) return;
+    size_t first = s_first_group(htab, hashval) * group_width;
+    uint32_t bits = group_match(htab->ctrl + first, s_h2(hashval));
+    if (!bits) return;
+    HNode *node = htab->table[first + __builtin_ctz(bits)];
+    __builtin_prefetch(node);
+}
+
+static bool s_foreach(HTable *htab, bool (* fn)(HNode *, void *), void *arg) {
+    if (htab->table == NULL) return true;
+    for (size_t i = 0; i <= htab->mask; i++) {
+        if (htab->ctrl[i] & 0x80) continue;
+        if (!fn(htab->table[i], arg)) return false;
+    }
+    return true;
+}
+
+// plan
+// 1. scan up to rehash_work slots of older from migrate_pos
+// 2. move every full one to newer, leave a tombstone behind (probes in
+//    older still have to get past it)
+// 3. free older once it's empty
+static void sm_help_rehashing(HMap *map, size_t work) {
+    if (!map->older.table) return;
+    size_t slots = map->older.mask + 1;
+    for (size_t n = 0; n < work && map->migrate_pos != slots && map->older.size > 0; n++) {
+        size_t idx = map->migrate_pos++;
+        if (map->older.ctrl[idx] & 0x80) continue;
+        HNode *node = map->older.table[idx];
+        map->older.ctrl[idx] = ctrl_deleted;
+        map->older.deleted++;
+        map->older.size--;
+        s_insert(&map->newer, node);
+    }
+    if (map->older.size == 0) {
+        s_free(&map->older);
+    }
+}
+
+static void sm_rehash_init(HMap *map, size_t slots) {
+    map->older = map->newer;
+    s_init(&map->newer, slots);
+    map->migrate_pos = 0;
+}
+
+// smallest table at most half full
+static size_t s_fit_slots(size_t keys) {
+    size_t slots = swiss_min_slots;
+    while (slots < keys * 2) slots *= 2;
+    return slots;
+}
+
+static void sm_insert(HMap *map, HNode *node) {
+    if (!map->newer.table) {
+        s_init(&map->newer, swiss_min_slots);
+    }
+    // can't happen with rehash_work per insert, but never fill up newer
+    if (map->older.table && s_too_full(&map->newer)) {
+        sm_help_rehashing(map, (size_t)-1);
+    }
+    s_insert(&map->newer, node);
+    if (!map->older.table && s_too_full(&map->newer)) {
+        // grow to 2x if it's over half full of live keys, otherwise the
+        // same size just to drop the tombstones
+        size_t slots = map->newer.mask + 1;
+        if (map->newer.size * 2 >= slots) {
+            slots *= 2;
+        }
+        sm_rehash_init(map, slots);
+    }
+    sm_help_rehashing(map, rehash_work);
+}
+
+static HNode *sm_lookup(HMap *map, HNode *target, bool (* eq)(HNode *, HNode *)) {
+    size_t idx = s_lookup(&map->newer, target, eq);
+    if (idx != swiss_npos) return map->newer.table[idx];
+    idx = s_lookup(&map->older, target, eq);
+    return idx != swiss_npos ? map->older.table[idx] : NULL;
+}
+
+static HNode *sm_delete(HMap *map, HNode *target, bool (* eq)(HNode *, HNode *)) {
+    size_t idx = s_lookup(&map->newer, target, eq);
+    if (idx != swiss_npos) return s_detach(&map->newer, idx);
+    idx = s_lookup(&map->older, target, eq);
+    if (idx != swiss_npos) return s_detach(&map->older, idx);
+    return NULL;
+}
+
+static void sm_maybe_shrink(HMap *map) {
+    if (map->older.table || !map->newer.table) return;
+    size_t slots = map->newer.mask + 1;
+    if (slots > swiss_min_slots && map->newer.size * shrink_ratio < slots) {
+        sm_rehash_init(map, s_fit_slots(map->newer.size));
+    }
+}
+
+static void hm_rehash_init(HMap *map, size_t slots) {
     if (map->older.table != NULL) return;
     map->older = map->newer;
-    h_init(&map->newer, (map->older.mask + 1) * 2); // resize to 2^(n+1)
+    h_init(&map->newer, slots);
     map->migrate_pos = 0;
 }
 
+// load <= 1 after a shrink, far from both thresholds
+static void h_maybe_shrink(HMap *map) {
+    if (map->older.table || !map->newer.table) return;
+    size_t slots = map->newer.mask + 1;
+    if (slots > chain_min_slots && map->newer.size * shrink_ratio < slots) {
+        size_t fit = chain_min_slots;
+        while (fit < map->newer.size) fit *= 2;
+        hm_rehash_init(map, fit);
+    }
+}
+
+static void hm_help_rehashing(HMap *map, size_t work);
+
+// both kinds: move `work` more keys (swiss: slots) if a resize is going
+// on, a resize that just finished may start a shrink
+static void help_rehashing(HMap *map, size_t work) {
+    if (!map->older.table) return;
+    if (map->kind == HMAP_SWISS) {
+        sm_help_rehashing(map, work);
+        sm_maybe_shrink(map);
+    } else {
+        hm_help_rehashing(map, work);
+        h_maybe_shrink(map);
+    }
+}
+
+bool hm_rehashing(HMap *map) {
+    return map->older.table != NULL;
+}
+
+static uint64_t clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// chunks of a few thousand keys between clock reads
+bool hm_rehash_step(HMap *map, uint64_t budget_ns) {
+    uint64_t start = clock_ns();
+    while (hm_rehashing(map)) {
+        help_rehashing(map, rehash_work * 32);
+        if (clock_ns() - start >= budget_ns) break;
+    }
+    return hm_rehashing(map);
+}
+
+// a lookup moves some keys too, or a read-only workload would keep both
+// tables alive forever. nodes don't move, only the slots pointing at them
 HNode *hm_lookup(HMap *map, HNode *target, bool (* eq)(HNode *, HNode *)) {
     if (!map) return NULL;
+    help_rehashing(map, rehash_work);
+    if (map->kind == HMAP_SWISS) return sm_lookup(map, target, eq);
     HNode **res = h_lookup(&map->newer, target, eq);
     if (res == NULL) {
         res = h_lookup(&map->older, target, eq);
@@ -83,10 +455,43 @@ HNode *hm_lookup(HMap *map, HNode *target, bool (* eq)(HNode *, HNode *)) {
     return res != NULL ? *res : NULL;
 }
 
-// detach the target node (can be dummy) from map and return detached node 
-HNode *hm_delete(HMap *map, HNode *target, bool(* eq)(HNode *, HNode *)) {
+static void h_prefetch_slot(HTable *htab, uint64_t hashval) {
+    if (!htab->table) return;
+    __builtin_prefetch(&htab->table[hashval & htab->mask]);
+}
+
+// the head node: the start of its Entry, key included
+static void h_prefetch_head(HTable *htab, uint64_t hashval) {
+    if (!htab->table) return;
+    HNode *head = htab->table[hashval & htab->mask];
+    if (!head) return;
+    __builtin_prefetch(head);
+}
+
+// while rehashing the key can be in either table
+void hm_prefetch_slot(HMap *map, uint64_t hashval) {
+    if (map->kind == HMAP_SWISS) {
+        s_prefetch_slot(&map->newer, hashval);
+        s_prefetch_slot(&map->older, hashval);
+        return;
+    }
+    h_prefetch_slot(&map->newer, hashval);
+    h_prefetch_slot(&map->older, hashval);
+}
+
+void hm_prefetch_head(HMap *map, uint64_t hashval) {
+    if (map->kind == HMAP_SWISS) {
+        s_prefetch_head(&map->newer, hashval);
+        s_prefetch_head(&map->older, hashval);
+        return;
+    }
+    h_prefetch_head(&map->newer, hashval);
+    h_prefetch_head(&map->older, hashval);
+}
+
+static HNode *h_delete(HMap *map, HNode *target, bool(* eq)(HNode *, HNode *)) {
     HNode **target_ptr = h_lookup(&map->newer, target, eq);
-    if ((target_ptr == h_lookup(&map->newer, target, eq)) != NULL) {
+    if (target_ptr != NULL) {
         return h_detach(&map->newer, target_ptr);
     }
     if ((target_ptr = h_lookup(&map->older, target, eq)) != NULL) {
@@ -95,22 +500,41 @@ HNode *hm_delete(HMap *map, HNode *target, bool(* eq)(HNode *, HNode *)) {
     return NULL;
 }
 
+// detach the target node (can be dummy) from map and return detached node.
+// moves some keys like lookup, and starts a shrink if it got too empty
+HNode *hm_delete(HMap *map, HNode *target, bool(* eq)(HNode *, HNode *)) {
+    help_rehashing(map, rehash_work);
+    HNode *node;
+    if (map->kind == HMAP_SWISS) {
+        node = sm_delete(map, target, eq);
+        if (node) sm_maybe_shrink(map);
+    } else {
+        node = h_delete(map, target, eq);
+        if (node) h_maybe_shrink(map);
+    }
+    return node;
+}
+
 // plan
 // 1. for loop 10 (another cond: `migrate_pos` != `mask + 1`)
 // 2. run migrate_pos until we found something (or it runs out, break)
 // 3. at `migrate_pos` idx linked list, detach the head get node pointer
 // 4. then put it in new one
 // 5. check at the end if we done rehashing
-static void hm_help_rehashing(HMap *map) {
+// empty slots count too (8 per key), after a shrink older is mostly empty
+// and one call shouldn't scan all of it
+static void hm_help_rehashing(HMap *map, size_t work) {
     if (!map->older.table) return;
     size_t slots = map->older.mask + 1;
-    for (size_t moved = 0; moved < rehash_work && map->migrate_pos != slots; moved++) {
+    size_t empty_work = work * 8;
+    for (size_t moved = 0; moved < work && map->migrate_pos != slots; moved++) {
         // find the non-empty slot
-        while (map->migrate_pos != slots && map->older.table[map->migrate_pos] == NULL) {
+        while (map->migrate_pos != slots && map->older.table[map->migrate_pos] == NULL && empty_work > 0) {
             map->migrate_pos++;
+            empty_work--;
         }
-        // break if we done
-        if (map->migrate_pos == slots) break;
+        // break if we done (or scanned enough for now)
+        if (map->migrate_pos == slots || map->older.table[map->migrate_pos] == NULL) break;
         HNode **head_ptr = &map->older.table[map->migrate_pos];
         HNode *detached_head = h_detach(&map->older, head_ptr);
         h_insert(&map->newer, detached_head);
@@ -124,6 +548,7 @@ static void hm_help_rehashing(HMap *map) {
 }
 
 void hm_insert(HMap *map, HNode *node) {
+    if (map->kind == HMAP_SWISS) return sm_insert(map, node);
     if (!map->newer.table) {
         h_init(&map->newer, 4);
     }
@@ -135,17 +560,250 @@ void hm_insert(HMap *map, HNode *node) {
         // check if current load factor exceed our threshold
         size_t max_keys = (map->newer.mask + 1) * max_load_factor;
         if (map->newer.size >= max_keys) {
-            hm_rehash_init(map);
+            hm_rehash_init(map, (map->newer.mask + 1) * 2); // resize to 2^(n+1)
         }
     }
-    hm_help_rehashing(map); // move some keys
+    help_rehashing(map, rehash_work); // move some keys
 }
 
 // only compare key
 bool entry_eq(HNode *n1, HNode *n2) {
     Entry *e1 = container_of(n1, Entry, node);
     Entry *e2 = container_of(n2, Entry, node);
-    return e1->key == e2->key;
+    return entry_key(e1) == entry_key(e2);
+}
+
+bool entry_key_eq(HNode *n1, HNode *n2) {
+    Entry *entry = container_of(n1, Entry, node);
+    LookupKey *probe = container_of(n2, LookupKey, node);
+    return probe->key == entry_key(entry);
+}
+
+std::string_view entry_key(Entry *entry) {
+    return std::string_view(entry->data, entry->key_len);
+}
+
+Value *entry_value(Entry *entry) {
+    if (entry->val_len != entry_val_ref) return NULL;
+    Value *value;
+    memcpy(&value, entry->data + entry->key_len, sizeof(value)); // unaligned
+    return value;
+}
+
+std::string_view entry_val(Entry *entry) {
+    if (Value *value = entry_value(entry)) return std::string_view(value->data, value->len);
+    return std::string_view(entry->data + entry->key_len, entry->val_len);
+}
+
+// what the entry takes in the slab (the key starts right after access,
+// no padding). val_len: the value's, or entry_val_ref
+static size_t entry_size(size_t key_len, size_t val_len) {
+    if (val_len > entry_inline_max) val_len = sizeof(Value *);
+    return offsetof(Entry, data) + key_len + val_len;
+}
+
+static size_t value_size(Value *value) {
+    return sizeof(Value) + value->len;
+}
+
+static void entry_fill_value(Cache *cache, Entry *entry, std::string_view val) {
+    if (val.size() > entry_inline_max) {
+        Value *value = value_new(val.data(), val.size());
+        memcpy(entry->data + entry->key_len, &value, sizeof(value));
+        entry->val_len = entry_val_ref;
+        cache->value_bytes += value_size(value);
+    } else {
+        entry->val_len = (uint32_t)val.size();
+        memcpy(entry->data + entry->key_len, val.data(), val.size());
+    }
+}
+
+// a reply may still hold the value, but it's not the keyspace's anymore
+static void entry_drop_value(Cache *cache, Entry *entry) {
+    Value *value = entry_value(entry);
+    if (!value) return;
+    cache->value_bytes -= value_size(value);
+    value_unref(value);
+}
+
+static uint32_t access_new(Cache *cache);
+
+Entry *entry_new(Cache *cache, std::string_view key, uint64_t hashval, std::string_view val) {
+    Entry *entry = (Entry *)slab_alloc(&cache->slab, entry_size(key.size(), val.size()));
+    entry->node.next = NULL;
+    entry->node.hashval = hashval;
+    entry->key_len = (uint32_t)key.size();
+    entry->heap_idx = heap_none;
+    entry->access = access_new(cache);
+    memcpy(entry->data, key.data(), key.size());
+    entry_fill_value(cache, entry, val);
+    return entry;
+}
+
+void entry_free(Cache *cache, Entry *entry) {
+    if (entry->heap_idx != heap_none) heap_remove(cache->ttl, entry->heap_idx);
+    entry_drop_value(cache, entry);
+    slab_free(&cache->slab, entry, entry_size(entry->key_len, entry->val_len));
+}
+
+static bool node_same(HNode *n1, HNode *n2) {
+    return n1 == n2;
+}
+
+// plan
+// 1. same slab class: drop the old value, write the new one in place
+// 2. otherwise: a new entry, swapped with the old one in the map
+Entry *entry_set_value(Cache *cache, Entry *entry, std::string_view val) {
+    size_t old_size = entry_size(entry->key_len, entry->val_len);
+    size_t new_size = entry_size(entry->key_len, val.size());
+    if (slab_size(old_size) == slab_size(new_size)) {
+        entry_drop_value(cache, entry);
+        entry_fill_value(cache, entry, val);
+        return entry;
+    }
+
+    Entry *fresh = entry_new(cache, entry_key(entry), entry->node.hashval, val);
+    fresh->access = entry->access;
+    HNode *old = hm_delete(&cache->map, &entry->node, &node_same);
+    assert(old == &entry->node);
+    hm_insert(&cache->map, &fresh->node);
+    // the deadline moves over too
+    if (entry->heap_idx != heap_none) {
+        fresh->heap_idx = entry->heap_idx;
+        cache->ttl[fresh->heap_idx].ref = &fresh->heap_idx;
+        entry->heap_idx = heap_none;
+    }
+    entry_free(cache, entry);
+    return fresh;
+}
+
+// plan
+// 1. 0: leave the heap if it's in
+// 2. in already: new value, move it up or down
+// 3. otherwise push
+void entry_set_deadline(Cache *cache, Entry *entry, uint64_t deadline) {
+    if (deadline == 0) {
+        if (entry->heap_idx != heap_none) heap_remove(cache->ttl, entry->heap_idx);
+        return;
+    }
+    if (entry->heap_idx != heap_none) {
+        cache->ttl[entry->heap_idx].val = deadline;
+        heap_update(cache->ttl.data(), entry->heap_idx, cache->ttl.size());
+        return;
+    }
+    heap_push(cache->ttl, deadline, &entry->heap_idx);
+}
+
+uint64_t entry_deadline(Cache *cache, Entry *entry) {
+    if (entry->heap_idx == heap_none) return 0;
+    return cache->ttl[entry->heap_idx].val;
+}
+
+void cache_remove(Cache *cache, Entry *entry) {
+    HNode *node = hm_delete(&cache->map, &entry->node, &node_same);
+    assert(node == &entry->node);
+    (void)node;
+    entry_free(cache, entry);
+}
+
+// the heap top is always the nearest deadline
+size_t cache_expire(Cache *cache, uint64_t now, size_t max_keys) {
+    size_t n = 0;
+    while (n < max_keys && !cache->ttl.empty() && cache->ttl[0].val <= now) {
+        Entry *entry = container_of(cache->ttl[0].ref, Entry, heap_idx);
+        cache_remove(cache, entry);
+        n++;
+    }
+    return n;
+}
+
+////// eviction
+// LRU: Entry::access is the clock in units of 2^lru_clock_shift ms, the
+// idle time is the unsigned difference (32 bits wrap after ~2 years).
+// LFU, like Redis: an 8 bit Morris counter that goes up by one with
+// probability 1 / ((count - lfu_init) * lfu_log_factor + 1), so ~1M hits
+// reach 255. it loses one per lfu_decay_ms without a hit, a key that was
+// hot once doesn't stay forever. the top 24 bits are the minute it was
+// last decayed
+const int lru_clock_shift = 4;
+const uint32_t lfu_init = 5; // new keys aren't the first to go
+const uint32_t lfu_log_factor = 10;
+const uint64_t lfu_decay_ms = 60 * 1000;
+const size_t evict_max_samples = 64;
+const int evict_tries = 4; // samples that came back empty (sparse table)
+
+static uint64_t cache_rand(Cache *cache) {
+    uint64_t x = cache->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return cache->rng = x;
+}
+
+static uint32_t lfu_minutes(Cache *cache) {
+    return (uint32_t)(cache->clock / lfu_decay_ms) & 0xffffff;
+}
+
+// the counter after the decay since it was last touched
+static uint32_t lfu_count(Cache *cache, uint32_t access) {
+    uint32_t elapsed = (lfu_minutes(cache) - (access >> 8)) & 0xffffff;
+    uint32_t count = access & 0xff;
+    return elapsed >= count ? 0 : count - elapsed;
+}
+
+static uint32_t lru_clock(Cache *cache) {
+    return (uint32_t)(cache->clock >> lru_clock_shift);
+}
+
+static uint32_t access_new(Cache *cache) {
+    if (cache->evict == EVICT_LFU) return lfu_minutes(cache) << 8 | lfu_init;
+    return lru_clock(cache);
+}
+
+void entry_touch(Cache *cache, Entry *entry) {
+    if (cache->evict == EVICT_LRU) {
+        entry->access = lru_clock(cache);
+    } else if (cache->evict == EVICT_LFU) {
+        uint32_t count = lfu_count(cache, entry->access);
+        if (count < 255) {
+            uint32_t base = count > lfu_init ? count - lfu_init : 0;
+            count += cache_rand(cache) % (base * lfu_log_factor + 1) == 0;
+        }
+        entry->access = lfu_minutes(cache) << 8 | count;
+    }
+}
+
+// bigger = better to evict
+static uint32_t evict_rank(Cache *cache, Entry *entry) {
+    if (cache->evict == EVICT_LFU) return 255 - lfu_count(cache, entry->access);
+    return lru_clock(cache) - entry->access;
+}
+
+// plan
+// 1. a few keys from a random spot of the map
+// 2. the one that ranks worst goes
+bool cache_evict(Cache *cache, size_t samples) {
+    assert(cache->evict != EVICT_NONE);
+    samples = std::min(std::max<size_t>(samples, 1), evict_max_samples);
+    HNode *nodes[evict_max_samples];
+    size_t n = 0;
+    for (int i = 0; n == 0 && i < evict_tries && hm_size(&cache->map) > 0; i++) {
+        n = hm_sample(&cache->map, cache_rand(cache), nodes, samples);
+    }
+    if (n == 0) return false;
+
+    Entry *victim = NULL;
+    uint32_t worst = 0;
+    for (size_t i = 0; i < n; i++) {
+        Entry *entry = container_of(nodes[i], Entry, node);
+        uint32_t rank = evict_rank(cache, entry);
+        if (!victim || rank > worst) {
+            victim = entry;
+            worst = rank;
+        }
+    }
+    cache_remove(cache, victim);
+    return true;
 }
 
 static size_t h_size(HTable *htab) {
@@ -172,6 +830,132 @@ static bool h_foreach(HTable *htab, bool (* fn)(HNode *, void *), void *arg) {
 
 // do the function
 void hm_foreach(HMap *map, bool (* fn)(HNode *, void *), void *arg) {
+    if (map->kind == HMAP_SWISS) {
+        s_foreach(&map->newer, fn, arg) && s_foreach(&map->older, fn, arg);
+        return;
+    }
     // loop new table, if fail, don't bother the old one
     h_foreach(&map->newer, fn, arg) && h_foreach(&map->older, fn, arg);  
 }
+
+////// scan
+// a cursor walks "buckets": a slot for chain, for swiss the keys whose
+// probe starts at one group. a key's bucket is the low bits of its hash
+// (swiss: of hash >> 7), so a bucket of a 2x table is one of the two
+// halves of a bucket of the smaller one. the cursor counts up with its
+// bits reversed (high bit first), which visits the buckets of any 2^n
+// table in an order where the buckets already done stay done when the
+// table grows or shrinks: nothing gets skipped across a resize, at worst
+// a key shows up twice.
+
+static uint64_t rev_bits(uint64_t v) {
+    v = ((v >> 1) & 0x5555555555555555) | ((v & 0x5555555555555555) << 1);
+    v = ((v >> 2) & 0x3333333333333333) | ((v & 0x3333333333333333) << 2);
+    v = ((v >> 4) & 0x0f0f0f0f0f0f0f0f) | ((v & 0x0f0f0f0f0f0f0f0f) << 4);
+    return __builtin_bswap64(v);
+}
+
+// +1 to the bits under mask, counted from the top
+static uint64_t scan_next(uint64_t cursor, uint64_t mask) {
+    cursor |= ~mask;
+    return rev_bits(rev_bits(cursor) + 1);
+}
+
+static uint64_t scan_mask(HMap *map, HTable *htab) {
+    if (map->kind == HMAP_SWISS) return (htab->mask + 1) / group_width - 1;
+    return htab->mask;
+}
+
+// swiss: probe from the group like a lookup would, and keep the keys
+// that started there
+static void s_scan_bucket(HTable *htab, size_t first, void (* fn)(HNode *, void *), void *arg) {
+    size_t groups = (htab->mask + 1) / group_width;
+    size_t group = first;
+    for (size_t step = 1; step <= groups; step++) {
+        uint8_t *ctrl = htab->ctrl + group * group_width;
+        for (uint32_t bits = ~group_match_free(ctrl) & 0xffff; bits; bits &= bits - 1) {
+            HNode *node = htab->table[group * group_width + __builtin_ctz(bits)];
+            if (s_first_group(htab, node->hashval) == first) fn(node, arg);
+        }
+        if (group_match(ctrl, ctrl_empty)) break;
+        group = (group + step) & (groups - 1);
+    }
+}
+
+static void scan_bucket(HMap *map, HTable *htab, uint64_t bucket, void (* fn)(HNode *, void *), void *arg) {
+    if (map->kind == HMAP_SWISS) return s_scan_bucket(htab, bucket, fn, arg);
+    for (HNode *cur = htab->table[bucket]; cur != NULL; cur = cur->next) {
+        fn(cur, arg);
+    }
+}
+
+// plan
+// 1. not resizing: the cursor's bucket, then the next cursor
+// 2. resizing: the cursor's bucket in the smaller table, then every bucket
+//    of the bigger one that's part of it. the next cursor is the one after
+//    the last of those
+uint64_t hm_scan(HMap *map, uint64_t cursor, void (* fn)(HNode *, void *), void *arg) {
+    if (!map->newer.table) return 0;
+    if (!map->older.table) {
+        uint64_t mask = scan_mask(map, &map->newer);
+        scan_bucket(map, &map->newer, cursor & mask, fn, arg);
+        return scan_next(cursor, mask);
+    }
+
+    HTable *small = &map->newer;
+    HTable *big = &map->older;
+    if (small->mask > big->mask) std::swap(small, big);
+    uint64_t small_mask = scan_mask(map, small);
+    uint64_t big_mask = scan_mask(map, big);
+    scan_bucket(map, small, cursor & small_mask, fn, arg);
+    do {
+        scan_bucket(map, big, cursor & big_mask, fn, arg);
+        cursor = scan_next(cursor, big_mask);
+    } while (cursor & (small_mask ^ big_mask));
+    return cursor;
+}
+
+// slots are taken in order from a random one, at most sample_span per
+// key wanted. a chain is taken whole (it's short)
+const size_t sample_span = 16;
+
+static size_t h_sample(HMap *map, HTable *htab, uint64_t rnd, HNode **out, size_t n) {
+    size_t got = 0;
+    size_t steps = std::min(htab->mask + 1, n * sample_span);
+    for (size_t i = 0; i < steps && got < n; i++) {
+        size_t pos = (rnd + i) & htab->mask;
+        if (map->kind == HMAP_SWISS) {
+            if (htab->ctrl[pos] < ctrl_empty) out[got++] = htab->table[pos];
+            continue;
+        }
+        for (HNode *cur = htab->table[pos]; cur != NULL && got < n; cur = cur->next) {
+            out[got++] = cur;
+        }
+    }
+    return got;
+}
+
+// resizing: one of the two tables, picked by how many keys it has
+size_t hm_sample(HMap *map, uint64_t rnd, HNode **out, size_t n) {
+    if (!map->newer.table) return 0;
+    HTable *htab = &map->newer;
+    size_t older = h_size(&map->older);
+    if (older > 0 && (rnd >> 32) % (older + map->newer.size) < older) {
+        htab = &map->older;
+    }
+    return h_sample(map, htab, rnd, out, n);
+}
+
+static size_t h_mem(HTable *htab) {
+    if (!htab->table) return 0;
+    return (htab->mask + 1) * sizeof(HNode *);
+}
+
+size_t hm_mem(HMap *map) {
+    if (map->kind == HMAP_SWISS) return s_mem(&map->newer) + s_mem(&map->older);
+    return h_mem(&map->newer) + h_mem(&map->older);
+}
+
+const char *hm_kind_name(HMapKind kind) {
+    return kind == HMAP_SWISS ? "swiss" : "chain";
+}
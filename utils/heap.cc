@@ -0,0 +1,74 @@
+#include <assert.h>
+
+#include "heap.h"
+
+static size_t heap_parent(size_t i) {
+    return (i + 1) / 2 - 1;
+}
+
+static size_t heap_left(size_t i) {
+    return i * 2 + 1;
+}
+
+// swap the item up while it's smaller than its parent
+static void heap_up(HeapItem *a, size_t pos) {
+    HeapItem item = a[pos];
+    while (pos > 0 && a[heap_parent(pos)].val > item.val) {
+        a[pos] = a[heap_parent(pos)];
+        *a[pos].ref = (uint32_t)pos;
+        pos = heap_parent(pos);
+    }
+    a[pos] = item;
+    *a[pos].ref = (uint32_t)pos;
+}
+
+// swap the item down with its smaller child while that one is smaller
+static void heap_down(HeapItem *a, size_t pos, size_t len) {
+    HeapItem item = a[pos];
+    while (true) {
+        size_t left = heap_left(pos);
+        size_t right = left + 1;
+        size_t min_pos = pos;
+        uint64_t min_val = item.val;
+        if (left < len && a[left].val < min_val) {
+            min_pos = left;
+            min_val = a[left].val;
+        }
+        if (right < len && a[right].val < min_val) {
+            min_pos = right;
+        }
+        if (min_pos == pos) break;
+        a[pos] = a[min_pos];
+        *a[pos].ref = (uint32_t)pos;
+        pos = min_pos;
+    }
+    a[pos] = item;
+    *a[pos].ref = (uint32_t)pos;
+}
+
+void heap_update(HeapItem *a, size_t pos, size_t len) {
+    if (pos > 0 && a[heap_parent(pos)].val > a[pos].val) {
+        heap_up(a, pos);
+    } else {
+        heap_down(a, pos, len);
+    }
+}
+
+void heap_push(std::vector<HeapItem> &heap, uint64_t val, uint32_t *ref) {
+    HeapItem item;
+    item.val = val;
+    item.ref = ref;
+    heap.push_back(item);
+    heap_update(heap.data(), heap.size() - 1, heap.size());
+}
+
+// the last item takes its place, then moves to where it belongs
+void heap_remove(std::vector<HeapItem> &heap, size_t pos) {
+    assert(pos < heap.size());
+    *heap[pos].ref = heap_none;
+    heap[pos] = heap.back();
+    heap.pop_back();
+    if (pos < heap.size()) {
+        heap_update(heap.data(), pos, heap.size());
+    }
+}
@@ -0,0 +1,48 @@
+#include "iopool.h"
+
+// checks of `round` before a helper goes to sleep. short: with fewer
+// cores than threads a spinning helper only delays the others
+const uint32_t io_spin = 1000;
+
+// wait for a round we haven't run yet, run our share, report done
+static void io_pool_helper(IoPool *pool, uint32_t idx) {
+    uint64_t seen = 0;
+    while (true) {
+        for (uint32_t i = 0; i < io_spin && pool->round.load(std::memory_order_acquire) == seen; i++) {
+        }
+        if (pool->round.load(std::memory_order_acquire) == seen) {
+            std::unique_lock<std::mutex> lock(pool->mu);
+            pool->cv.wait(lock, [&] { return pool->round.load(std::memory_order_relaxed) != seen; });
+        }
+        seen = pool->round.load(std::memory_order_acquire);
+        pool->fn(pool->arg, idx);
+        pool->busy.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void io_pool_init(IoPool *pool, uint32_t num_threads) {
+    pool->num_threads = num_threads;
+    for (uint32_t i = 1; i < num_threads; i++) {
+        pool->threads.emplace_back(io_pool_helper, pool, i);
+    }
+}
+
+// 1. publish the work, then the new round (under the lock, a helper
+//    about to sleep can't miss it)
+// 2. our own share
+// 3. wait for the helpers, yield: they may need this core
+void io_pool_run(IoPool *pool, void (*fn)(void *arg, uint32_t idx), void *arg) {
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->busy.store(pool->num_threads - 1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(pool->mu);
+        pool->round.fetch_add(1, std::memory_order_release);
+    }
+    pool->cv.notify_all();
+
+    fn(arg, 0);
+    while (pool->busy.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
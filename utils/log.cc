@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "log.h"
+
+const uint32_t log_rate_max = 100; // lines per second
+const size_t log_buf_max = 1 << 20; // waiting to be written, past that lines are dropped
+
+struct LogState {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::string buf; // guarded by mu
+    // the current second and the lines taken in it. racy on purpose: two
+    // threads crossing a second may both reset it, a line more or less
+    std::atomic<uint64_t> second{0};
+    std::atomic<uint32_t> lines{0};
+    std::atomic<uint64_t> dropped{0};
+};
+
+static LogState g_log;
+
+static uint64_t coarse_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts); // vDSO, no syscall
+    return (uint64_t)ts.tv_sec;
+}
+
+static void write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return; // nowhere to complain to
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// wake up for new lines, or once a second to report drops
+static void log_thread() {
+    std::string out;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(g_log.mu);
+            g_log.cv.wait_for(lock, std::chrono::seconds(1), [] { return !g_log.buf.empty(); });
+            out.swap(g_log.buf);
+        }
+        uint64_t dropped = g_log.dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped) {
+            char line[64];
+            snprintf(line, sizeof(line), "(%lu log lines dropped)\n", (unsigned long)dropped);
+            out += line;
+        }
+        write_all(STDOUT_FILENO, out.data(), out.size());
+        out.clear();
+    }
+}
+
+void log_init() {
+    std::thread(log_thread).detach();
+}
+
+bool log_allow() {
+    uint64_t now = coarse_sec();
+    if (g_log.second.load(std::memory_order_relaxed) != now) {
+        g_log.second.store(now, std::memory_order_relaxed);
+        g_log.lines.store(0, std::memory_order_relaxed);
+    }
+    if (g_log.lines.fetch_add(1, std::memory_order_relaxed) < log_rate_max) return true;
+    g_log.dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void log_printf(const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if ((size_t)len > sizeof(line) - 2) len = sizeof(line) - 2;
+    line[len++] = '\n';
+    {
+        std::lock_guard<std::mutex> lock(g_log.mu);
+        if (g_log.buf.size() + (size_t)len > log_buf_max) {
+            g_log.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        g_log.buf.append(line, (size_t)len);
+    }
+    g_log.cv.notify_one();
+}
@@ -0,0 +1,48 @@
+#include <stdlib.h>
+
+#include "mailbox.h"
+
+// empty queue = only the stub, head and tail both point to it
+void mailbox_init(Mailbox *box) {
+    box->stub.next.store(NULL, std::memory_order_relaxed);
+    box->head.store(&box->stub, std::memory_order_relaxed);
+    box->tail = &box->stub;
+}
+
+// 1. swap ourself in as the new head
+// 2. link the previous head to us
+// between 1 and 2 the list is broken for a moment, pop handles that
+void mailbox_push(Mailbox *box, MailNode *node) {
+    node->next.store(NULL, std::memory_order_relaxed);
+    MailNode *prev = box->head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+// 1. skip the stub if it is at the tail
+// 2. if tail has a next, tail is safe to hand out
+// 3. if tail is the last node, push the stub behind it so it gets a next
+MailNode *mailbox_pop(Mailbox *box) {
+    MailNode *tail = box->tail;
+    MailNode *next = tail->next.load(std::memory_order_acquire);
+    if (tail == &box->stub) {
+        if (next == NULL) return NULL; // empty
+        box->tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+        box->tail = next;
+        return tail;
+    }
+
+    // tail is not the head: a producer swapped the head but not linked yet
+    if (tail != box->head.load(std::memory_order_acquire)) return NULL;
+
+    mailbox_push(box, &box->stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        box->tail = next;
+        return tail;
+    }
+    return NULL;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "poller.h"
+
+const size_t ep_events_min = 64;
+
+static uint32_t to_epoll(Poller *poller, uint32_t events) {
+    uint32_t ep = 0;
+    if (events & EV_READ) ep |= EPOLLIN;
+    if (events & EV_WRITE) ep |= EPOLLOUT;
+    if (poller->edge_triggered) ep |= EPOLLET;
+    return ep; // EPOLLERR + EPOLLHUP are always reported
+}
+
+static uint32_t from_epoll(uint32_t ep) {
+    uint32_t events = 0;
+    if (ep & EPOLLIN) events |= EV_READ;
+    if (ep & EPOLLOUT) events |= EV_WRITE;
+    if (ep & (EPOLLERR | EPOLLHUP)) events |= EV_ERR;
+    return events;
+}
+
+static short to_poll(uint32_t events) {
+    short pev = POLLERR;
+    if (events & EV_READ) pev |= POLLIN;
+    if (events & EV_WRITE) pev |= POLLOUT;
+    return pev;
+}
+
+static uint32_t from_poll(short pev) {
+    uint32_t events = 0;
+    if (pev & POLLIN) events |= EV_READ;
+    if (pev & POLLOUT) events |= EV_WRITE;
+    if (pev & (POLLERR | POLLHUP | POLLNVAL)) events |= EV_ERR;
+    return events;
+}
+
+bool poller_init(Poller *poller, PollerBackend backend, bool edge_triggered) {
+    poller->backend = backend;
+    poller->edge_triggered = false;
+    if (backend == BACKEND_POLL) return true;
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        return false;
+    }
+    poller->epfd = epfd;
+    poller->edge_triggered = edge_triggered;
+    poller->ep_events.resize(ep_events_min);
+    return true;
+}
+
+static void epoll_ctl_or_die(Poller *poller, int op, int fd, uint32_t events) {
+    struct epoll_event ev = {};
+    ev.events = to_epoll(poller, events);
+    ev.data.fd = fd;
+    poller->syscalls++;
+    if (epoll_ctl(poller->epfd, op, fd, &ev) == -1) {
+        perror("epoll_ctl");
+        abort();
+    }
+}
+
+void poller_add(Poller *poller, int fd, uint32_t events) {
+    assert(fd >= 0);
+    if (poller->backend == BACKEND_EPOLL) {
+        return epoll_ctl_or_die(poller, EPOLL_CTL_ADD, fd, events);
+    }
+
+    if (poller->fd_idx.size() <= (size_t)fd) {
+        poller->fd_idx.resize(fd + 1, -1);
+    }
+    assert(poller->fd_idx[fd] == -1);
+    poller->fd_idx[fd] = (int)poller->pfds.size();
+    poller->pfds.push_back(pollfd{fd, to_poll(events), 0});
+}
+
+void poller_mod(Poller *poller, int fd, uint32_t events) {
+    if (poller->backend == BACKEND_EPOLL) {
+        return epoll_ctl_or_die(poller, EPOLL_CTL_MOD, fd, events);
+    }
+    assert((size_t)fd < poller->fd_idx.size() && poller->fd_idx[fd] != -1);
+    poller->pfds[poller->fd_idx[fd]].events = to_poll(events);
+}
+
+// poll: swap the last pollfd into the hole, so the array stays dense
+void poller_del(Poller *poller, int fd) {
+    if (poller->backend == BACKEND_EPOLL) {
+        // the event arg is ignored but old kernels want non-NULL
+        return epoll_ctl_or_die(poller, EPOLL_CTL_DEL, fd, 0);
+    }
+    assert((size_t)fd < poller->fd_idx.size() && poller->fd_idx[fd] != -1);
+    int idx = poller->fd_idx[fd];
+    struct pollfd last = poller->pfds.back();
+    poller->pfds[idx] = last;
+    poller->fd_idx[last.fd] = idx;
+    poller->pfds.pop_back();
+    poller->fd_idx[fd] = -1;
+}
+
+int poller_wait(Poller *poller, std::vector<PollerEvent> &out, int timeout_ms) {
+    out.clear();
+    poller->syscalls++;
+    if (poller->backend == BACKEND_EPOLL) {
+        int n = epoll_wait(poller->epfd, poller->ep_events.data(),
+                           (int)poller->ep_events.size(), timeout_ms);
+        if (n < 0) return -1;
+        for (int i = 0; i < n; i++) {
+            struct epoll_event &ev = poller->ep_events[i];
+            out.push_back(PollerEvent{ev.data.fd, from_epoll(ev.events)});
+        }
+        // got a full batch, there might be more. grow for next time
+        if ((size_t)n == poller->ep_events.size()) {
+            poller->ep_events.resize(poller->ep_events.size() * 2);
+        }
+        return n;
+    }
+
+    int n = poll(poller->pfds.data(), (nfds_t)poller->pfds.size(), timeout_ms);
+    if (n < 0) return -1;
+    for (size_t i = 0; i < poller->pfds.size() && out.size() < (size_t)n; i++) {
+        struct pollfd &pfd = poller->pfds[i];
+        if (pfd.revents == 0) continue;
+        out.push_back(PollerEvent{pfd.fd, from_poll(pfd.revents)});
+    }
+    return n;
+}
+
+const char *poller_name(Poller *poller) {
+    if (poller->backend == BACKEND_POLL) return "poll";
+    return poller->edge_triggered ? "epoll (edge-triggered)" : "epoll";
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <new>
+
+#include "slab.h"
+
+// objects start after the header, 16-byte aligned
+const size_t slab_page_hdr = (sizeof(SlabPage) + 15) & ~(size_t)15;
+
+static size_t slab_class(size_t len) {
+    if (len <= slab_min_obj) return 0;
+    return (len - slab_min_obj + slab_step - 1) / slab_step;
+}
+
+size_t slab_size(size_t len) {
+    if (len > slab_max_obj) return len;
+    return slab_min_obj + slab_class(len) * slab_step;
+}
+
+static void page_unlink(SlabPage **list, SlabPage *page) {
+    if (page->prev) page->prev->next = page->next;
+    else *list = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->prev = page->next = NULL;
+}
+
+static void page_push(SlabPage **list, SlabPage *page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list) (*list)->prev = page;
+    *list = page;
+}
+
+static SlabPage *page_new(Slab *slab, size_t cls) {
+    void *mem = aligned_alloc(slab_page_size, slab_page_size);
+    if (!mem) {
+        perror("aligned_alloc(slab page)");
+        abort();
+    }
+    size_t size = slab_min_obj + cls * slab_step;
+    SlabPage *page = new (mem) SlabPage();
+    page->cls = (uint32_t)cls;
+    page->bump = (uint8_t *)mem + slab_page_hdr;
+    // the tail that doesn't fit a whole object is never used
+    page->end = page->bump + (slab_page_size - slab_page_hdr) / size * size;
+    slab->num_pages++;
+    return page;
+}
+
+// plan
+// 1. big objects: malloc
+// 2. the first page of the class with room, or a new one
+// 3. its free list first, then carve from the bump
+// 4. a page with no room left moves to the full list
+void *slab_alloc(Slab *slab, size_t len) {
+    size_t size = slab_size(len);
+    slab->used_bytes += size;
+    if (len > slab_max_obj) {
+        slab->big_bytes += size;
+        return malloc(size);
+    }
+
+    SlabClass *cls = &slab->classes[slab_class(len)];
+    if (!cls->partial) {
+        page_push(&cls->partial, page_new(slab, slab_class(len)));
+    }
+    SlabPage *page = cls->partial;
+    void *obj;
+    if (page->free_list) {
+        obj = page->free_list;
+        page->free_list = *(void **)obj;
+    } else {
+        obj = page->bump;
+        page->bump += size;
+    }
+    page->live++;
+    if (!page->free_list && page->bump == page->end) {
+        page_unlink(&cls->partial, page);
+        page_push(&cls->full, page);
+    }
+    return obj;
+}
+
+// plan
+// 1. big objects: free
+// 2. back on its page's free list, a full page has room again
+// 3. an empty page goes back to malloc if the class has another with room
+void slab_free(Slab *slab, void *ptr, size_t len) {
+    size_t size = slab_size(len);
+    assert(slab->used_bytes >= size);
+    slab->used_bytes -= size;
+    if (len > slab_max_obj) {
+        slab->big_bytes -= size;
+        return free(ptr);
+    }
+
+    SlabClass *cls = &slab->classes[slab_class(len)];
+    SlabPage *page = (SlabPage *)((uintptr_t)ptr & ~(uintptr_t)(slab_page_size - 1));
+    assert(page->cls == slab_class(len) && page->live > 0);
+    if (!page->free_list && page->bump == page->end) {
+        page_unlink(&cls->full, page);
+        page_push(&cls->partial, page);
+    }
+    *(void **)ptr = page->free_list;
+    page->free_list = ptr;
+    page->live--;
+    if (page->live == 0 && (page->prev || page->next)) {
+        page_unlink(&cls->partial, page);
+        free(page);
+        slab->num_pages--;
+    }
+}
+
+size_t slab_mem(Slab *slab) {
+    return slab->num_pages * slab_page_size + slab->big_bytes;
+}
+
+static void free_pages(SlabPage *page) {
+    while (page) {
+        SlabPage *next = page->next;
+        free(page);
+        page = next;
+    }
+}
+
+void slab_destroy(Slab *slab) {
+    for (SlabClass &cls : slab->classes) {
+        free_pages(cls.partial);
+        free_pages(cls.full);
+        cls = SlabClass{};
+    }
+    slab->num_pages = 0;
+    slab->used_bytes = 0;
+}
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// 1. io_uring_setup, the kernel tells us the ring layout in params
+// 2. mmap the SQ ring, CQ ring (same mapping with SINGLE_MMAP) and sqes
+// 3. keep pointers to head/tail/mask/array inside the mappings
+bool uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = sys_io_uring_setup(entries, &params);
+    if (fd < 0) {
+        return false;
+    }
+    ring->fd = fd;
+
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_ring_len > ring->sq_ring_len) {
+        ring->sq_ring_len = ring->cq_ring_len;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        perror("mmap(sq ring)");
+        close(fd);
+        return false;
+    }
+    ring->cq_ring = ring->sq_ring;
+    if (!single_mmap) {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            perror("mmap(cq ring)");
+            munmap(ring->sq_ring, ring->sq_ring_len);
+            close(fd);
+            return false;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("mmap(sqes)");
+        uring_destroy(ring);
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t *)ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sqe_tail = *ring->sq_tail;
+
+    uint8_t *cq = (uint8_t *)ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+void uring_destroy(Uring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_len);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_len);
+    if (ring->fd >= 0) close(ring->fd);
+    *ring = Uring{};
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        uring_submit(ring, 0);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sqe_tail - head >= ring->sq_entries) {
+            fprintf(stderr, "io_uring: submission queue stuck full\n");
+            abort();
+        }
+    }
+    unsigned idx = ring->sqe_tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+// publish the local tail, then one io_uring_enter does submit + wait
+int uring_submit(Uring *ring, unsigned wait_nr) {
+    unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    if (to_submit == 0 && wait_nr == 0) return 0;
+
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    ring->syscalls++;
+    int rv = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags);
+    return rv < 0 ? -errno : rv;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// the ring of buffer descriptors has to be page aligned, so mmap it
+bool uring_buf_ring_init(Uring *ring, UringBufRing *br, uint16_t bgid,
+                         uint32_t entries, uint32_t buf_len) {
+    // entries must be 2^n
+    if (entries == 0 || (entries & (entries - 1)) != 0) return false;
+    size_t ring_len = entries * sizeof(struct io_uring_buf);
+    void *mem = mmap(NULL, ring_len, PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap(buf ring)");
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)mem;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(mem, ring_len);
+        return false;
+    }
+
+    br->ring = (struct io_uring_buf_ring *)mem;
+    br->bufs = (uint8_t *)malloc((size_t)entries * buf_len);
+    br->entries = entries;
+    br->buf_len = buf_len;
+    br->bgid = bgid;
+    br->tail = 0;
+    for (uint32_t i = 0; i < entries; i++) {
+        uring_buf_recycle(br, (uint16_t)i);
+    }
+    return true;
+}
+
+uint8_t *uring_buf(UringBufRing *br, uint16_t bid) {
+    return br->bufs + (size_t)bid * br->buf_len;
+}
+
+// put the buffer back at the tail, kernel sees it after the tail store
+// note: index the ring as a plain io_uring_buf array, in C++ the header's
+// flexible `bufs` member doesn't land at offset 0
+void uring_buf_recycle(UringBufRing *br, uint16_t bid) {
+    struct io_uring_buf *slots = (struct io_uring_buf *)br->ring;
+    struct io_uring_buf *buf = &slots[br->tail & (br->entries - 1)];
+    buf->addr = (uint64_t)uring_buf(br, bid);
+    buf->len = br->buf_len;
+    buf->bid = bid;
+    br->tail++;
+    __atomic_store_n(&br->ring->tail, br->tail, __ATOMIC_RELEASE);
+}
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, uint16_t bgid) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+}
+
+void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *buf, size_t len) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void uring_prep_poll_multishot(struct io_uring_sqe *sqe, int fd, uint32_t poll_mask) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = poll_mask;
+    sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, uint32_t poll_mask) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = poll_mask;
+}
+
+// ts is read when the sqe is submitted, it only has to live until then
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)ts;
+    sqe->len = 1;
+    sqe->off = 0; // fire on time only, not after n completions
+}
+
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+}
+
+// 1. socketpair, one byte waiting on one end
+// 2. multishot recv with a 1 entry buffer ring on the other end
+// 3. supported if the completion has data + F_MORE (or at least data)
+bool uring_probe_multishot(void) {
+    Uring ring;
+    if (!uring_init(&ring, 4)) return false;
+
+    bool ok = false;
+    int sv[2];
+    UringBufRing br;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0) {
+        if (uring_buf_ring_init(&ring, &br, 0, 1, 64) && write(sv[0], "x", 1) == 1) {
+            struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+            uring_prep_recv_multishot(sqe, sv[1], 0);
+            if (uring_submit(&ring, 1) >= 0) {
+                struct io_uring_cqe *cqe = uring_peek_cqe(&ring);
+                ok = cqe && cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER);
+            }
+            free(br.bufs);
+            munmap(br.ring, br.entries * sizeof(struct io_uring_buf));
+        }
+        close(sv[0]);
+        close(sv[1]);
+    }
+    uring_destroy(&ring);
+    return ok;
+}
@@ -8,6 +8,8 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 
+#include <utility>
+
 #include "util.h"
 
 int32_t recv_all(int connfd, char *buff, size_t bytes) {
@@ -37,3 +39,71 @@ int32_t send_all(int connfd, char *msg, size_t bytes) {
     }
     return 0;
 }
+
+// [...] at pattern[p] (just past the '['), against byte c. moves p past
+// the closing ']' (an unclosed set runs to the end of the pattern)
+static bool glob_set(std::string_view pattern, size_t &p, char c) {
+    bool negate = p < pattern.size() && pattern[p] == '^';
+    if (negate) p++;
+    bool found = false;
+    while (p < pattern.size() && pattern[p] != ']') {
+        if (pattern[p] == '\\' && p + 1 < pattern.size()) p++;
+        char lo = pattern[p];
+        char hi = lo;
+        if (p + 2 < pattern.size() && pattern[p + 1] == '-' && pattern[p + 2] != ']') {
+            hi = pattern[p + 2];
+            p += 2;
+        }
+        if (lo > hi) std::swap(lo, hi);
+        if (c >= lo && c <= hi) found = true;
+        p++;
+    }
+    if (p < pattern.size()) p++; // the ']'
+    return found != negate;
+}
+
+// plan
+// 1. match byte by byte
+// 2. on *, remember where it was and how much of str it took so far
+// 3. on a mismatch, let the last * take one more byte and retry from
+//    there. no backtracking past it is needed: a later * can take over
+//    anything an earlier one would
+bool glob_match(std::string_view pattern, std::string_view str) {
+    size_t p = 0, s = 0;
+    size_t star_p = std::string_view::npos, star_s = 0;
+    while (s < str.size()) {
+        if (p < pattern.size()) {
+            char pc = pattern[p];
+            if (pc == '*') {
+                star_p = ++p;
+                star_s = s;
+                continue;
+            }
+            if (pc == '?') {
+                p++;
+                s++;
+                continue;
+            }
+            if (pc == '[') {
+                size_t next = p + 1;
+                if (glob_set(pattern, next, str[s])) {
+                    p = next;
+                    s++;
+                    continue;
+                }
+            } else {
+                if (pc == '\\' && p + 1 < pattern.size()) pc = pattern[++p];
+                if (pc == str[s]) {
+                    p++;
+                    s++;
+                    continue;
+                }
+            }
+        }
+        if (star_p == std::string_view::npos) return false;
+        p = star_p;
+        s = ++star_s;
+    }
+    while (p < pattern.size() && pattern[p] == '*') p++;
+    return p == pattern.size();
+}
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "value.h"
+#include "bgpool.h"
+
+// see value_lazy_free, set before the threads start
+static BgPool *g_lazy_pool = NULL;
+static size_t g_lazy_min = 0;
+static std::atomic<uint64_t> g_lazy_freed{0};
+
+// flexible array again, so malloc + placement new for the atomic
+Value *value_new(const char *data, size_t len) {
+    Value *value = (Value *)malloc(sizeof(Value) + len);
+    new (&value->refs) std::atomic<uint32_t>(1);
+    value->len = len;
+    memcpy(value->data, data, len);
+    return value;
+}
+
+void value_ref(Value *value) {
+    value->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+// acq_rel: whoever frees must see every write done under the other refs
+void value_unref(Value *value) {
+    if (value->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    if (g_lazy_pool && value->len >= g_lazy_min) {
+        g_lazy_freed.fetch_add(1, std::memory_order_relaxed);
+        bg_submit(g_lazy_pool, free, value);
+        return;
+    }
+    free(value);
+}
+
+void value_lazy_free(BgPool *pool, size_t min_len) {
+    g_lazy_pool = pool;
+    g_lazy_min = min_len;
+}
+
+uint64_t value_lazy_freed() {
+    return g_lazy_freed.load(std::memory_order_relaxed);
+}
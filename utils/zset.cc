@@ -3,7 +3,6 @@
 #include <string.h>
 
 #include "common.h"
-#include "buffer.h"
 #include "zset.h"
 
 // initialize new node with correct value
@@ -131,6 +130,7 @@ bool zset_insert(ZSet *zset, const char *name, size_t len, double score) {
         return false; // insert fail, but still update
     }
     ZNode *new_node = znode_new(name, len, score);
+    zset->node_bytes += sizeof(ZNode) + len;
     zset_tree_insert(zset, new_node);
     hm_insert(&zset->map, &new_node->hnode);
     return true;
@@ -152,6 +152,7 @@ void zset_delete(ZSet *zset, ZNode *node) {
     };
     HNode *detached_hnode = hm_delete(&zset->map, &dummy.hnode, &hnodecmp); 
     assert(detached_hnode);
+    zset->node_bytes -= sizeof(ZNode) + node->len;
     znode_destroy(container_of(detached_hnode, ZNode, hnode));
 }
 